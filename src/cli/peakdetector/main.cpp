@@ -96,7 +96,11 @@ int main(int argc, char *argv[]) {
 	//process all mass slices
 	if (peakdetectorCLI->mavenParameters->processAllSlices == true) {
 		peakdetectorCLI->mavenParameters->matchRtFlag = false;
-		peakdetectorCLI->peakDetector->processMassSlices();
+		if (peakdetectorCLI->streamReport && peakdetectorCLI->pollyArgs.isEmpty()) {
+			peakdetectorCLI->streamMassSlices("compounds");
+		} else {
+			peakdetectorCLI->peakDetector->processMassSlices();
+		}
 	}
 
 	//write report
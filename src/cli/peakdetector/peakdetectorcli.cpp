@@ -17,6 +17,9 @@ PeakDetectorCLI::PeakDetectorCLI(Logger* log, Analytics* analytics)
     mavenParameters = new MavenParameters();
     peakDetector = new PeakDetector();
     saveJsonEIC = false;
+    cacheSamples = false;
+    mzRtIndexMemory = 0;
+    streamReport = false;
     quantitationType = PeakGroup::AreaTop;
     clsfModelFilename = "default.model";
     alignMode = AlignmentMode::None;
@@ -196,10 +199,26 @@ void PeakDetectorCLI::processOptions(int argc, char* argv[])
             mavenParameters->quantileQuality = atof(optarg);
             break;
 
+        case 'R':
+            streamReport = atoi(optarg) != 0;
+            break;
+
         case 'r':
             mavenParameters->rtStepSize = atoi(optarg);
             break;
 
+        case 's':
+            cacheSamples = atoi(optarg) != 0;
+            break;
+
+        case 'M':
+            mzRtIndexMemory = max(atoi(optarg), 0);
+            break;
+
+        case 'U':
+            mavenParameters->isotopeEicMarginScans = max(atoi(optarg), 0);
+            break;
+
         case 'v':
             mavenParameters->ionizationMode = atoi(optarg);
             break;
@@ -208,6 +227,10 @@ void PeakDetectorCLI::processOptions(int argc, char* argv[])
             mavenParameters->minNoNoiseObs = atoi(optarg);
             break;
 
+        case 'W':
+            mavenParameters->windowedIsotopeEicFlag = atoi(optarg) != 0;
+            break;
+
         case 'x':
             if (!optarg) {
                 processXML("config.xml");
@@ -395,6 +418,14 @@ void PeakDetectorCLI::_processPeaksArgsXML(xml_node& peaksArgs)
                     mavenParameters->D2Labeled_BPE = false;
             }
 
+        } else if (strcmp(node.name(), "windowedIsotopeEic") == 0) {
+            mavenParameters->windowedIsotopeEicFlag =
+                atoi(node.attribute("value").value()) != 0;
+
+        } else if (strcmp(node.name(), "isotopeEicMarginScans") == 0) {
+            mavenParameters->isotopeEicMarginScans =
+                max(atoi(node.attribute("value").value()), 0);
+
         } else if (strcmp(node.name(), "grouping_maxRtWindow") == 0) {
             mavenParameters->grouping_maxRtWindow =
                 atof(node.attribute("value").value());
@@ -521,6 +552,15 @@ void PeakDetectorCLI::_processGeneralArgsXML(xml_node& generalArgs)
             if (atoi(node.attribute("value").value()) == 0)
                 saveJsonEIC = false;
 
+        } else if (strcmp(node.name(), "cacheSamples") == 0) {
+            cacheSamples = atoi(node.attribute("value").value()) != 0;
+
+        } else if (strcmp(node.name(), "mzRtIndexMemory") == 0) {
+            mzRtIndexMemory = max(atoi(node.attribute("value").value()), 0);
+
+        } else if (strcmp(node.name(), "streamReport") == 0) {
+            streamReport = atoi(node.attribute("value").value()) != 0;
+
         } else if (strcmp(node.name(), "outputdir") == 0) {
             mavenParameters->outputdir =
                 node.attribute("value").value() + string(DIR_SEPARATOR_STR);
@@ -619,6 +659,8 @@ void PeakDetectorCLI::loadSamples(vector<string>& filenames)
 
     for (unsigned int i = 0; i < filenames.size(); i++) {
         mzSample* sample = new mzSample();
+        sample->setSampleCaching(cacheSamples);
+        sample->setMzRtIndexLimit(size_t(mzRtIndexMemory) * 1024 * 1024);
         sample->loadSample(filenames[i].c_str());
         sample->sampleName = mzUtils::cleanFilename(filenames[i]);
         sample->isSelected = true;
@@ -1038,6 +1080,92 @@ void PeakDetectorCLI::_groupReduction()
     }
 }
 
+void PeakDetectorCLI::streamMassSlices(string setName)
+{
+#ifndef __APPLE__
+    double startDetection = getTime();
+#endif
+
+    mzUtils::createDir(mavenParameters->outputdir.c_str());
+    string fileName = mavenParameters->outputdir + setName;
+
+    CSVReports csvreports(mavenParameters->samples, false);
+    csvreports.setMavenParameters(mavenParameters);
+    csvreports.setUserQuantType(quantitationType);
+    csvreports.openGroupReport(fileName + ".csv", false);
+
+    JSONReports* jsonReports = nullptr;
+    if (saveJsonEIC) {
+        jsonReports = new JSONReports(mavenParameters);
+        jsonReports->openFile(fileName + ".json", mavenParameters->samples);
+    }
+
+    // rt range and intensity of the groups written so far, by m/z
+    struct WrittenGroup {
+        float minRt;
+        float maxRt;
+        float maxIntensity;
+    };
+    multimap<float, WrittenGroup> written;
+    MassCutoff* massCutoff = mavenParameters->massCutoffMerge;
+    auto isDuplicate = [&](PeakGroup& group) {
+        float window = massCutoff->getMassCutoff() / 1e3;
+        if (massCutoff->getMassCutoffType() == "ppm")
+            window = group.meanMz * massCutoff->getMassCutoff() / 1e6;
+
+        auto itr = written.lower_bound(group.meanMz - 2 * window);
+        auto end = written.upper_bound(group.meanMz + 2 * window);
+        for (; itr != end; itr++) {
+            const WrittenGroup& other = itr->second;
+            float masscutoffdist = massCutoffDist(itr->first,
+                                                  group.meanMz,
+                                                  massCutoff);
+            float rtoverlap = mzUtils::checkOverlap(other.minRt,
+                                                    other.maxRt,
+                                                    group.minRt,
+                                                    group.maxRt);
+            if (masscutoffdist < massCutoff->getMassCutoff()
+                && rtoverlap > 0.8
+                && group.maxIntensity <= other.maxIntensity)
+                return true;
+        }
+        return false;
+    };
+
+    int groupCount = 0;
+    peakDetector->setGroupSink([&](PeakGroup& group) {
+        if (_reduceGroupsFlag) {
+            if (isDuplicate(group))
+                return;
+            written.insert(make_pair(
+                group.meanMz,
+                WrittenGroup{group.minRt, group.maxRt, group.maxIntensity}));
+        }
+
+        csvreports.addGroup(&group);
+        if (jsonReports != nullptr)
+            jsonReports->addGroup(group);
+        groupCount++;
+    });
+    peakDetector->processMassSlices();
+    peakDetector->setGroupSink(nullptr);
+
+    csvreports.closeFiles();
+    _log->info() << "Wrote " << groupCount << " groups to CSV output file: "
+                 << fileName << ".csv" << std::flush;
+    if (jsonReports != nullptr) {
+        jsonReports->closeFile();
+        delete jsonReports;
+        _log->info() << "JSON output file: " << fileName << ".json"
+                     << std::flush;
+    }
+
+#ifndef __APPLE__
+    cout << "Execution time (streaming detection): "
+         << getTime() - startDetection << " seconds.\n";
+#endif
+}
+
 void PeakDetectorCLI::saveJson(string setName)
 {
     if (saveJsonEIC) {
@@ -1314,8 +1442,9 @@ void PeakDetectorCLI::saveCSV(string setName, bool pollyExport)
                               csvreports->groupId + 1)) {
                 PeakGroup newGroup = group;
                 Compound* compound = group.getCompound();
-                float compoundMz = MassCalculator::computeMass(
-                    compound->formula(), mavenParameters->getCharge(compound));
+                float compoundMz = MassCalculator::adjustMass(
+                    compound->parsedFormula()->neutralMass,
+                    mavenParameters->getCharge(compound));
                 float cutoffDist = massCutoffDist(
                     group.meanMz, compoundMz, mavenParameters->massCutoffMerge);
                 if (cutoffDist
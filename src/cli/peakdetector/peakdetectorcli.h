@@ -66,6 +66,9 @@ public:
     MavenParameters* mavenParameters;
     PeakDetector* peakDetector;
     bool saveJsonEIC;
+    bool cacheSamples;
+    int mzRtIndexMemory;
+    bool streamReport;
     PeakGroup::QType quantitationType;
     string clsfModelFilename;
     QString pollyArgs;
@@ -126,6 +129,23 @@ public:
      */
     void writeReport(string setName, QString jsPath, QString nodePath);
 
+    /**
+     * @brief Perform untargeted detection, writing every group to the CSV
+     * (and JSON) report as soon as it is found.
+     * @details Memory stays bounded by a batch of slices instead of growing
+     * with the number of groups. Since groups are never all in memory, they
+     * are not reduced as in reduceGroups: a group is dropped if a group
+     * written before it overlaps it and is at least as intense, but a group
+     * can no longer be dropped once written, not even for a more intense
+     * duplicate found later. The reports therefore differ from those of
+     * processMassSlices followed by writeReport whenever duplicates are
+     * found in order of increasing intensity, and groups are listed in the
+     * order they are found instead of by m/z. Reports are saved in the
+     * output folder only, never uploaded to Polly.
+     * @param setName name of the reports, without extension
+     */
+    void streamMassSlices(string setName);
+
     /**
      * @brief save output in a json file
      * @param setName file name with full path
@@ -167,15 +187,20 @@ public:
             "I?quantileIntensity: Specify required percentage of peaks above the intensity threshold. <float>",
             "j?saveEicJson: Enter non-zero integer to save EIC JSON in the output folder. <int>",
             "k?charge: Enter the magnitude of charge on each compound. <int>",
+            "M?mzRtIndexMemory: Enter the memory in MB each sample may use for an m/z-rt index of its MS1 data, which speeds up EIC extraction. 0 disables the index. <int>",
             "m?model: Enter full path to the model file. <string>",
             "n?eicMaxGroups: Enter maximum number of groups reported per compound. <int>",
             "o?outputdir: Enter full path to output folder. <string>",
             "p?ppmMerge: Enter ppm window for untargeted peak detection and removing duplicate groups. <float>",
             "q?minQuality: Enter min peak quality threshold for a group. <float>",
             "Q?quantileQuality: Specify required percentage of peaks above quality threshold. <float>",
+            "R?streamReport: Enter non-zero integer to write the groups of untargeted detection to the reports as they are found, instead of keeping all of them in memory. The reports can then differ from those written without it: groups are written in the order they are found instead of by m/z, and a duplicate group is only dropped if a group written before it is at least as intense, so more intense duplicates found later are written as well. <int>",
             "r?rtStepSize: Enter retention time window for untargeted peak detection. <float>",
+            "s?cacheSamples: Enter non-zero integer to keep a binary copy of every sample next to it (<sample>.emcache), which later runs load instead of parsing the sample. <int>",
+            "U?isotopeEicMarginScans: Enter number of scans added on either side of the parent peak when isotope EICs are pulled around it (see -W). <int>",
             "v?ionizationMode: Enter 0, -1 or 1 ionization mode. <int>",
             "w?minPeakWidth: Enter min peak width threshold in a group. <int>",
+            "W?windowedIsotopeEic: Enter non-zero integer to pull isotope EICs only around the retention time window of their parent peak. Faster, but peak areas and baselines of isotopes are then computed over the shorter EIC. <int>",
             "x?xml: Enter full path to the config file or a settings file from El-MAVEN. <string>",
             "X?defaultXml: Create a template config file.",
             "y?eicSmoothingWindow: Enter number of scans used for smoothing at a time. <int>",
@@ -264,6 +289,9 @@ struct Arguments
     void populateArgs() {
         generalArgs << "int" << "alignSamples" << "0";
         generalArgs << "int" << "saveEicJson" << "0";
+        generalArgs << "int" << "cacheSamples" << "0";
+        generalArgs << "int" << "mzRtIndexMemory" << "0";
+        generalArgs << "int" << "streamReport" << "0";
         generalArgs << "string" << "outputdir" << "0";
         generalArgs << "string" << "pollyExtra" << "";
         generalArgs << "string" << "samples" << "path/to/sample1";
@@ -275,6 +303,8 @@ struct Arguments
         peakDialogArgs << "string" << "Db" << "0";
         peakDialogArgs << "int" << "processAllSlices" << "0";
         peakDialogArgs << "int" << "pullIsotopes" << "0";
+        peakDialogArgs << "int" << "windowedIsotopeEic" << "0";
+        peakDialogArgs << "int" << "isotopeEicMarginScans" << "50";
         peakDialogArgs << "float" << "grouping_maxRtWindow" << "0.5";
         peakDialogArgs << "float" << "minGroupIntensity" << "5000";
         peakDialogArgs << "float" << "quantileIntensity" << "0.0";
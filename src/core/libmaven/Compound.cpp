@@ -12,10 +12,10 @@ Compound::Compound(string id, string name, string formula, int charge ) {
     this->charge = charge;
     /**
     *@brief  -   calculate mass of compound by its formula and assign it to mass
-    *@see  - double MassCalculator::computeNeutralMass(string formula) in mzMassCalculator.cpp
+    *@see  - MassCalculator::parseFormula(const string& formula) in mzMassCalculator.cpp
     */
-    this->mass =  MassCalculator::computeNeutralMass(_formula);
-    this->neutralMass = MassCalculator::computeNeutralMass(_formula);
+    this->mass =  _parsedFormula->neutralMass;
+    this->neutralMass = _parsedFormula->neutralMass;
     this->expectedRt = -1;
     this->logP = 0;
 
@@ -72,13 +72,19 @@ bool Compound::operator == (const Compound& rhs) const
             && type() == rhs.type());
 }
 
+void Compound::setFormula(string formula)
+{
+    _formula = filterFormula(formula);
+    _parsedFormula = MassCalculator::parseFormula(_formula);
+}
+
 float Compound::adjustedMass(int charge) { 
      /**   
     *@return    -    total mass by formula minus loss of electrons' mass 
     *@see  -  double MassCalculator::computeMass(string formula, int charge) in mzMassCalculator.cpp
     */
      if (!_formula.empty()) {
-        return MassCalculator::computeMass(_formula, charge);
+        return MassCalculator::adjustMass(_parsedFormula->neutralMass, charge);
      } else if (neutralMass != 0.0f) {
          return MassCalculator::adjustMass(neutralMass, charge);
      }
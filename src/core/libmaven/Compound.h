@@ -5,6 +5,7 @@
 #include "standardincludes.h"
 #include "PeakGroup.h"
 
+class ParsedFormula;
 class Reaction;
 class FragmentationMatchScore;
 class Fragment;
@@ -35,6 +36,12 @@ class Compound{
          */
         string _formula;
 
+        /**
+         * Interned parse of the formula, shared by all compounds with the
+         * same formula.
+         */
+        const ParsedFormula* _parsedFormula;
+
     public:
         enum class Type {
             MS1,
@@ -89,7 +96,12 @@ class Compound{
          * @param formula Ideally, an alpha-numeric string, representing a valid
          * chemical formula.
          */
-        void setFormula(string formula) { _formula = filterFormula(formula); }
+        void setFormula(string formula);
+
+        /**
+         * @brief Element counts and neutral mass of the formula, parsed once.
+         */
+        const ParsedFormula* parsedFormula() const { return _parsedFormula; }
 
         /**
          * @brief Filters an arbitrary string and gets rid of any characters
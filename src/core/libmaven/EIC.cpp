@@ -1,10 +1,12 @@
 #include "EIC.h"
+#include "eicpool.h"
 #include "Peak.h"
 #include "PeakGroup.h"
 #include "mzPatterns.h"
 #include "mzSample.h"
 #include "SavGolSmoother.h"
 #include "Scan.h"
+#include "mzrtindex.h"
 
 /**
  * @file EIC.cpp
@@ -13,8 +15,34 @@
  * @author Sahil
  * @version 769
  */
+atomic<size_t> EIC::_bufferAllocations(0);
+
 EIC::EIC()
 {
+    _splineBuffer = NULL;
+    _splineCapacity = 0;
+    _baselineBuffer = NULL;
+    _baselineCapacity = 0;
+    reset();
+}
+
+EIC::~EIC()
+{
+    delete[] _splineBuffer;
+    delete[] _baselineBuffer;
+    spline = NULL;
+    baseline = NULL;
+    peaks.clear();
+}
+
+void EIC::reset()
+{
+    scannum.clear();
+    rt.clear();
+    mz.clear();
+    intensity.clear();
+    peaks.clear();
+    sampleName.clear();
     sample = NULL;
     spline = NULL;
     baseline = NULL;
@@ -39,21 +67,25 @@ EIC::EIC()
         color[i] = 0;
 }
 
-EIC::~EIC()
+float* EIC::_reserveBuffer(float*& buffer, size_t& capacity, size_t n)
 {
-    if (spline != NULL)
-        delete[] spline;
-    spline = NULL;
-    if (baseline != NULL)
-        delete[] baseline;
-    baseline = NULL;
-    peaks.clear();
+    if (capacity < n) {
+        delete[] buffer;
+        buffer = NULL;
+        capacity = 0;
+
+        // left empty if the allocation throws
+        buffer = new float[n];
+        capacity = n;
+        _bufferAllocations++;
+    }
+    return buffer;
 }
 
 EIC *EIC::eicMerge(const vector<EIC *> &eics)
 {
     // Merge to 776
-    EIC *meic = new EIC();
+    EIC *meic = EICPool::acquire();
 
     unsigned int maxlen = 0;
     float minRt = DBL_MAX;
@@ -142,8 +174,7 @@ EIC *EIC::eicMerge(const vector<EIC *> &eics)
 bool EIC::_clearBaseline()
 {
     if (baseline != nullptr)
-    { //delete previous baseline if exists
-        delete[] baseline;
+    { //clear previous baseline if exists
         baseline = nullptr;
         eic_noNoiseObs = 0;
     }
@@ -152,7 +183,7 @@ bool EIC::_clearBaseline()
     if (!n)
         return false;
 
-    baseline = new float[n];
+    baseline = _reserveBuffer(_baselineBuffer, _baselineCapacity, n);
     std::fill_n(baseline, n, 0.0f);
 
     return true;
@@ -162,7 +193,7 @@ void EIC::_computeAsLSBaseline(const float lambda,
                                const float p,
                                const int numIterations)
 {
-    // Eigen behaves better with double values compared to float
+    // the linear system is better conditioned with double values
     vector<double> intensity;
     for(unsigned int i = 0; i < this->intensity.size(); ++i)
         intensity.push_back(static_cast<double>(this->intensity[i]));
@@ -173,79 +204,97 @@ void EIC::_computeAsLSBaseline(const float lambda,
     auto resamplingFactor = mzUtils::approximateResamplingFactor(originalSize);
     intensity = mzUtils::resample(intensity, 1, resamplingFactor);
 
-    using namespace Eigen;
     auto n = static_cast<unsigned int>(intensity.size());
 
-    // Perform difference operation (pseudo-differentiation) on a sparse matrix
-    auto diff = [](Eigen::SparseMatrix<double> mat)
-    {
-        Eigen::SparseMatrix<double> E1 = mat.block(0,
-                                                   0,
-                                                   mat.rows() - 1,
-                                                   mat.cols());
-        Eigen::SparseMatrix<double> E2 = mat.block(1,
-                                                   0,
-                                                   mat.rows() - 1,
-                                                   mat.cols());
-        return Eigen::SparseMatrix<double>(E2 - E1);
-    };
-
-    // create a sparse identity matrix of size `n`
-    Eigen::SparseMatrix<double> ident(n, n);
-    ident.setIdentity();
-
-    // compute approximate second derivative of the identity matrix
-    auto D = diff(diff(ident));
-
-    // create a weights vector of length `n` initially containing only ones
-    // for coefficients
-    auto w = VectorXd(ArrayXd::Ones(n));
-
-    // instantiate a Cholesky decomposition linear solver for sparse matrices
-    SimplicialCholesky<SparseMatrix<double>> solver;
-
-    // instantiate a vector for intensity and one to store baseline
-    VectorXd intensityVec = Map<VectorXd>(intensity.data(), n);
-    VectorXd baselineVec;
-
-    // helper matrices for `select` operation used when creating binary vectors
-    auto ones = VectorXd(MatrixXd::Ones(n, 1));
-    auto zeros = VectorXd(MatrixXd::Zero(n, 1));
+    // The system 'A·x = b' solved in every iteration has A = W + λ·DᵀD,
+    // where W is the diagonal matrix of weights and D the second difference
+    // operator. A is symmetric and pentadiagonal, so it is kept as its main
+    // diagonal and two upper diagonals and factorized as L·Δ·Lᵀ, with L
+    // unit lower triangular of bandwidth 2, in linear time.
+
+    // diagonals of λ·DᵀD, summed over the rows (1, -2, 1) of D
+    vector<double> h0(n, 0.0);
+    vector<double> h1(n, 0.0);
+    vector<double> h2(n, 0.0);
+    for (unsigned int r = 0; r + 2 < n; ++r) {
+        h0[r] += lambda;
+        h0[r + 1] += 4.0 * lambda;
+        h0[r + 2] += lambda;
+        h1[r] -= 2.0 * lambda;
+        h1[r + 1] -= 2.0 * lambda;
+        h2[r] += lambda;
+    }
+
+    // weights, initially one for every coefficient, and the workspace of the
+    // factorization: Δ, the two subdiagonals of L and the solution
+    vector<double> w(n, 1.0);
+    vector<double> delta(n);
+    vector<double> l1(n, 0.0);
+    vector<double> l2(n, 0.0);
+    vector<double> tempVector(n);
+
+    // baseline of the last iteration that could be solved
+    vector<double> baselineVec = intensity;
 
     // TODO: ideally this should converge to a point where the baseline does
     // not change anymnore, but since we do not have good float comparators
     // yet we can use a decent number of iterations to get as close to the true
     // baseline as possible
     for (int i=0; i < numIterations; ++i) {
-        // create a square matrix 'W' with the weights as its diagonal
-        auto W = SparseMatrix<double>(w.asDiagonal());
+        // factorize 'A' and solve 'L·z = b' on the way, where b = W·y. Points
+        // matching the baseline exactly get no weight, so 'A' is singular if
+        // too few points are left to fit (e.g., on flat EICs or those shorter
+        // than three points), and the last baseline is kept.
+        bool singular = false;
+        for (unsigned int k = 0; k < n && !singular; ++k) {
+            double d = w[k] + h0[k];
+            double z = w[k] * intensity[k];
+            if (k >= 2) {
+                l2[k] = h2[k - 2] / delta[k - 2];
+                d -= l2[k] * l2[k] * delta[k - 2];
+                z -= l2[k] * tempVector[k - 2];
+            }
+            if (k >= 1) {
+                double a1 = h1[k - 1];
+                if (k >= 2)
+                    a1 -= l2[k] * l1[k - 1] * delta[k - 2];
+                l1[k] = a1 / delta[k - 1];
+                d -= l1[k] * l1[k] * delta[k - 1];
+                z -= l1[k] * tempVector[k - 1];
+            }
+            delta[k] = d;
+            tempVector[k] = z;
+            singular = !(d > 0.0);
+        }
+        if (singular)
+            break;
 
-        // compute 'A' and 'b', and then solve for 'x' that satisfies the
-        // equation 'A·x = b', where x will be the iteratively estimated
-        // baseline
-        auto A = W + (lambda * (D.transpose() * D));
-        solver.compute(A);
-        auto b = VectorXd(w.array() * intensityVec.array());
-        baselineVec = solver.solve(b);
+        // solve 'Δ·Lᵀ·x = z' for the estimated baseline 'x'
+        for (unsigned int k = n; k-- > 0;) {
+            double x = tempVector[k] / delta[k];
+            if (k + 1 < n)
+                x -= l1[k + 1] * tempVector[k + 1];
+            if (k + 2 < n)
+                x -= l2[k + 2] * tempVector[k + 2];
+            tempVector[k] = x;
+        }
+        baselineVec.swap(tempVector);
 
         // calculate weights for the next iteration
-        auto gtBin = VectorXd(
-            ((intensityVec - baselineVec).array() > 0.0).select(ones, zeros)
-        );
-        auto ltBin = VectorXd(
-            ((intensityVec - baselineVec).array() < 0.0).select(ones, zeros)
-        );
-        w = (p * gtBin) + ((1.0f - p) * ltBin);
+        for (unsigned int k = 0; k < n; ++k) {
+            double residual = intensity[k] - baselineVec[k];
+            if (residual > 0.0) {
+                w[k] = p;
+            } else if (residual < 0.0) {
+                w[k] = 1.0f - p;
+            } else {
+                w[k] = 0.0;
+            }
+        }
     }
 
-    // copy data from an Eigen vector to std::vector
-    vector<double> tempVector(baselineVec.data(),
-                              baselineVec.data()
-                              + baselineVec.rows()
-                              * baselineVec.cols());
-
     // interpolate the signal after possible decimation
-    tempVector = mzUtils::resample(tempVector, resamplingFactor, 1);
+    tempVector = mzUtils::resample(baselineVec, resamplingFactor, 1);
 
     // since the interpolated vector may not be of the same size as the original
     // intensity vector, we remove/pad (with zeros) until they are the same size
@@ -360,17 +409,11 @@ void EIC::computeSpline(int smoothWindow)
 
     if (n == 0)
         return;
-    if (this->spline != NULL)
-    {
-        delete[] spline;
-        spline = NULL;
-    }
+    spline = NULL;
 
     try
     {
-        this->spline = new float[n];
-        for (int i = 0; i < n; i++)
-            spline[i] = 0;
+        this->spline = _reserveBuffer(_splineBuffer, _splineCapacity, n);
     }
     catch (...)
     {
@@ -386,12 +429,12 @@ void EIC::computeSpline(int smoothWindow)
     if (smoothWindow <= 1)
         return; //nothing to smooth get out
 
+    // smoothers write straight into the spline, with filter coefficients
+    // shared between all EICs using the same window
     if (smootherType == SAVGOL)
     { //SAVGOL SMOOTHER
         mzUtils::SavGolSmoother smoother(smoothWindow, smoothWindow, 4);
-        vector<float> smoothed = smoother.Smooth(intensity);
-        for (int i = 0; i < n; i++)
-            spline[i] = smoothed[i];
+        smoother.Smooth(intensity.data(), spline, n);
     }
     else if (smootherType == GAUSSIAN)
     { //GAUSSIAN SMOOTHER
@@ -399,11 +442,7 @@ void EIC::computeSpline(int smoothWindow)
     }
     else if (smootherType == AVG)
     {
-        float *y = new float[n];
-        for (int i = 0; i < n; i++)
-            y[i] = intensity[i];
-        smoothAverage(y, spline, smoothWindow, n);
-        delete[] y;
+        smoothAverage(intensity.data(), spline, smoothWindow, n);
     }
 }
 
@@ -939,6 +978,16 @@ vector<PeakGroup> EIC::groupPeaks(vector<EIC *> &eics,
 
     //cerr << "EIC::groupPeaks() peakgroups=" << pgroups.size() << endl;
 
+    // merged peaks are sorted by rt, their bounds are not. The running
+    // maximum of their bounds tells how many leading peaks end before a
+    // sample peak starts, and can be skipped.
+    vector<float> peakReach(m->peaks.size());
+    float reach = -FLT_MAX;
+    for (unsigned int k = 0; k < m->peaks.size(); k++) {
+        reach = max(reach, max(m->peaks[k].rtmin, m->peaks[k].rtmax));
+        peakReach[k] = reach;
+    }
+
     for (unsigned int i = 0; i < eics.size(); i++)
     { //for every sample
         for (unsigned int j = 0; j < eics[i]->peaks.size(); j++)
@@ -947,14 +996,31 @@ vector<PeakGroup> EIC::groupPeaks(vector<EIC *> &eics,
             b.groupNum = -1;
             b.groupOverlap = FLT_MIN;
 
-            vector<Peak>::iterator itr = lower_bound(m->peaks.begin(), m->peaks.end(), b, Peak::compRtMin);
-            int lb = (itr - (m->peaks.begin())) - 1;
-            if (lb < 0)
-                lb = 0;
-            //cerr << "\tb=" << b.rtmin << "<=>" << b.rtmax << " lb=" << lb << endl;
+            // only merged peaks that can score are visited, the rest would
+            // be skipped by the checks below
+            unsigned int first = 0;
+            unsigned int last = m->peaks.size();
+            if (useOverlap) {
+                first = lower_bound(peakReach.begin(),
+                                    peakReach.end(),
+                                    b.rtmin) - peakReach.begin();
+            } else {
+                first = partition_point(m->peaks.begin(),
+                                        m->peaks.end(),
+                                        [&b, maxRtDiff](const Peak& a) {
+                                            return a.rt < b.rt
+                                                   && abs(b.rt - a.rt) > maxRtDiff;
+                                        }) - m->peaks.begin();
+                last = partition_point(m->peaks.begin() + first,
+                                       m->peaks.end(),
+                                       [&b, maxRtDiff](const Peak& a) {
+                                           return !(a.rt > b.rt
+                                                    && abs(b.rt - a.rt) > maxRtDiff);
+                                       }) - m->peaks.begin();
+            }
 
             //Find best matching group
-            for (unsigned int k = 0; k < m->peaks.size(); k++)
+            for (unsigned int k = first; k < last; k++)
             {
                 Peak &a = m->peaks[k];
 
@@ -1039,7 +1105,7 @@ vector<PeakGroup> EIC::groupPeaks(vector<EIC *> &eics,
     //cerr << "Found " << pgroups.size() << "groups" << endl;
 
     if (m)
-        delete (m);
+        EICPool::release(m);
     return (pgroups);
 }
 
@@ -1100,16 +1166,9 @@ void EIC::getRTMinMaxPerScan()
 bool EIC::makeEICSlice(mzSample *sample, float mzmin, float mzmax, float rtmin, float rtmax, int mslevel, int eicType, string filterline)
 {
     float eicMz = 0, eicIntensity = 0;
-    int lb, scanNum;
-    vector<float>::iterator mzItr;
-    deque<Scan *>::iterator scanItr;
-    deque<Scan *> scans;
-
-    scans = sample->scans;
-    //binary search rt domain iterator
-    Scan tmpScan(sample, 0, 1, rtmin - 0.1, 0, -1);
-    scanItr = lower_bound(scans.begin(), scans.end(), &tmpScan, Scan::compRt);
-    if (scanItr >= scans.end())
+    const deque<Scan *> &scans = sample->scans;
+
+    if (scans.empty() || scans.back()->rt < float(rtmin - 0.1))
     {
         return false;
     }
@@ -1128,103 +1187,149 @@ bool EIC::makeEICSlice(mzSample *sample, float mzmin, float mzmax, float rtmin,
     this->intensity.reserve(estimatedScans);
     this->mz.reserve(estimatedScans);
 
-    scanNum = scanItr - scans.begin() - 1;
+    // during batch processing, read peaks from the contiguous columns of the
+    // sample instead of the arrays of each scan
+    const ScanColumns *columns = sample->scanColumns();
+    if (columns != nullptr && columns->scanCount() != scans.size())
+        columns = nullptr;
 
-    for (; scanItr != scans.end(); scanItr++)
+    //binary search rt domain of the scans of this MS level
+    vector<unsigned int> scratch;
+    const unsigned int *scanItr, *scanEnd;
+    sample->scansInRtRange(mslevel, rtmin, rtmax, scratch, scanItr, scanEnd);
+
+    // reduce all scans at once from the m/z bins covering the slice
+    const MzRtIndex *index = sample->mzRtIndex();
+    if (index != nullptr && index->msLevel() == mslevel && filterline == "")
     {
-        Scan *scan = *(scanItr);
-        scanNum++;
+        const unsigned int *levelBegin = sample->scansOfMsLevel(mslevel,
+                                                                scratch).data();
+        vector<float> eicMzs, eicIntensities;
+        index->reduceScans(mzmin,
+                           mzmax,
+                           scanItr - levelBegin,
+                           scanEnd - levelBegin,
+                           eicType,
+                           eicMzs,
+                           eicIntensities);
+        for (size_t i = 0; scanItr != scanEnd; scanItr++, i++)
+        {
+            addScanPoint(*scanItr,
+                         scans[*scanItr]->rt,
+                         eicMzs[i],
+                         eicIntensities[i]);
+        }
+        return true;
+    }
 
-        if (!(scan->filterLine == filterline || filterline == ""))
-            continue;
-        if (scan->mslevel != mslevel)
-            continue;
-        if (scan->rt < rtmin)
+    for (; scanItr != scanEnd; scanItr++)
+    {
+        int scanNum = *scanItr;
+        Scan *scan = scans[scanNum];
+
+        if (!(filterline == "" || scan->filterLine == filterline))
             continue;
-        if (scan->rt > rtmax)
-            break;
 
-        eicMz = 0;
-        eicIntensity = 0;
+        const float *mzBegin, *mzEnd, *intensities;
+        float scanRt;
+        if (columns != nullptr) {
+            scanRt = columns->rt[scanNum];
+            mzBegin = columns->mz(scanNum);
+            mzEnd = mzBegin + columns->nobs(scanNum);
+            intensities = columns->intensity(scanNum);
+        } else {
+            scanRt = scan->rt;
+            scan->loadData();
+            mzBegin = scan->mz.data();
+            mzEnd = mzBegin + scan->nobs();
+            intensities = scan->intensity.data();
+        }
 
         //binary search
-        mzItr = lower_bound(scan->mz.begin(), scan->mz.end(), mzmin);
-        lb = mzItr - scan->mz.begin();
+        const float *mzItr = lower_bound(mzBegin, mzEnd, mzmin);
+        reduceScanPeaks(mzItr,
+                        mzEnd,
+                        intensities + (mzItr - mzBegin),
+                        mzmin,
+                        mzmax,
+                        eicType,
+                        eicMz,
+                        eicIntensity);
+        addScanPoint(scanNum, scanRt, eicMz, eicIntensity);
+    }
 
-        switch ((EIC::EicType)eicType)
-        {
+    return true;
+}
 
-        //takes the maximum intensity for given m/z range in a scan
-            case EIC::MAX:
-        {
-            for (unsigned int scanIdx = lb; scanIdx < scan->nobs(); scanIdx++)
-            {
-                if (scan->mz[scanIdx] < mzmin)
-                    continue;
-                if (scan->mz[scanIdx] > mzmax)
-                    break;
+void EIC::reduceScanPeaks(const float *mzItr,
+                          const float *mzEnd,
+                          const float *intensityItr,
+                          float mzmin,
+                          float mzmax,
+                          int eicType,
+                          float &eicMz,
+                          float &eicIntensity)
+{
+    eicMz = 0;
+    eicIntensity = 0;
 
-                if (scan->intensity[scanIdx] > eicIntensity)
-                {
-                    eicIntensity = scan->intensity[scanIdx];
-                    eicMz = scan->mz[scanIdx];
-                }
-            }
-            break;
-        }
+    switch ((EIC::EicType)eicType)
+    {
 
-        //takes the sum of all intensities for given m/z range in a scan
-        //associated m/z is the weighted average(with intensities as weights)
-        case EIC::SUM:
+    //takes the sum of all intensities for given m/z range in a scan
+    //associated m/z is the weighted average(with intensities as weights)
+    case EIC::SUM:
+    {
+        float n = 0;
+        for (; mzItr != mzEnd; mzItr++, intensityItr++)
         {
-            float n = 0;
-            for (unsigned int scanIdx = lb; scanIdx < scan->nobs(); scanIdx++)
-            {
-                if (scan->mz[scanIdx] < mzmin)
-                    continue;
-                if (scan->mz[scanIdx] > mzmax)
-                    break;
+            if (*mzItr < mzmin)
+                continue;
+            if (*mzItr > mzmax)
+                break;
 
-                eicIntensity += scan->intensity[scanIdx];
-                eicMz += scan->mz[scanIdx] * scan->intensity[scanIdx];
-                n += scan->intensity[scanIdx];
-            }
-            eicMz /= n;
-            break;
+            eicIntensity += *intensityItr;
+            eicMz += *mzItr * *intensityItr;
+            n += *intensityItr;
         }
+        eicMz /= n;
+        break;
+    }
 
-        default:
+    //takes the maximum intensity for given m/z range in a scan
+    case EIC::MAX:
+    default:
+    {
+        for (; mzItr != mzEnd; mzItr++, intensityItr++)
         {
-            for (unsigned int scanIdx = lb; scanIdx < scan->nobs(); scanIdx++)
-            {
-                if (scan->mz[scanIdx] < mzmin)
-                    continue;
-                if (scan->mz[scanIdx] > mzmax)
-                    break;
+            if (*mzItr < mzmin)
+                continue;
+            if (*mzItr > mzmax)
+                break;
 
-                if (scan->intensity[scanIdx] > eicIntensity)
-                {
-                    eicIntensity = scan->intensity[scanIdx];
-                    eicMz = scan->mz[scanIdx];
-                }
+            if (*intensityItr > eicIntensity)
+            {
+                eicIntensity = *intensityItr;
+                eicMz = *mzItr;
             }
-            break;
-        }
-        }
-
-        this->scannum.push_back(scanNum);
-        this->rt.push_back(scan->rt);
-        this->intensity.push_back(eicIntensity);
-        this->mz.push_back(eicMz);
-        this->totalIntensity += eicIntensity;
-        if (eicIntensity > this->maxIntensity) {
-            this->maxIntensity = eicIntensity;
-            this->rtAtMaxIntensity = scan->rt;
-            this->mzAtMaxIntensity = eicMz;
         }
+        break;
     }
+    }
+}
 
-    return true;
+void EIC::addScanPoint(int scanNum, float scanRt, float eicMz, float eicIntensity)
+{
+    this->scannum.push_back(scanNum);
+    this->rt.push_back(scanRt);
+    this->intensity.push_back(eicIntensity);
+    this->mz.push_back(eicMz);
+    this->totalIntensity += eicIntensity;
+    if (eicIntensity > this->maxIntensity) {
+        this->maxIntensity = eicIntensity;
+        this->rtAtMaxIntensity = scanRt;
+        this->mzAtMaxIntensity = eicMz;
+    }
 }
 
 void EIC::normalizeIntensityPerScan(float scale)
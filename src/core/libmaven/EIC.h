@@ -7,6 +7,7 @@
 #ifndef MZEIC_H
 #define MZEIC_H
 
+#include <atomic>
 #include <Eigen>
 
 #include "standardincludes.h"
@@ -35,6 +36,19 @@ class EIC
     */
     ~EIC();
 
+    /**
+     * @brief Restore the state of a newly constructed EIC, but keep the
+     * memory held by its data vectors, spline and baseline for reuse.
+     * @see EICPool
+     */
+    void reset();
+
+    /**
+     * @brief Number of spline and baseline buffers allocated by all EICs
+     * since the start of the process.
+     */
+    static size_t bufferAllocations() { return _bufferAllocations.load(); }
+
     enum SmootherType /**<Enumeration to select the smoothing algorithm */
     {
         SAVGOL = 0,
@@ -227,6 +241,30 @@ class EIC
     */
     bool makeEICSlice(mzSample *sample, float mzmin, float mzmax, float rtmin, float rtmax, int mslevel, int eicType, string filterline);
 
+    /**
+    * @brief reduce the peaks of a scan with m/z within [mzmin, mzmax] to one
+    * EIC point, by maximum intensity or by intensity sum depending on eicType
+    * @param mzItr first peak of the scan to consider, usually the lower bound
+    * of mzmin
+    * @param mzEnd end of the m/z array of the scan
+    * @param intensityItr intensity of the peak at mzItr
+    * @param eicMz m/z of the point (intensity weighted mean for sums)
+    * @param eicIntensity intensity of the point
+    */
+    static void reduceScanPeaks(const float *mzItr,
+                                const float *mzEnd,
+                                const float *intensityItr,
+                                float mzmin,
+                                float mzmax,
+                                int eicType,
+                                float &eicMz,
+                                float &eicIntensity);
+
+    /**
+    * @brief append the point of one scan to the EIC and update its totals
+    */
+    void addScanPoint(int scanNum, float scanRt, float eicMz, float eicIntensity);
+
     void getRTMinMaxPerScan();
 
     void normalizeIntensityPerScan(float scale);
@@ -297,6 +335,23 @@ class EIC
     static bool compMaxIntensity(EIC *a, EIC *b) { return a->maxIntensity > b->maxIntensity; }
 
   private:
+    /**
+     * @brief Memory behind `spline` and `baseline`, kept while they are
+     * unset so that a recomputed or reused EIC does not allocate again.
+     */
+    float* _splineBuffer;
+    size_t _splineCapacity;
+    float* _baselineBuffer;
+    size_t _baselineCapacity;
+
+    static atomic<size_t> _bufferAllocations;
+
+    /**
+     * @brief Grow a buffer to hold at least `n` values, only allocating if
+     * its capacity falls short. Contents are not preserved.
+     */
+    static float* _reserveBuffer(float*& buffer, size_t& capacity, size_t n);
+
     /**
      * Name of selected smoothing algorithm
      */
@@ -15,6 +15,7 @@
 #include "mavenparameters.h"
 #include "mzMassCalculator.h"
 #include "isotopeDetection.h"
+#include "eicpool.h"
 
 PeakDetector::PeakDetector() {
     mavenParameters = NULL;
@@ -78,24 +79,7 @@ vector<EIC*> PeakDetector::pullEICs(mzSlice* slice,
             }
 
             if (e) {
-                // if eic exists, perform smoothing
-                EIC::SmootherType smootherType =
-                    (EIC::SmootherType)mp->eic_smoothingAlgorithm;
-                e->setSmootherType(smootherType);
-
-                // set appropriate baseline parameters
-                if (mp->aslsBaselineMode) {
-                    e->setBaselineMode(EIC::BaselineMode::AsLSSmoothing);
-                    e->setAsLSSmoothness(mp->aslsSmoothness);
-                    e->setAsLSAsymmetry(mp->aslsAsymmetry);
-                } else {
-                    e->setBaselineMode(EIC::BaselineMode::Threshold);
-                    e->setBaselineSmoothingWindow(mp->baseline_smoothingWindow);
-                    e->setBaselineDropTopX(mp->baseline_dropTopX);
-                }
-                e->setFilterSignalBaselineDiff(mp->minSignalBaselineDifference);
-                e->getPeakPositions(mp->eic_smoothingWindow);
-                // smoohing over
+                prepareEIC(e, mp);
 
 #pragma omp critical
                 // push eic to all eics vector
@@ -106,6 +90,94 @@ vector<EIC*> PeakDetector::pullEICs(mzSlice* slice,
     return eics;
 }
 
+vector<vector<EIC*>> PeakDetector::pullEICs(const vector<mzSlice*>& slices,
+                                            vector<mzSample*>& samples,
+                                            MavenParameters* mp)
+{
+    vector<vector<EIC*>> eics(slices.size());
+
+    // slices with plain m/z and rt bounds are extracted together, SRM and
+    // MS/MS slices one by one
+    vector<mzSlice*> rangeSlices;
+    vector<size_t> rangeIndices;
+    for (size_t i = 0; i < slices.size(); i++) {
+        mzSlice* slice = slices[i];
+        Compound* c = slice->compound;
+        if (!slice->srmId.empty()
+            || (c && c->precursorMz > 0 && c->productMz > 0)) {
+            eics[i] = pullEICs(slice, samples, mp);
+        } else {
+            rangeSlices.push_back(slice);
+            rangeIndices.push_back(i);
+        }
+    }
+    if (rangeSlices.empty())
+        return eics;
+
+    vector<mzSample*> vsamples;
+    for (auto sample : samples) {
+        if (sample != NULL && sample->isSelected)
+            vsamples.push_back(sample);
+    }
+
+    vector<vector<EIC*>> sampleEics(vsamples.size());
+#pragma omp parallel for
+    for (unsigned int i = 0; i < vsamples.size(); i++) {
+        sampleEics[i] = vsamples[i]->getEICs(rangeSlices,
+                                             1,
+                                             mp->eicType,
+                                             mp->filterline);
+        for (auto e : sampleEics[i])
+            prepareEIC(e, mp);
+    }
+
+    for (size_t j = 0; j < rangeSlices.size(); j++) {
+        for (size_t i = 0; i < vsamples.size(); i++)
+            eics[rangeIndices[j]].push_back(sampleEics[i][j]);
+    }
+    return eics;
+}
+
+void PeakDetector::prepareEIC(EIC* e, MavenParameters* mp)
+{
+    // perform smoothing
+    EIC::SmootherType smootherType =
+        (EIC::SmootherType)mp->eic_smoothingAlgorithm;
+    e->setSmootherType(smootherType);
+
+    // set appropriate baseline parameters
+    if (mp->aslsBaselineMode) {
+        e->setBaselineMode(EIC::BaselineMode::AsLSSmoothing);
+        e->setAsLSSmoothness(mp->aslsSmoothness);
+        e->setAsLSAsymmetry(mp->aslsAsymmetry);
+    } else {
+        e->setBaselineMode(EIC::BaselineMode::Threshold);
+        e->setBaselineSmoothingWindow(mp->baseline_smoothingWindow);
+        e->setBaselineDropTopX(mp->baseline_dropTopX);
+    }
+    e->setFilterSignalBaselineDiff(mp->minSignalBaselineDifference);
+    e->getPeakPositions(mp->eic_smoothingWindow);
+}
+
+void PeakDetector::loadSampleData() {
+    vector<mzSample*>& samples = mavenParameters->samples;
+#pragma omp parallel for
+    for (unsigned int i = 0; i < samples.size(); i++)
+        samples[i]->loadAllScanData();
+}
+
+void PeakDetector::buildScanColumns() {
+    vector<mzSample*>& samples = mavenParameters->samples;
+#pragma omp parallel for
+    for (unsigned int i = 0; i < samples.size(); i++)
+        samples[i]->buildScanColumns();
+}
+
+void PeakDetector::releaseScanColumns() {
+    for (auto sample : mavenParameters->samples)
+        sample->releaseScanColumns();
+}
+
 void PeakDetector::processSlices() {
         processSlices(mavenParameters->_slices, "sliceset");
 }
@@ -117,42 +189,57 @@ void PeakDetector::processSlice(mzSlice& slice) {
 }
 
 void PeakDetector::pullAllIsotopes() {
-    for (unsigned int j = 0; j < mavenParameters->allgroups.size(); j++) {
-        if(mavenParameters->stop) break;
-        PeakGroup& group = mavenParameters->allgroups[j];
-        Compound* compound = group.getCompound();
+    vector<PeakGroup>& groups = mavenParameters->allgroups;
+
+    if (mavenParameters->pullIsotopesFlag) {
+        ProgressReporter progress(mavenParameters->showProgressFlag
+                                      ? progressCallback()
+                                      : nullptr,
+                                  "Calculating Isotopes",
+                                  groups.size());
+
+        bool C13Flag = mavenParameters->C13Labeled_BPE;
+        bool N15Flag = mavenParameters->N15Labeled_BPE;
+        bool S34Flag = mavenParameters->S34Labeled_BPE;
+        bool D2Flag = mavenParameters->D2Labeled_BPE;
+
+        // every parent group only gains children of its own, so groups are
+        // handed out to whichever thread is idle
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int j = 0; j < static_cast<int>(groups.size()); j++) {
+            if (mavenParameters->stop)
+                continue;
 
-        if (mavenParameters->pullIsotopesFlag && !group.isIsotope())
-        {
-            bool C13Flag = mavenParameters->C13Labeled_BPE;
-            bool N15Flag = mavenParameters->N15Labeled_BPE;
-            bool S34Flag = mavenParameters->S34Labeled_BPE;
-            bool D2Flag = mavenParameters->D2Labeled_BPE;
-
-            IsotopeDetection::IsotopeDetectionType isoType;
-            isoType = IsotopeDetection::PeakDetection;
-
-            IsotopeDetection isotopeDetection(
-                mavenParameters,
-                isoType,
-                C13Flag,
-                N15Flag,
-                S34Flag,
-                D2Flag);
-            isotopeDetection.pullIsotopes(&group);
+            PeakGroup& group = groups[j];
+            if (!group.isIsotope()) {
+                IsotopeDetection::IsotopeDetectionType isoType;
+                isoType = IsotopeDetection::PeakDetection;
+
+                IsotopeDetection isotopeDetection(
+                    mavenParameters,
+                    isoType,
+                    C13Flag,
+                    N15Flag,
+                    S34Flag,
+                    D2Flag);
+                isotopeDetection.pullIsotopes(&group);
+            }
+            progress.advance();
         }
+    }
+
+    // compounds may be shared between groups, they are linked to their best
+    // group in group order once all isotopes are known
+    for (unsigned int j = 0; j < groups.size(); j++) {
+        if(mavenParameters->stop) break;
+        PeakGroup& group = groups[j];
+        Compound* compound = group.getCompound();
 
         if (compound) {
             if (!compound->hasGroup() ||
                 group.groupRank < compound->getPeakGroup()->groupRank)
                 compound->setPeakGroup(group);
         }
-
-
-        if (mavenParameters->showProgressFlag &&
-            mavenParameters->pullIsotopesFlag && j % 10 == 0) {
-			sendBoostSignal("Calculating Isotopes", j, mavenParameters->allgroups.size());
-        }
     }
 }
 
@@ -167,6 +254,10 @@ void PeakDetector::processMassSlices(const vector<Compound*>& identificationSet)
     // TODO: cant this be in background_peaks_update parameter setting function
     mavenParameters->setAverageScanTime();  // find avgScanTime
 
+    // mass slicing and the EICs of all slices walk over every data point,
+    // stream them from contiguous per-sample columns for this run
+    buildScanColumns();
+
     MassSlices massSlices;
     massSlices.setSamples(mavenParameters->samples);
     massSlices.setMavenParameters(mavenParameters);
@@ -190,6 +281,7 @@ void PeakDetector::processMassSlices(const vector<Compound*>& identificationSet)
     if (massSlices.slices.size() == 0) {
         //	Q_EMIT (updateProgressBar("Quiting! No good mass slices found",
         //1, 1)); TODO: Fix Q_EMIT.
+        releaseScanColumns();
         return;
     }
 
@@ -203,6 +295,7 @@ void PeakDetector::processMassSlices(const vector<Compound*>& identificationSet)
 
     // cleanup
     delete_all(massSlices.slices);
+    releaseScanColumns();
 
     qDebug() << "processMassSlices() Done. ElepsTime=%1 msec"
              << timer.elapsed();
@@ -309,112 +402,158 @@ void PeakDetector::processSlices(vector<mzSlice*> &slices, string setName)
     if (slices.empty())
         return;
 
+    loadSampleData();
+
     mavenParameters->allgroups.clear();
+    EICPool::resetStats();
     sort(slices.begin(), slices.end(), mzSlice::compIntensity);
-    for (unsigned int s = 0; s < slices.size(); s++) {
-        if (mavenParameters->stop)
-            break;
 
-        mzSlice* slice = slices[s];
-        Compound* compound = slice->compound;
-        if (compound != nullptr && compound->hasGroup())
-            compound->unlinkGroup();
-
-        vector<EIC*> eics = pullEICs(slice,
-                                     mavenParameters->samples,
-                                     mavenParameters);
-
-        if (mavenParameters->clsf->hasModel())
-            mavenParameters->clsf->scoreEICs(eics);
-
-        float eicMaxIntensity = 0;
-        for (auto eic : eics) {
-            float max = 0;
-            switch (static_cast<PeakGroup::QType>(mavenParameters->peakQuantitation))
-            {
-            case PeakGroup::AreaTop:
-                max = eic->maxAreaTopIntensity;
-                break;
-            case PeakGroup::Area:
-                max = eic->maxAreaIntensity;
-                break;
-            case PeakGroup::Height:
-                max = eic->maxIntensity;
-                break;
-            case PeakGroup::AreaNotCorrected:
-                max = eic->maxAreaNotCorrectedIntensity;
-                break;
-            case PeakGroup::AreaTopNotCorrected:
-                max = eic->maxAreaTopNotCorrectedIntensity;
-                break;
-            default:
-                max = eic->maxIntensity;
-                break;
-            }
-
-            if (max > eicMaxIntensity)
-                eicMaxIntensity = max;
+    // EICs are pulled for batches of slices at a time, each batch with a
+    // single pass over the scans of every sample. The batch size bounds the
+    // number of EICs held in memory.
+    const size_t maxBatchEICs = 10000;
+    size_t batchSize = max(static_cast<size_t>(1),
+                           maxBatchEICs / max(static_cast<size_t>(1),
+                                              mavenParameters->samples.size()));
+
+    atomic<size_t> groupCount(0);
+    ProgressReporter progress(mavenParameters->showProgressFlag
+                                  ? progressCallback()
+                                  : nullptr,
+                              "",
+                              std::min((int)slices.size(),
+                                       mavenParameters->limitGroupCount));
+    progress.setText([&groupCount]() {
+        return "Found " + to_string(groupCount.load()) + " groups";
+    });
+    bool limitReached = false;
+    for (size_t batchStart = 0;
+         batchStart < slices.size() && !limitReached && !mavenParameters->stop;
+         batchStart += batchSize) {
+        size_t batchEnd = min(slices.size(), batchStart + batchSize);
+        vector<mzSlice*> batch(slices.begin() + batchStart,
+                               slices.begin() + batchEnd);
+
+        // a compound may be the target of more than one slice
+        for (auto slice : batch) {
+            Compound* compound = slice->compound;
+            if (compound != nullptr && compound->hasGroup())
+                compound->unlinkGroup();
         }
 
-        if (eicMaxIntensity < mavenParameters->minGroupIntensity) {
-            delete_all(eics);
-            continue;
+        vector<vector<EIC*>> batchEics = pullEICs(batch,
+                                                  mavenParameters->samples,
+                                                  mavenParameters);
+
+        // slices are handed out one at a time to whichever thread is idle,
+        // and the groups of every slice kept apart until they are merged in
+        // slice order below
+        vector<vector<PeakGroup>> batchGroups(batch.size());
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < static_cast<int>(batch.size()); i++) {
+            if (!mavenParameters->stop)
+                batchGroups[i] = groupsOfSlice(batch[i], batchEics[i]);
+            EICPool::release(batchEics[i]);
         }
 
-        PeakFiltering peakFiltering(mavenParameters, false);
-        peakFiltering.filter(eics);
-
-        vector<PeakGroup> peakgroups =
-            EIC::groupPeaks(eics,
-                            slice,
-                            mavenParameters->eic_smoothingWindow,
-                            mavenParameters->grouping_maxRtWindow,
-                            mavenParameters->minQuality,
-                            mavenParameters->distXWeight,
-                            mavenParameters->distYWeight,
-                            mavenParameters->overlapWeight,
-                            mavenParameters->useOverlap,
-                            mavenParameters->minSignalBaselineDifference,
-                            mavenParameters->fragmentTolerance,
-                            mavenParameters->scoringAlgo);
-        
-        GroupFiltering groupFiltering(mavenParameters, slice);
-        groupFiltering.filter(peakgroups);
-
-        // sort groups according to their rank
-        sort(peakgroups.begin(), peakgroups.end(), PeakGroup::compRank);
-
-        for (unsigned int j = 0; j < peakgroups.size(); j++) {
-            // check for duplicates	and append group
-            if (j >= mavenParameters->eicMaxGroups)
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (mavenParameters->stop)
                 break;
 
-            mavenParameters->allgroups.push_back(peakgroups[j]);
-        }
+            vector<PeakGroup>& peakgroups = batchGroups[i];
+            for (unsigned int j = 0; j < peakgroups.size(); j++) {
+                if (j >= mavenParameters->eicMaxGroups)
+                    break;
 
-        // cleanup
-        delete_all(eics);
+                if (_groupSink) {
+                    _groupSink(peakgroups[j]);
+                } else {
+                    mavenParameters->allgroups.push_back(peakgroups[j]);
+                }
+                groupCount++;
+            }
+            vector<PeakGroup>().swap(peakgroups);
 
-        if (mavenParameters->allgroups.size() > mavenParameters->limitGroupCount) {
-            cerr << "Group limit exceeded!" << endl;
-            break;
-        }
+            if (groupCount > mavenParameters->limitGroupCount) {
+                cerr << "Group limit exceeded!" << endl;
+                limitReached = true;
+                break;
+            }
 
-        if (zeroStatus) {
-            sendBoostSignal("Status", 0, 1);
-            zeroStatus = false;
+            if (zeroStatus) {
+                sendBoostSignal("Status", 0, 1);
+                zeroStatus = false;
+            }
+
+            progress.setCompleted(batchStart + i + 1);
         }
+    }
+
+    // pooled EICs are not kept beyond the detection that pulled them
+    EICPool::clear();
+}
+
+vector<PeakGroup> PeakDetector::groupsOfSlice(mzSlice* slice,
+                                              vector<EIC*>& eics)
+{
+    if (mavenParameters->clsf->hasModel())
+        mavenParameters->clsf->scoreEICs(eics);
 
-        if (mavenParameters->showProgressFlag && s % 10 == 0) {
-            string progressText = "Found "
-                                  + to_string(mavenParameters->allgroups.size())
-                                  + " groups";
-            sendBoostSignal(progressText,
-                            s + 1,
-                            std::min((int)slices.size(),
-                                     mavenParameters->limitGroupCount));
+    float eicMaxIntensity = 0;
+    for (auto eic : eics) {
+        float max = 0;
+        switch (static_cast<PeakGroup::QType>(mavenParameters->peakQuantitation))
+        {
+        case PeakGroup::AreaTop:
+            max = eic->maxAreaTopIntensity;
+            break;
+        case PeakGroup::Area:
+            max = eic->maxAreaIntensity;
+            break;
+        case PeakGroup::Height:
+            max = eic->maxIntensity;
+            break;
+        case PeakGroup::AreaNotCorrected:
+            max = eic->maxAreaNotCorrectedIntensity;
+            break;
+        case PeakGroup::AreaTopNotCorrected:
+            max = eic->maxAreaTopNotCorrectedIntensity;
+            break;
+        default:
+            max = eic->maxIntensity;
+            break;
         }
+
+        if (max > eicMaxIntensity)
+            eicMaxIntensity = max;
     }
+
+    if (eicMaxIntensity < mavenParameters->minGroupIntensity)
+        return vector<PeakGroup>();
+
+    PeakFiltering peakFiltering(mavenParameters, false);
+    peakFiltering.filter(eics);
+
+    vector<PeakGroup> peakgroups =
+        EIC::groupPeaks(eics,
+                        slice,
+                        mavenParameters->eic_smoothingWindow,
+                        mavenParameters->grouping_maxRtWindow,
+                        mavenParameters->minQuality,
+                        mavenParameters->distXWeight,
+                        mavenParameters->distYWeight,
+                        mavenParameters->overlapWeight,
+                        mavenParameters->useOverlap,
+                        mavenParameters->minSignalBaselineDifference,
+                        mavenParameters->fragmentTolerance,
+                        mavenParameters->scoringAlgo);
+
+    GroupFiltering groupFiltering(mavenParameters, slice);
+    groupFiltering.filter(peakgroups);
+
+    // sort groups according to their rank
+    sort(peakgroups.begin(), peakgroups.end(), PeakGroup::compRank);
+    return peakgroups;
 }
 
 void PeakDetector::identifyFeatures(const vector<Compound*>& identificationSet)
@@ -424,6 +563,11 @@ void PeakDetector::identifyFeatures(const vector<Compound*>& identificationSet)
 
     GroupFiltering groupFiltering(mavenParameters);
     vector<PeakGroup> toBeMerged;
+    ProgressReporter progress(mavenParameters->showProgressFlag
+                                  ? progressCallback()
+                                  : nullptr,
+                              "Identifying features using the given compound set…",
+                              mavenParameters->allgroups.size());
     auto iter = mavenParameters->allgroups.begin();
     while(iter != mavenParameters->allgroups.end()) {
         auto& group = *iter;
@@ -468,9 +612,8 @@ void PeakDetector::identifyFeatures(const vector<Compound*>& identificationSet)
             ++iter;
         }
 
-       sendBoostSignal("Identifying features using the given compound set…",
-                       iter - mavenParameters->allgroups.begin(),
-                       mavenParameters->allgroups.size());
+        progress.setCompleted(iter - mavenParameters->allgroups.begin());
+        progress.setTotal(mavenParameters->allgroups.size());
     }
 
     if (!toBeMerged.empty()) {
@@ -7,8 +7,11 @@
 #include <boost/bind.hpp>
 #include <boost/signals2.hpp>
 
+#include <functional>
 #include <omp.h>
 
+#include "progressreporter.h"
+
 class Compound;
 class EIC;
 class MavenParameters;
@@ -47,9 +50,39 @@ public:
     boostSignal(progressText, completed_slices, total_slices);
     }
 
+    /**
+     * @brief Callback for a `ProgressReporter` that forwards progress to
+     * `sendBoostSignal`.
+     */
+    ProgressReporter::Callback progressCallback()
+    {
+        return [this](const std::string& progressText,
+                      unsigned int completed,
+                      int total) {
+            sendBoostSignal(progressText, completed, total);
+        };
+    }
+
 
 	void resetProgressBar();
 
+	/**
+	 * @brief Decode all scans of lazily loaded samples, in parallel across
+	 * samples. Batch detection needs every data point in memory.
+	 */
+	void loadSampleData();
+
+	/**
+	 * @brief Move the peaks of every sample into contiguous columns (see
+	 * mzSample::buildScanColumns) for the duration of an untargeted run.
+	 */
+	void buildScanColumns();
+
+	/**
+	 * @brief Hand the peaks back to the scans and free the columns.
+	 */
+	void releaseScanColumns();
+
 	/**
 	 * [get Maven Parameters]
 	 * @return [params]
@@ -66,6 +99,19 @@ public:
 		mavenParameters = mp;
 	}
 
+	/**
+	 * @brief Hand the groups found by processSlices to a sink instead of
+	 * collecting them in MavenParameters::allgroups.
+	 * @details Groups are passed in the order they would have been added to
+	 * allgroups, one batch of slices at a time, and freed once the sink
+	 * returns, so memory no longer grows with the number of groups. The
+	 * group limit applies to the number of groups passed on. An empty sink
+	 * restores collection in allgroups.
+	 */
+	void setGroupSink(std::function<void(PeakGroup&)> sink) {
+		_groupSink = sink;
+	}
+
 	/**
 	 * [align Samples using Aligner class]
 	 * @method alignSamples
@@ -127,6 +173,19 @@ public:
                                  std::vector<mzSample*>& samples,
                                  MavenParameters* mp);
 
+    /**
+     * @brief Pull the EICs of many slices from all selected samples.
+     * @details Slices bounded by m/z and rt are extracted with a single pass
+     * over the scans of each sample (see mzSample::getEICs); SRM and MS/MS
+     * slices are pulled one at a time.
+     * @return EICs of every slice, in the order of the slices and with the
+     * EICs of a slice in sample order.
+     */
+    static std::vector<std::vector<EIC*>> pullEICs(
+        const std::vector<mzSlice*>& slices,
+        std::vector<mzSample*>& samples,
+        MavenParameters* mp);
+
     /**
      * @brief This method can be used to identify features found by performing
      * untargeted detection.
@@ -149,6 +208,23 @@ public:
 	 */
 	MavenParameters* mavenParameters;
 	bool zeroStatus;
+	std::function<void(PeakGroup&)> _groupSink;
+
+	/**
+	 * @brief Smooth an EIC, compute its baseline and find its peaks as set
+	 * up in the given parameters.
+	 */
+	static void prepareEIC(EIC* e, MavenParameters* mp);
+
+	/**
+	 * @brief Group the peaks of the EICs of a slice and filter the groups.
+	 * @details Safe to call for different slices in parallel.
+	 * @param eics EICs of the slice, in sample order. Peaks are filtered
+	 * but the EICs are not deleted.
+	 * @return Groups that passed filtering, sorted by rank.
+	 */
+	std::vector<PeakGroup> groupsOfSlice(mzSlice* slice,
+	                                     std::vector<EIC*>& eics);
 };
 
 #endif // PEAKDETECTOR_H
@@ -49,6 +49,7 @@ PeakGroup::PeakGroup()  {
     predictedLabel=0;
     minQuality = 0.2;
     minIntensity = 0;
+    quantitationType = AreaTop;
 
     //quantileIntensityPeaks = 0;
     //quantileQualityPeaks = 0;
@@ -88,6 +89,7 @@ void PeakGroup::copyObj(const PeakGroup& o)  {
 
     minQuality = o.minQuality;
     minIntensity = o.minIntensity;
+    quantitationType = o.quantitationType;
     maxIntensity= o.maxIntensity;
     maxAreaTopIntensity = o.maxAreaTopIntensity;
     maxAreaIntensity = o.maxAreaIntensity;
@@ -17,6 +17,7 @@ vector<mzSlice*> SRMList::getSrmSlices(double amuQ1, double amuQ3, int userPolar
     vector<mzSlice*>slices;
     for(int i=0; i < samples.size(); i++ ) {
         mzSample* sample = samples[i];
+        sample->loadAllScanData();
         for( int j=0; j < sample->scans.size(); j++ ) {
             Scan* scan = sample->getScan(j);
             if (!scan) continue;
@@ -35,14 +35,40 @@ namespace mzUtils
     {
     }
 
+    std::map<SavGolSmoother::CoefficientKey, std::vector<float>> SavGolSmoother::mmap_coefficients ;
+    std::mutex SavGolSmoother::mmutex_coefficients ;
+
     void SavGolSmoother::SetOptions(int num_left, int num_right, int order)
     {
-        mvect_coefficients.clear() ;
-
         mint_golay_order = order ;
         mint_Nleft_golay = num_left ;
         mint_Nright_golay = num_right ;
-        int np = mint_Nleft_golay + mint_Nright_golay + 1 ;
+
+        mint_num_coeffs = mint_Nright_golay * 2 ;
+        if (mint_Nleft_golay > mint_Nright_golay)
+        {
+            mint_num_coeffs = mint_Nleft_golay * 2 ;
+        }
+
+        mptr_coefficients = &Coefficients(num_left, num_right, order) ;
+    }
+
+    const std::vector<float>& SavGolSmoother::Coefficients(int num_left, int num_right, int order)
+    {
+        // entries are never removed, so references to them stay valid
+        std::lock_guard<std::mutex> lock(mmutex_coefficients) ;
+        CoefficientKey key(num_left, num_right, order) ;
+        auto entry = mmap_coefficients.find(key) ;
+        if (entry == mmap_coefficients.end())
+        {
+            entry = mmap_coefficients.insert(std::make_pair(key, ComputeCoefficients(num_left, num_right, order))).first ;
+        }
+        return entry->second ;
+    }
+
+    std::vector<float> SavGolSmoother::ComputeCoefficients(int num_left, int num_right, int order)
+    {
+        int np = num_left + num_right + 1 ;
 
         float *golay_coeffs = new float[np+2] ;
 
@@ -50,28 +76,27 @@ namespace mzUtils
             golay_coeffs[i] = 0 ;
 
 
-        savgol(golay_coeffs, np, mint_Nleft_golay, mint_Nright_golay , 0, mint_golay_order) ;
+        savgol(golay_coeffs, np, num_left, num_right , 0, order) ;
 
-        mint_num_coeffs = mint_Nright_golay * 2 ;
-        if (mint_Nleft_golay > mint_Nright_golay)
+        int num_coeffs = num_right * 2 ;
+        if (num_left > num_right)
         {
-            mint_num_coeffs = mint_Nleft_golay * 2 ;
+            num_coeffs = num_left * 2 ;
         }
 
         // unwrap golay coeffs
-        mvect_coefficients.clear() ;
-        for (int i = 0 ; i < mint_Nleft_golay + mint_Nright_golay + 1 ; i++)
-            mvect_coefficients.push_back(0) ;
+        std::vector<float> coefficients(np, 0) ;
 
-        for(int i = 0 ; i <= mint_Nleft_golay ; i++)
+        for(int i = 0 ; i <= num_left ; i++)
         {
-            mvect_coefficients[mint_num_coeffs/2 - i] = (float) golay_coeffs[i+1] ;
+            coefficients[num_coeffs/2 - i] = (float) golay_coeffs[i+1] ;
         }
-        for (int i = 1 ; i <= mint_Nright_golay ; i++)
+        for (int i = 1 ; i <= num_right ; i++)
         {
-            mvect_coefficients[mint_num_coeffs/2+i] = (float) golay_coeffs[mint_num_coeffs-i] ;
+            coefficients[num_coeffs/2+i] = (float) golay_coeffs[num_coeffs-i] ;
         }
         delete [] golay_coeffs ;
+        return coefficients ;
     }
 
 
@@ -99,7 +124,7 @@ namespace mzUtils
             for (int j = start_index ; j < stop_index ; j++)
             {
                 sum_before = sum ;
-                float val = intensities->at(j) * mvect_coefficients[j-start_index]  ;
+                float val = intensities->at(j) * (*mptr_coefficients)[j-start_index]  ;
                 sum = sum_before + val ;
             }
 
@@ -117,32 +142,44 @@ namespace mzUtils
     {
         int size = (int) intensities.size() ;
         mvect_temp_y.resize(size);
+        Smooth(intensities.data(), mvect_temp_y.data(), size) ;
+        return mvect_temp_y;
+    }
 
-        for (int i = 0 ; i < size ; i++)
+    void SavGolSmoother::Smooth(const float* intensities, float* smoothed, int size) const
+    {
+        // points whose window would reach past either end are not smoothed
+        int first = mint_Nleft_golay ;
+        int last = size - mint_Nright_golay - 1 ;
+        if (first > last)
+            first = last = 0 ;
+        for (int i = 0 ; i < first ; i++)
+            smoothed[i] = intensities[i] ;
+        for (int i = last ; i < size ; i++)
+            smoothed[i] = intensities[i] ;
+        if (first == last)
+            return ;
+
+        // the window is applied one coefficient at a time over all points,
+        // so that the inner loop runs over contiguous data and vectorizes,
+        // while every point still sums its window from left to right
+        const float* coefficients = mptr_coefficients->data() ;
+        int width = mint_Nleft_golay + mint_Nright_golay + 1 ;
+        float* out = smoothed + first ;
+        int count = last - first ;
+        for (int i = 0 ; i < count ; i++)
+            out[i] = 0 ;
+        for (int j = 0 ; j < width ; j++)
         {
-            int start_index = i - mint_Nleft_golay ;
-            int stop_index =  i + mint_Nright_golay +1 ;
-            mvect_temp_y[i] = 0;
-
-            if (start_index < 0 || stop_index >= size)
-            {
-                // dont worry about smoothing just push back and forget.
-                mvect_temp_y[i] = intensities[i];
-                continue ;
-            }
-
-            float sum = 0 ;
-            float sum_before = 0 ;
-            for (int j = start_index ; j < stop_index ; j++)
-            {
-                sum_before = sum ;
-                float val = intensities.at(j) * mvect_coefficients[j-start_index]  ;
-                sum = sum_before + val ;
-            }
-
-            if (sum < 0) sum = 0 ;
-            mvect_temp_y[i]=sum;
+            const float coefficient = coefficients[j] ;
+            const float* in = intensities + j ;
+#pragma omp simd
+            for (int i = 0 ; i < count ; i++)
+                out[i] += in[i] * coefficient ;
+        }
+        for (int i = 0 ; i < count ; i++)
+        {
+            if (out[i] < 0) out[i] = 0 ;
         }
-       return mvect_temp_y;
     }
 }
@@ -15,6 +15,9 @@
  ***************************************************************************/
 #pragma once
 #include <vector> 
+#include <map>
+#include <mutex>
+#include <tuple>
 
 namespace mzUtils
 {
@@ -31,7 +34,14 @@ namespace mzUtils
 
         std::vector<float> mvect_temp_x ;
         std::vector<float> mvect_temp_y ;
-        std::vector<float> mvect_coefficients ;
+        //! coefficients of the filter, shared through the coefficient cache.
+        const std::vector<float>* mptr_coefficients ;
+
+        typedef std::tuple<int, int, int> CoefficientKey ;
+        static std::map<CoefficientKey, std::vector<float>> mmap_coefficients ;
+        static std::mutex mmutex_coefficients ;
+
+        static std::vector<float> ComputeCoefficients(int num_left, int num_right, int order) ;
 
     public:
         SavGolSmoother() ;
@@ -40,5 +50,17 @@ namespace mzUtils
         ~SavGolSmoother() ;
         void Smooth(std::vector<float> *mzs, std::vector<float> *intensities) ;
         std::vector<float> Smooth(std::vector<float>& intensities);
+
+        /**
+         * @brief Smooth `size` intensities into `smoothed`, which must not
+         * overlap them. Points too close to either end are copied as is.
+         */
+        void Smooth(const float* intensities, float* smoothed, int size) const ;
+
+        /**
+         * @brief Filter coefficients for the given window and order. They
+         * are computed once per process and shared by all smoothers.
+         */
+        static const std::vector<float>& Coefficients(int num_left, int num_right, int order) ;
     };
 }
@@ -3,6 +3,7 @@
 #include "mzSample.h"
 #include "constants.h"
 #include "SavGolSmoother.h"
+#include "deconvolver.h"
 
 Scan::Scan(mzSample* sample, int scannum, int mslevel, float rt, float precursorMz, int polarity) {
     this->sample = sample;
@@ -18,9 +19,19 @@ Scan::Scan(mzSample* sample, int scannum, int mslevel, float rt, float precursor
 	this->precursorCharge = 0;
 	this->precursorIntensity = 0;
     this->isolationWindow = 1;
+    this->dataOffset = -1;
+    this->_dataState = DataState::Loaded;
+}
+
+void Scan::loadData() {
+    DataState state = dataState();
+    if ((state == DataState::Pending || state == DataState::InColumns)
+        && sample)
+        sample->loadScanData(this);
 }
 
 void Scan::deepcopy(Scan* b) {
+    b->loadData();
     this->sample = b->sample;
     this->rt = b->rt;
     this->scannum = b->scannum;
@@ -43,6 +54,7 @@ void Scan::deepcopy(Scan* b) {
 }
 
 int Scan::findHighestIntensityPos(float _mz, MassCutoff *massCutoff) {
+        loadData();
         float mzmin = _mz - massCutoff->massCutoffValue(_mz);
         float mzmax = _mz + massCutoff->massCutoffValue(_mz);
 
@@ -65,6 +77,7 @@ int Scan::findHighestIntensityPos(float _mz, MassCutoff *massCutoff) {
 */
 //TODO: Sahil, Added while merging point
 int Scan::findClosestHighestIntensityPos(float _mz, MassCutoff *massCutoff) {
+			loadData();
 			float mzmin = _mz - massCutoff->getMassCutoff()-0.001;
 			float mzmax = _mz + massCutoff->getMassCutoff()+0.001;
 
@@ -91,6 +104,7 @@ int Scan::findClosestHighestIntensityPos(float _mz, MassCutoff *massCutoff) {
 }
 
 vector<int> Scan::findMatchingMzs(float mzmin, float mzmax) {
+	loadData();
 	vector<int>matches;
 	vector<float>::iterator itr = lower_bound(mz.begin(), mz.end(), mzmin-1);
 	int lb = itr-mz.begin();
@@ -202,6 +216,7 @@ void Scan::updateIntensityWithTheLocalMaximas(vector<float> *cMz, vector<float>
 }
 
 bool Scan::hasMz(float _mz, MassCutoff *massCutoff) {
+    loadData();
     float mzmin = _mz - massCutoff->massCutoffValue(_mz);
     float mzmax = _mz + massCutoff->massCutoffValue(_mz);
 	vector<float>::iterator itr = lower_bound(mz.begin(), mz.end(), mzmin);
@@ -239,159 +254,21 @@ vector<float> Scan::chargeSeries(float Mx, unsigned int Zx) {
 }
 
 
-bool Scan::setParentPeakData(float mzfocus,  float noiseLevel, MassCutoff *massCutoffMerge,float minSigNoiseRatio) {
-    bool flag=true;
-    int mzfocus_pos = this->findHighestIntensityPos(mzfocus,massCutoffMerge);
-    if (mzfocus_pos < 0 ) { cout << "ERROR: Can't find parent " << mzfocus << endl; flag=false; return flag; }
-    parentPeakIntensity=this->intensity[mzfocus_pos];
-    float parentPeakSN=parentPeakIntensity/noiseLevel;
-    if(parentPeakSN <=minSigNoiseRatio){ flag=false; return flag;}
-    return flag;
-}
-
-void Scan::initialiseBrotherData(int z, float mzfocus) {
-        brotherdata->expectedMass = (mzfocus*z)-z;     //predict what M ought to be
-        brotherdata->countMatches=0;
-        brotherdata->totalIntensity=0;
-        brotherdata->upCount=0;
-        brotherdata->downCount=0;
-        brotherdata->minZ=z;
-        brotherdata->maxZ=z;
-}
-
-void Scan::updateBrotherDataIfPeakFound(int loopdirection, int ii, bool *flag, bool *lastMatched, float *lastIntensity, float noiseLevel,  MassCutoff *massCutoffMerge) {
-
-            float brotherMz = (brotherdata->expectedMass+ii)/ii;
-            int pos = this->findHighestIntensityPos(brotherMz, massCutoffMerge);
-            float brotherIntensity = pos>=0?this->intensity[pos]:0;
-            float snRatio = brotherIntensity/noiseLevel;
-            if (brotherIntensity < 1.1*(*lastIntensity) && snRatio > 2 && withinXMassCutoff(this->mz[pos]*ii-ii,brotherdata->expectedMass,massCutoffMerge)) {
-                if (loopdirection==1) {
-                    brotherdata->maxZ = ii;
-                    brotherdata->upCount++;
-                }
-                else if (loopdirection==-1) {
-                    brotherdata->minZ = ii;
-                    brotherdata->downCount++;
-                }
-                brotherdata->countMatches++;
-                brotherdata->totalIntensity += brotherIntensity;
-                *lastMatched=true;
-                *lastIntensity=brotherIntensity;
-                //cout << "up.." << ii << " pos=" << pos << " snRa=" << snRatio << "\t"  << " T=" << totalIntensity <<  endl;
-            } else if (*lastMatched == true) {   //last charge matched ..but this one didn't..
-                *flag=false;
-                return;
-            }
-
-}
-
-void Scan::findBrotherPeaks (ChargedSpecies* x, float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge,int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates) {
-    brotherdata=&b;
-    for(int z=minDeconvolutionCharge; z <= maxDeconvolutionCharge; z++ ) {
-
-        initialiseBrotherData(z,mzfocus);
-
-        if (brotherdata->expectedMass >= maxDeconvolutionMass || brotherdata->expectedMass <= minDeconvolutionMass ) continue;
-        bool flag=true;
-        bool lastMatched=false;
-        int loopdirection;
-        loopdirection=1;
-        float lastIntensity=parentPeakIntensity;
-        for(int ii=z; ii < z+50 && ii<maxDeconvolutionCharge; ii++ ) {
-            updateBrotherDataIfPeakFound(loopdirection,ii,&flag, &lastMatched,&lastIntensity,noiseLevel,massCutoffMerge);
-            if (flag==false)
-               break;
-        }
-
-        flag=true;
-        lastMatched = false;
-        loopdirection=-1;
-        lastIntensity=parentPeakIntensity;
-        for(int ii=z-1; ii > z-50 && ii>minDeconvolutionCharge; ii--) {
-             updateBrotherDataIfPeakFound(loopdirection,ii,&flag, &lastMatched,&lastIntensity,noiseLevel,massCutoffMerge);
-             if (flag==false)
-                 break;
-        }
-
-        updateChargedSpeciesDataAndFindQScore(x, z, mzfocus,noiseLevel,massCutoffMerge,minChargedStates);
-
-    }
-    // done..
-}
-
-
-void Scan::updateChargedSpeciesDataAndFindQScore(ChargedSpecies* x, int z,float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge, int minChargedStates) {
-        if (x->totalIntensity < brotherdata->totalIntensity && brotherdata->countMatches>minChargedStates && brotherdata->upCount >= 2 && brotherdata->downCount >= 2 ) {
-                x->totalIntensity = brotherdata->totalIntensity;
-                x->countMatches=brotherdata->countMatches;
-                x->deconvolutedMass = (mzfocus*z)-z;
-                x->minZ = brotherdata->minZ;
-                x->maxZ = brotherdata->maxZ;
-                x->scan = this;
-                x->observedCharges.clear();
-                x->observedMzs.clear();
-                x->observedIntensities.clear();
-                x->upCount = brotherdata->upCount;
-                x->downCount = brotherdata->downCount;
-
-                float qscore=0;
-                for(int ii=brotherdata->minZ; ii <= brotherdata->maxZ; ii++ ) {
-                        int pos = this->findHighestIntensityPos( (brotherdata->expectedMass+ii)/ii, massCutoffMerge );
-                        if (pos > 0 ) {
-                                x->observedCharges.push_back(ii);
-                                x->observedMzs.push_back( this->mz[pos] );
-                                x->observedIntensities.push_back( this->intensity[pos] );
-                                float snRatio = this->intensity[pos]/noiseLevel;
-                                qscore += log(pow(0.97,(int)snRatio));
-                        //      if(ii == z) cout << '*';
-                        //      cout << setprecision(2) << snRatio << ",";
-                        }
-                }
-                x->qscore = -20*qscore;
-                //cout << " upC=" << x->upCount << " downC=" << x->downCount << " qscore=" << -qscore <<  " M=" << x->deconvolutedMass << endl;
-        }
-}
-
 ChargedSpecies* Scan::deconvolute(float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge, float minSigNoiseRatio, int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates ) {
-
-
-    bool flag=setParentPeakData(mzfocus,noiseLevel,massCutoffMerge,minSigNoiseRatio);
-
-        if (flag==false)
-            return NULL;
-    //cout << "Deconvolution of " << mzfocus << " pSN=" << parentPeakSN << endl;
-
-    int scanTotalIntensity=0;
-    for(unsigned int i=0; i<this->nobs();i++) scanTotalIntensity+=this->intensity[i];
-
-    ChargedSpecies* x = new ChargedSpecies();
-    findBrotherPeaks (x, mzfocus, noiseLevel, massCutoffMerge, minDeconvolutionCharge, maxDeconvolutionCharge, minDeconvolutionMass, maxDeconvolutionMass, minChargedStates);
-
-
-    if ( x->countMatches > minChargedStates ) {
-            findError(x);
-            return x;
-    } else {
-            delete(x);
-            x=NULL;
-            return(x);
-    }
+    Deconvolver deconvolver(this);
+    return deconvolver.deconvolute(mzfocus,
+                                   noiseLevel,
+                                   massCutoffMerge,
+                                   minSigNoiseRatio,
+                                   minDeconvolutionCharge,
+                                   maxDeconvolutionCharge,
+                                   minDeconvolutionMass,
+                                   maxDeconvolutionMass,
+                                   minChargedStates);
 }
 
-void Scan::findError(ChargedSpecies* x) {
-            float totalError=0; brotherdata->totalIntensity=0;
-            for(unsigned int i=0; i < x->observedCharges.size(); i++ ) {
-                    float My = (x->observedMzs[i]*x->observedCharges[i]) - x->observedCharges[i];
-                    float deltaM = abs(x->deconvolutedMass - My);
-                    totalError += deltaM*deltaM;
-                    brotherdata->totalIntensity += x->observedIntensities[i];
-            }
-            //cout << "\t" << mzfocus << " matches=" << x->countMatches << " totalInts=" << x->totalIntensity << " Score=" << x->qscore << endl;
-            x->error = sqrt(totalError/x->countMatches);
-            //cout << "-------- total Error= " << sqrt(totalError/x->countMatches) << " total Intensity=" << totalIntensity << endl;
-}
 vector<int> Scan::intensityOrderDesc() {
+    loadData();
     vector<pair<float,int> > mzarray(nobs());
     vector<int>position(nobs());
     for(unsigned int pos=0; pos < nobs(); pos++ ) {
@@ -409,6 +286,7 @@ vector<int> Scan::intensityOrderDesc() {
 vector <pair<float,float> > Scan::getTopPeaks(float minFracCutoff,float minSNRatio=3,int dropTopX=40)
 {
     vector<pair<float,float>> selected;
+    loadData();
     if (nobs() == 0)
         return selected;
 
@@ -436,6 +314,7 @@ vector <pair<float,float> > Scan::getTopPeaks(float minFracCutoff,float minSNRat
 
 string Scan::toMGF() { 
     //Merged with Maven776 - Kiran
+    loadData();
     std::stringstream buffer;
     buffer << "BEGIN IONS" << endl;
     if (sample) { buffer << "TITLE=" <<  sample->sampleName << "." << scannum << "." << scannum << "." << precursorCharge << endl; }
@@ -451,6 +330,7 @@ string Scan::toMGF() {
 }
 
 vector<int> Scan::assignCharges(MassCutoff *massCutoffTolr) {
+    loadData();
     if ( nobs() == 0) {
         vector<int>empty;
         return empty;
@@ -547,7 +427,7 @@ Scan* Scan::getLastFullScan(int historySize)
 {
 	if (!this->sample) return 0;
     int scanNum = this->scannum;
-    for(int i = scanNum; i > (scanNum - historySize); i--) {
+    for(int i = scanNum; i >= 0 && i > (scanNum - historySize); i--) {
         Scan* lscan = this->sample->getScan(i);
         if (!lscan or lscan->mslevel > 1) continue;
 		return lscan; // found ms1 scan, all is good
@@ -560,7 +440,7 @@ void Scan::recalculatePrecursorMz(float ppm)
     if (mslevel != 2)
         return;
     
-    Scan* fullScan = getLastFullScan(50);
+    Scan* fullScan = getLastFullScan();
     if (!fullScan)
         return;
     
@@ -568,7 +448,8 @@ void Scan::recalculatePrecursorMz(float ppm)
     massCutoff->setMassCutoffAndType(ppm, "ppm");
 
     //find highest intensity precursor for this ms2 scan
-    //increase the error range till a precursor is found
+    //increase the error range till a precursor is found, up to
+    //maxPrecursorShift
     for (int i : {1, 2, 3, 4, 5}) {
         massCutoff->setMassCutoff(ppm * i);
         int pos = fullScan->findHighestIntensityPos(this->precursorMz, massCutoff);
@@ -587,6 +468,7 @@ vector<mzPoint> Scan::getIsolatedRegion(float isolationWindowAmu)
 	//find last ms1 scan or get out
 	Scan* lastFullScan = this->getLastFullScan();
 	if (!lastFullScan) return isolatedSegment;
+	lastFullScan->loadData();
 
 	//no precursor information
 	if (this->precursorMz <= 0) return isolatedSegment;
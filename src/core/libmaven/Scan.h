@@ -5,6 +5,8 @@
 #include <QString>
 #include <QStringList>
 
+#include <atomic>
+
 #include "standardincludes.h"
 
 class mzSample;
@@ -25,20 +27,31 @@ There are multiple m/z and intenstities in one scan
 class Scan
 {
   public:
+    /**
+     * @brief State of the m/z and intensity arrays of a scan.
+     * @details Scans of lazily loaded samples start out Pending and become
+     * either Loaded or Failed once their spectrum has been decoded. Scans
+     * are InColumns while their arrays have been moved into the ScanColumns
+     * of their sample, and Loaded again once they have been copied back.
+     */
+    enum class DataState { Loaded, Pending, Failed, InColumns };
+
     Scan(mzSample *sample, int scannum, int mslevel, float rt, float precursorMz, int polarity);
 
     void deepcopy(Scan *b);
 
     /**
     * @brief return number of m/z's(number of observatiosn) recorded in a scan.
+    * Decodes the scan first if it has been loaded lazily.
     */
-    inline unsigned int nobs() const { return mz.size(); }
+    inline unsigned int nobs() { loadData(); return mz.size(); }
 
     /**
      * @brief Obtain the smallest m/z value stored.
      * @return Fractional m/z value.
      */
     inline float minMz() {
+        loadData();
         if(nobs() > 0)
             return *(std::min_element(begin(mz),
                                       end(mz)));
@@ -50,11 +63,56 @@ class Scan
      * @return Fractional m/z value.
      */
     inline float maxMz() {
+        loadData();
         if(nobs() > 0)
             return *(std::max_element(begin(mz),
                                       end(mz)));
         return 0.0f; }
 
+    /**
+     * @brief Make sure the m/z and intensity arrays of the scan are in
+     * memory.
+     * @details Scans of lazily loaded samples only carry their metadata until
+     * their arrays are needed. Code that reads `mz` or `intensity` of a scan
+     * it did not create should call this first; it is a no-op for scans that
+     * have already been loaded.
+     */
+    void loadData();
+
+    /**
+     * @brief Whether the m/z and intensity arrays are in memory.
+     * @details Safe to call while another thread decodes the scan; a true
+     * result means the arrays written by that thread are visible.
+     */
+    inline bool isDataLoaded() const
+    {
+        return dataState() == DataState::Loaded;
+    }
+
+    /**
+     * @brief Whether decoding the arrays of a lazily loaded scan failed.
+     * Such a scan has no data points, although its spectrum may have had
+     * some.
+     */
+    inline bool dataLoadFailed() const
+    {
+        return dataState() == DataState::Failed;
+    }
+
+    inline DataState dataState() const
+    {
+        return _dataState.load(memory_order_acquire);
+    }
+
+    /**
+     * @brief Publish the state of the arrays. Loaded and Failed must only be
+     * set once the arrays have been written.
+     */
+    inline void setDataState(DataState state)
+    {
+        _dataState.store(state, memory_order_release);
+    }
+
     /**
     *@brief return the corresponding sample
     */
@@ -110,8 +168,9 @@ class Scan
     * @brief Calculate the sum of all the intensities for a scan
     * @return return total intensity
     */
-    int totalIntensity() const
+    int totalIntensity()
     {
+        loadData();
         int sum = 0;
         for (unsigned int i = 0; i < intensity.size(); i++)
             sum += intensity[i];
@@ -126,6 +185,7 @@ class Scan
 
     float maxIntensity()
     {
+        loadData();
         float max = 0;
         for (unsigned int i = 0; i < intensity.size(); i++)
             if (intensity[i] > max)
@@ -145,6 +205,9 @@ class Scan
 
     vector<float> chargeSeries(float Mx, unsigned int Zx); //TODO what does this do chargeSeries?
 
+    /**
+    * @brief Charge state deconvolution of the peak at mzfocus (see Deconvolver)
+    */
     ChargedSpecies *deconvolute(float mzfocus, float noiseLevel, MassCutoff *massCutoffMerge, float minSigNoiseRatio, int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates);
 
     string toMGF();
@@ -181,6 +244,20 @@ class Scan
     */
     void recalculatePrecursorMz(float ppm);
 
+    /**
+     * @brief Largest change recalculatePrecursorMz(ppm) can make to the
+     * precursor m/z, in ppm.
+     */
+    static float maxPrecursorShift(float ppm) { return 5 * ppm; }
+
+    /**
+     * @brief gets the previous MS1 scan till historySize
+     * @details This is the full scan recalculatePrecursorMz takes the
+     * precursor from. It only looks at scan metadata, so it does not decode
+     * lazily loaded scans.
+     */
+    Scan* getLastFullScan(int historySize = 50);
+
     /**
      * @brief calculates purity of the spectra
      * @details if the parent full scan has multiple readings within a precursor m/z window
@@ -218,6 +295,8 @@ class Scan
     string filterLine;
     mzSample *sample; /**< sample corresponding to the scan */
     int polarity; /**< +1 for positively charged, -1 for negatively charged, 0 for neutral*/
+    /** byte offset of the spectrum in the source file for lazily loaded scans; -1 otherwise */
+    streamoff dataOffset;
 
     /**
      * @brief compare total intensity of two scans
@@ -240,33 +319,8 @@ class Scan
     bool operator<(const Scan &b) const { return rt < b.rt; }
 
   private:
-    float parentPeakIntensity;
+    atomic<DataState> _dataState;
 
-    struct BrotherData
-    {
-        float expectedMass;
-        int countMatches;
-        float totalIntensity;
-        int upCount;
-        int downCount;
-        int minZ;
-        int maxZ;
-    };
-
-    ofstream file;
-    BrotherData *brotherdata, b;
-    void initialiseBrotherData(int z, float mzfocus);
-    void updateBrotherDataIfPeakFound(int loopdirection, int ii, bool *flag, bool *lastMatched, float *lastIntensity, float noiseLevel, MassCutoff *massCutoffMerge);
-    void updateChargedSpeciesDataAndFindQScore(ChargedSpecies *x, int z, float mzfocus, float noiseLevel, MassCutoff *massCutoffMerge, int minChargedStates);
-    void findBrotherPeaks(ChargedSpecies *x, float mzfocus, float noiseLevel, MassCutoff *massCutoffMerge, int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates);
-    bool setParentPeakData(float mzfocus, float noiseLevel, MassCutoff *massCutoffMerge, float minSigNoiseRatio);
-    void findError(ChargedSpecies *x);
-    
-    /**
-     * @brief gets the previous MS1 scan till historySize
-     */ 
-    Scan* getLastFullScan(int historySize = 50);
-    
     /**
      * @brief gets the full-scan m/z-int readings that fall within the isolation window of the precursor
      */
@@ -1,60 +1,444 @@
 #include "base64.h"
 #include "mzUtils.h"
 
+// vectorized kernels are compiled for specific instruction sets through
+// function attributes and only used if the CPU reports support at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86_SIMD
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 namespace base64 {
-    string decodeString(const char *data, const size_t len)
-    {
-        unsigned char* p = (unsigned char*)data;
-        int pad = len > 0 && (len % 4 || p[len - 1] == '=');
-        const size_t L = ((len + 3) / 4 - pad) * 4;
-        std::string str(L / 4 * 3 + pad, '\0');
-
-        const int B64index[256] = {
-            0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-            0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-            0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  62, 63, 62, 62, 63,
-            52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 0,  0,  0,  0,  0,  0,
-            0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14,
-            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0,  0,  0,  0,  63,
-            0,  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-            41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51
-        };
+namespace {
+    const int B64index[256] = {
+        0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+        0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+        0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  62, 63, 62, 62, 63,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 0,  0,  0,  0,  0,  0,
+        0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0,  0,  0,  0,  63,
+        0,  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51
+    };
+
+    // Vector kernels store a full register per block, which may run past the
+    // last decoded byte. Output buffers are sized with this much slack.
+    const size_t outputSlack = 32;
+
+    /**
+     * A block decoder turns complete groups of four base64 characters into
+     * bytes and returns how many characters it consumed. It may stop early,
+     * e.g. when it meets a character outside the standard alphabet; the
+     * remainder is then handled by the scalar code.
+     */
+    typedef size_t (*BlockDecoder)(const unsigned char* src,
+                                   size_t len,
+                                   char* dest);
+
+    /**
+     * A converter narrows the first `count` 4 or 8 byte floating point values
+     * of a byte buffer into floats, swapping byte order on the way if asked
+     * to, and returns how many values it converted.
+     */
+    typedef size_t (*Converter)(const char* src,
+                                size_t count,
+                                int float_size,
+                                bool swap,
+                                float* dest);
 
+    size_t decodeBlocksScalar(const unsigned char* p, size_t len, char* dest)
+    {
+        size_t L = len / 4 * 4;
         for (size_t i = 0, j = 0; i < L; i += 4)
         {
             int n = B64index[p[i]] << 18 | B64index[p[i + 1]] << 12
                     | B64index[p[i + 2]] << 6 | B64index[p[i + 3]];
-            str[j++] = n >> 16;
-            str[j++] = n >> 8 & 0xFF;
-            str[j++] = n & 0xFF;
+            dest[j++] = n >> 16;
+            dest[j++] = n >> 8 & 0xFF;
+            dest[j++] = n & 0xFF;
+        }
+        return L;
+    }
+
+    size_t convertScalar(const char* dest,
+                         size_t size,
+                         int float_size,
+                         bool swap,
+                         float* decodedArray)
+    {
+        if ( float_size == 8 ) {
+            if ( swap == false ) {
+                for (size_t i=0; i<size; i++)
+                    decodedArray[i] = (float) ((double*) dest)[i];
+            } else {
+                uint64_t *u = (uint64_t *) dest;
+                double data=0;
+                for (size_t i=0; i<size; i++) {
+                    uint64_t t = swapbytes64(u[i]);
+                    memcpy(&data,&t,8);
+                    decodedArray[i] = (float) data;
+                }
+            }
+        } else if (float_size == 4 ) {
+            if ( swap == false) {
+                memcpy(decodedArray, dest, size * 4);
+            } else {
+                uint32_t *u = (uint32_t *) dest;
+                float data=0;
+                for (size_t i=0; i<size; i++) {
+                    uint32_t t = swapbytes(u[i]);
+                    memcpy(&data,&t,4);
+                    decodedArray[i] = data;
+                }
+            }
         }
+        return size;
+    }
+
+#ifdef BASE64_X86_SIMD
+    /*
+     * The vector decoders translate characters to their 6-bit values with
+     * nibble indexed lookups: one pair of tables flags characters outside
+     * the standard alphabet, a third gives the offset to add for each
+     * character range. The 6-bit values are then merged into bytes with two
+     * multiply-adds and a byte shuffle.
+     */
+
+    __attribute__((target("ssse3,sse4.1")))
+    size_t decodeBlocksSSE(const unsigned char* src, size_t len, char* dest)
+    {
+        const __m128i lutLo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lutHi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lutRoll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i mask2F = _mm_set1_epi8(0x2F);
+        const __m128i packBytes = _mm_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        size_t i = 0;
+        char* out = dest;
+        for (; i + 16 <= len; i += 16, out += 12) {
+            __m128i str = _mm_loadu_si128((const __m128i*) (src + i));
+
+            __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask2F);
+            __m128i loNibbles = _mm_and_si128(str, mask2F);
+            __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+            __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+            if (!_mm_testz_si128(lo, hi))
+                break;
+
+            __m128i eq2F = _mm_cmpeq_epi8(str, mask2F);
+            __m128i roll = _mm_shuffle_epi8(lutRoll,
+                                            _mm_add_epi8(eq2F, hiNibbles));
+            str = _mm_add_epi8(str, roll);
+
+            str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+            str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+            str = _mm_shuffle_epi8(str, packBytes);
+            _mm_storeu_si128((__m128i*) out, str);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t decodeBlocksAVX2(const unsigned char* src, size_t len, char* dest)
+    {
+        const __m256i lutLo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m256i lutHi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lutRoll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i mask2F = _mm256_set1_epi8(0x2F);
+        const __m256i packBytes = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i packLanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+        size_t i = 0;
+        char* out = dest;
+        for (; i + 32 <= len; i += 32, out += 24) {
+            __m256i str = _mm256_loadu_si256((const __m256i*) (src + i));
+
+            __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4),
+                                                 mask2F);
+            __m256i loNibbles = _mm256_and_si256(str, mask2F);
+            __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+            __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+            if (!_mm256_testz_si256(lo, hi))
+                break;
+
+            __m256i eq2F = _mm256_cmpeq_epi8(str, mask2F);
+            __m256i roll = _mm256_shuffle_epi8(
+                lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+            str = _mm256_add_epi8(str, roll);
+
+            str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+            str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+            str = _mm256_shuffle_epi8(str, packBytes);
+            str = _mm256_permutevar8x32_epi32(str, packLanes);
+            _mm256_storeu_si256((__m256i*) out, str);
+        }
+
+        // finish off with 16 character blocks
+        return i + decodeBlocksSSE(src + i, len - i, out);
+    }
+
+    __attribute__((target("ssse3,sse4.1")))
+    size_t convertSSE(const char* src,
+                      size_t count,
+                      int float_size,
+                      bool swap,
+                      float* dest)
+    {
+        const __m128i swap32 = _mm_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m128i swap64 = _mm_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+        size_t i = 0;
+        if (float_size == 8) {
+            for (; i + 2 <= count; i += 2) {
+                __m128i v = _mm_loadu_si128((const __m128i*) (src + i * 8));
+                if (swap)
+                    v = _mm_shuffle_epi8(v, swap64);
+                __m128 narrowed = _mm_cvtpd_ps(_mm_castsi128_pd(v));
+                _mm_storel_pi((__m64*) (dest + i), narrowed);
+            }
+        } else if (float_size == 4 && swap) {
+            for (; i + 4 <= count; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*) (src + i * 4));
+                v = _mm_shuffle_epi8(v, swap32);
+                _mm_storeu_si128((__m128i*) (dest + i), v);
+            }
+        }
+        return i + convertScalar(src + i * float_size,
+                                 count - i,
+                                 float_size,
+                                 swap,
+                                 dest + i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t convertAVX2(const char* src,
+                       size_t count,
+                       int float_size,
+                       bool swap,
+                       float* dest)
+    {
+        const __m256i swap32 = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m256i swap64 = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+        size_t i = 0;
+        if (float_size == 8) {
+            for (; i + 4 <= count; i += 4) {
+                __m256i v = _mm256_loadu_si256((const __m256i*) (src + i * 8));
+                if (swap)
+                    v = _mm256_shuffle_epi8(v, swap64);
+                __m128 narrowed = _mm256_cvtpd_ps(_mm256_castsi256_pd(v));
+                _mm_storeu_ps(dest + i, narrowed);
+            }
+        } else if (float_size == 4 && swap) {
+            for (; i + 8 <= count; i += 8) {
+                __m256i v = _mm256_loadu_si256((const __m256i*) (src + i * 4));
+                v = _mm256_shuffle_epi8(v, swap32);
+                _mm256_storeu_si256((__m256i*) (dest + i), v);
+            }
+        }
+        return i + convertSSE(src + i * float_size,
+                              count - i,
+                              float_size,
+                              swap,
+                              dest + i);
+    }
+#endif
+
+    /**
+     * Kernels used for decoding.
+     */
+    struct Kernels {
+        const char* name;
+        BlockDecoder decodeBlocks;
+        Converter convert;
+    };
+
+    /**
+     * Kernels the CPU can run, checked once, from the portable scalar code
+     * up to the fastest.
+     */
+    const vector<Kernels>& supportedKernels()
+    {
+        static const vector<Kernels> supported = []() -> vector<Kernels> {
+            vector<Kernels> k;
+            k.push_back({"scalar", decodeBlocksScalar, convertScalar});
+#ifdef BASE64_X86_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse4.1")
+                && __builtin_cpu_supports("ssse3")) {
+                k.push_back({"sse4", decodeBlocksSSE, convertSSE});
+            }
+            if (__builtin_cpu_supports("avx2"))
+                k.push_back({"avx2", decodeBlocksAVX2, convertAVX2});
+#endif
+            return k;
+        }();
+        return supported;
+    }
+
+    // kernels forced by forceDecoder, null to use the fastest supported ones
+    const Kernels* forcedKernels = nullptr;
+
+    const Kernels& kernels()
+    {
+        if (forcedKernels != nullptr)
+            return *forcedKernels;
+        return supportedKernels().back();
+    }
+
+    /**
+     * Growable scratch buffer aligned to a cache line, so that the vector
+     * kernels never split a load across lines when reading it.
+     */
+    class AlignedBuffer {
+        public:
+        AlignedBuffer() : _raw(nullptr), _data(nullptr), _capacity(0) {}
+        ~AlignedBuffer() { free(_raw); }
+
+        char* reserve(size_t size)
+        {
+            if (size > _capacity) {
+                free(_raw);
+                _raw = (char*) malloc(size + 63);
+                _data = (char*) (((uintptr_t) _raw + 63) & ~(uintptr_t) 63);
+                _capacity = size;
+            }
+            return _data;
+        }
+
+        private:
+        char* _raw;
+        char* _data;
+        size_t _capacity;
+
+        AlignedBuffer(const AlignedBuffer&);
+        AlignedBuffer& operator=(const AlignedBuffer&);
+    };
+
+    /**
+     * Size of the decoded form of `len` base64 characters, following the
+     * same rules as the original scalar decoder for padded and truncated
+     * input.
+     */
+    size_t decodedSize(const unsigned char* p, size_t len)
+    {
+        int pad = len > 0 && (len % 4 || p[len - 1] == '=');
+        const size_t L = ((len + 3) / 4 - pad) * 4;
+        size_t size = L / 4 * 3 + pad;
+        if (pad && len > L + 2 && p[L + 2] != '=')
+            size++;
+        return size;
+    }
+
+    /**
+     * Decode `len` base64 characters into `dest`, which must have room for
+     * decodedSize() bytes plus outputSlack.
+     */
+    size_t decodeInto(const unsigned char* p, size_t len, char* dest)
+    {
+        int pad = len > 0 && (len % 4 || p[len - 1] == '=');
+        const size_t L = ((len + 3) / 4 - pad) * 4;
+
+        size_t i = kernels().decodeBlocks(p, L, dest);
+        decodeBlocksScalar(p + i, L - i, dest + i / 4 * 3);
+
+        size_t size = L / 4 * 3;
         if (pad)
         {
             int n = B64index[p[L]] << 18 | B64index[p[L + 1]] << 12;
-            str[str.size() - 1] = n >> 16;
+            dest[size++] = n >> 16;
 
             if (len > L + 2 && p[L + 2] != '=')
             {
                 n |= B64index[p[L + 2]] << 6;
-                str.push_back(n >> 8 & 0xFF);
+                dest[size++] = n >> 8 & 0xFF;
             }
         }
+        return size;
+    }
+} // namespace
+
+    string decodeString(const char *data, const size_t len)
+    {
+        string str;
+        decodeString(data, len, str);
         return str;
     }
 
+    void decodeString(const char *data, const size_t len, string& str)
+    {
+        const unsigned char* p = (const unsigned char*) data;
+        str.resize(decodedSize(p, len) + outputSlack);
+        str.resize(decodeInto(p, len, &str[0]));
+    }
+
     vector<float> decodeBase64(const string& src,
                                int float_size,
                                bool neworkorder,
                                bool decompress)
     {
-        string destStr = decodeString(src.c_str(), src.size());
+        vector<float> decodedArray;
+        decodeBase64(src.c_str(),
+                     src.size(),
+                     float_size,
+                     neworkorder,
+                     decompress,
+                     decodedArray);
+        return decodedArray;
+    }
+
+    bool decodeBase64(const char* src,
+                      size_t len,
+                      int float_size,
+                      bool neworkorder,
+                      bool decompress,
+                      vector<float>& decodedArray)
+    {
+        // scratch buffers are reused across calls made from the same thread,
+        // so that loading a file does not allocate them once per array
+        static thread_local AlignedBuffer decoded;
+        static thread_local string inflated;
+
+        const unsigned char* p = (const unsigned char*) src;
+        char* dest = decoded.reserve(decodedSize(p, len) + outputSlack);
+        size_t destSize = decodeInto(p, len, dest);
 
         if (decompress) {
-#ifdef ZLIB
-            destStr = mzUtils::decompressString(destStr);
-#endif
+            if (!mzUtils::decompressString(dest, destSize, inflated)) {
+                decodedArray.clear();
+                return false;
+            }
+            dest = &inflated[0];
+            destSize = inflated.size();
         }
 
 #if (LITTLE_ENDIAN == 1)
@@ -62,40 +446,47 @@ namespace base64 {
          neworkorder=!neworkorder;
 #endif
 
-        int size = 1 + (destStr.size() - 4) / float_size;
-
         // we will cast everything as a float may be this is not wise,
         // but have not found a need for double precission yet.
-        vector<float> decodedArray(size);
-        const char* dest = destStr.c_str();
+        size_t size = 0;
+        if (float_size == 4 || float_size == 8)
+            size = destSize / float_size;
+        decodedArray.resize(size);
+        if (size > 0) {
+            kernels().convert(dest,
+                              size,
+                              float_size,
+                              neworkorder,
+                              decodedArray.data());
+        }
+        return true;
+    }
 
-        if ( float_size == 8 ) {
-            if ( neworkorder == false ) {
-                for (int i=0; i<size; i++)
-                    decodedArray[i] = (float) ((double*) dest)[i];
-            } else {
-                uint64_t *u = (uint64_t *) dest;
-                double data=0;
-                for (int i=0; i<size; i++) {
-                    uint64_t t = swapbytes64(u[i]);
-                    memcpy(&data,&t,8);
-                    decodedArray[i] = (float) data;
-                }
-            }
-        } else if (float_size == 4 ) {
-            if ( neworkorder == false) {
-                for (int i=0; i<size; i++) decodedArray[i] = ((float*)dest)[i];
-            } else {
-                uint32_t *u = (uint32_t *) dest;
-                float data=0;
-                for (int i=0; i<size; i++) {
-                    uint32_t t = swapbytes(u[i]);
-                    memcpy(&data,&t,4);
-                    decodedArray[i] = data;
-                }
+    const char* decoderName()
+    {
+        return kernels().name;
+    }
+
+    vector<string> supportedDecoders()
+    {
+        vector<string> names;
+        for (const Kernels& k : supportedKernels())
+            names.push_back(k.name);
+        return names;
+    }
+
+    bool forceDecoder(const string& name)
+    {
+        if (name.empty()) {
+            forcedKernels = nullptr;
+            return true;
+        }
+        for (const Kernels& k : supportedKernels()) {
+            if (name == k.name) {
+                forcedKernels = &k;
+                return true;
             }
         }
-
-        return decodedArray;
+        return false;
     }
 } // namespace
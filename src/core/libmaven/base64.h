@@ -46,13 +46,38 @@ namespace base64 {
      * @param decompress Whether the string needs to be decompressed after
      * decoding step.
      * @return A vector of floating point values extracted from undecoded binary
-     * data.
+     * data, empty if the data could not be decompressed.
      */
     vector<float> decodeBase64(const string& src,
                                int float_size,
                                bool neworkorder,
                                bool decompress);
 
+    /**
+     * @brief Decode base64 encoded (and optionally zlib compressed) binary
+     * data straight into an existing array of floating point values.
+     * @details The input is read in place, e.g. from the text of a parsed
+     * XML node, and the intermediate byte buffers are kept per thread. This
+     * makes the function safe to call concurrently for different arrays and
+     * avoids the string copies of the value returning overload.
+     * @param src Pointer to base64 encoded data.
+     * @param len Number of base64 characters.
+     * @param float_size Value denoting precision of floating point data.
+     * @param neworkorder Boolean indication network order.
+     * @param decompress Whether the data needs to be decompressed after
+     * decoding step.
+     * @param decodedArray Array that will be resized to hold the decoded
+     * values.
+     * @return False if the data could not be decompressed, in which case
+     * `decodedArray` is left empty.
+     */
+    bool decodeBase64(const char* src,
+                      size_t len,
+                      int float_size,
+                      bool neworkorder,
+                      bool decompress,
+                      vector<float>& decodedArray);
+
     /**
      * @brief Decode a plain base64-encoded string.
      * @param data A raw base64-encoded buffer.
@@ -60,6 +85,41 @@ namespace base64 {
      * @return A decoded form of input base64- encoded string.
      */
     string decodeString(const char* data, const size_t len);
+
+    /**
+     * @brief Decode a plain base64-encoded buffer into an existing string.
+     * @param data A raw base64-encoded buffer.
+     * @param len Length of the buffer containing base64 data.
+     * @param str String that will be overwritten with the decoded bytes.
+     */
+    void decodeString(const char* data, const size_t len, string& str);
+
+    /**
+     * @brief Name of the decoding kernels picked for this CPU.
+     * @details The base64 decoder and the float conversion use AVX2 or
+     * SSE4 instructions when the processor supports them, and fall back to
+     * portable scalar code otherwise. The choice is made once, at first use,
+     * unless it is overridden with forceDecoder.
+     * @return One of "avx2", "sse4" or "scalar".
+     */
+    const char* decoderName();
+
+    /**
+     * @brief Names of the decoding kernels this CPU can run, starting with
+     * "scalar" and ending with the one picked by default.
+     */
+    vector<string> supportedDecoders();
+
+    /**
+     * @brief Make every decode use the named kernels instead of the fastest
+     * ones, so that tests can check each of them on the same CPU.
+     * @details Not thread safe; meant for tests only.
+     * @param name One of the names returned by supportedDecoders, or an empty
+     * string to go back to the default choice.
+     * @return False (leaving the choice unchanged) if the CPU cannot run the
+     * named kernels.
+     */
+    bool forceDecoder(const string& name);
 }
 
 #endif
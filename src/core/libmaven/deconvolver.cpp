@@ -0,0 +1,163 @@
+#include "deconvolver.h"
+#include "masscutofftype.h"
+#include "mzSample.h"
+#include "mzUtils.h"
+#include "Scan.h"
+
+Deconvolver::Deconvolver(Scan* scan)
+{
+    _scan = scan;
+    _parentPeakIntensity = 0;
+}
+
+bool Deconvolver::setParentPeakData(float mzfocus,  float noiseLevel, MassCutoff *massCutoffMerge,float minSigNoiseRatio) {
+    bool flag=true;
+    int mzfocus_pos = _scan->findHighestIntensityPos(mzfocus,massCutoffMerge);
+    if (mzfocus_pos < 0 ) { cout << "ERROR: Can't find parent " << mzfocus << endl; flag=false; return flag; }
+    _parentPeakIntensity=_scan->intensity[mzfocus_pos];
+    float parentPeakSN=_parentPeakIntensity/noiseLevel;
+    if(parentPeakSN <=minSigNoiseRatio){ flag=false; return flag;}
+    return flag;
+}
+
+void Deconvolver::initialiseBrotherData(int z, float mzfocus) {
+        _brotherData.expectedMass = (mzfocus*z)-z;     //predict what M ought to be
+        _brotherData.countMatches=0;
+        _brotherData.totalIntensity=0;
+        _brotherData.upCount=0;
+        _brotherData.downCount=0;
+        _brotherData.minZ=z;
+        _brotherData.maxZ=z;
+}
+
+void Deconvolver::updateBrotherDataIfPeakFound(int loopdirection, int ii, bool *flag, bool *lastMatched, float *lastIntensity, float noiseLevel,  MassCutoff *massCutoffMerge) {
+
+            float brotherMz = (_brotherData.expectedMass+ii)/ii;
+            int pos = _scan->findHighestIntensityPos(brotherMz, massCutoffMerge);
+            float brotherIntensity = pos>=0?_scan->intensity[pos]:0;
+            float snRatio = brotherIntensity/noiseLevel;
+            if (brotherIntensity < 1.1*(*lastIntensity) && snRatio > 2 && withinXMassCutoff(_scan->mz[pos]*ii-ii,_brotherData.expectedMass,massCutoffMerge)) {
+                if (loopdirection==1) {
+                    _brotherData.maxZ = ii;
+                    _brotherData.upCount++;
+                }
+                else if (loopdirection==-1) {
+                    _brotherData.minZ = ii;
+                    _brotherData.downCount++;
+                }
+                _brotherData.countMatches++;
+                _brotherData.totalIntensity += brotherIntensity;
+                *lastMatched=true;
+                *lastIntensity=brotherIntensity;
+                //cout << "up.." << ii << " pos=" << pos << " snRa=" << snRatio << "\t"  << " T=" << totalIntensity <<  endl;
+            } else if (*lastMatched == true) {   //last charge matched ..but this one didn't..
+                *flag=false;
+                return;
+            }
+
+}
+
+void Deconvolver::findBrotherPeaks (ChargedSpecies* x, float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge,int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates) {
+    for(int z=minDeconvolutionCharge; z <= maxDeconvolutionCharge; z++ ) {
+
+        initialiseBrotherData(z,mzfocus);
+
+        if (_brotherData.expectedMass >= maxDeconvolutionMass || _brotherData.expectedMass <= minDeconvolutionMass ) continue;
+        bool flag=true;
+        bool lastMatched=false;
+        int loopdirection;
+        loopdirection=1;
+        float lastIntensity=_parentPeakIntensity;
+        for(int ii=z; ii < z+50 && ii<maxDeconvolutionCharge; ii++ ) {
+            updateBrotherDataIfPeakFound(loopdirection,ii,&flag, &lastMatched,&lastIntensity,noiseLevel,massCutoffMerge);
+            if (flag==false)
+               break;
+        }
+
+        flag=true;
+        lastMatched = false;
+        loopdirection=-1;
+        lastIntensity=_parentPeakIntensity;
+        for(int ii=z-1; ii > z-50 && ii>minDeconvolutionCharge; ii--) {
+             updateBrotherDataIfPeakFound(loopdirection,ii,&flag, &lastMatched,&lastIntensity,noiseLevel,massCutoffMerge);
+             if (flag==false)
+                 break;
+        }
+
+        updateChargedSpeciesDataAndFindQScore(x, z, mzfocus,noiseLevel,massCutoffMerge,minChargedStates);
+
+    }
+    // done..
+}
+
+
+void Deconvolver::updateChargedSpeciesDataAndFindQScore(ChargedSpecies* x, int z,float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge, int minChargedStates) {
+        if (x->totalIntensity < _brotherData.totalIntensity && _brotherData.countMatches>minChargedStates && _brotherData.upCount >= 2 && _brotherData.downCount >= 2 ) {
+                x->totalIntensity = _brotherData.totalIntensity;
+                x->countMatches=_brotherData.countMatches;
+                x->deconvolutedMass = (mzfocus*z)-z;
+                x->minZ = _brotherData.minZ;
+                x->maxZ = _brotherData.maxZ;
+                x->scan = _scan;
+                x->observedCharges.clear();
+                x->observedMzs.clear();
+                x->observedIntensities.clear();
+                x->upCount = _brotherData.upCount;
+                x->downCount = _brotherData.downCount;
+
+                float qscore=0;
+                for(int ii=_brotherData.minZ; ii <= _brotherData.maxZ; ii++ ) {
+                        int pos = _scan->findHighestIntensityPos( (_brotherData.expectedMass+ii)/ii, massCutoffMerge );
+                        if (pos > 0 ) {
+                                x->observedCharges.push_back(ii);
+                                x->observedMzs.push_back( _scan->mz[pos] );
+                                x->observedIntensities.push_back( _scan->intensity[pos] );
+                                float snRatio = _scan->intensity[pos]/noiseLevel;
+                                qscore += log(pow(0.97,(int)snRatio));
+                        //      if(ii == z) cout << '*';
+                        //      cout << setprecision(2) << snRatio << ",";
+                        }
+                }
+                x->qscore = -20*qscore;
+                //cout << " upC=" << x->upCount << " downC=" << x->downCount << " qscore=" << -qscore <<  " M=" << x->deconvolutedMass << endl;
+        }
+}
+
+ChargedSpecies* Deconvolver::deconvolute(float mzfocus, float noiseLevel,  MassCutoff *massCutoffMerge, float minSigNoiseRatio, int minDeconvolutionCharge, int maxDeconvolutionCharge, int minDeconvolutionMass, int maxDeconvolutionMass, int minChargedStates ) {
+
+
+    bool flag=setParentPeakData(mzfocus,noiseLevel,massCutoffMerge,minSigNoiseRatio);
+
+        if (flag==false)
+            return NULL;
+    //cout << "Deconvolution of " << mzfocus << " pSN=" << parentPeakSN << endl;
+
+    int scanTotalIntensity=0;
+    for(unsigned int i=0; i<_scan->nobs();i++) scanTotalIntensity+=_scan->intensity[i];
+
+    ChargedSpecies* x = new ChargedSpecies();
+    findBrotherPeaks (x, mzfocus, noiseLevel, massCutoffMerge, minDeconvolutionCharge, maxDeconvolutionCharge, minDeconvolutionMass, maxDeconvolutionMass, minChargedStates);
+
+
+    if ( x->countMatches > minChargedStates ) {
+            findError(x);
+            return x;
+    } else {
+            delete(x);
+            x=NULL;
+            return(x);
+    }
+}
+
+void Deconvolver::findError(ChargedSpecies* x) {
+            float totalError=0; _brotherData.totalIntensity=0;
+            for(unsigned int i=0; i < x->observedCharges.size(); i++ ) {
+                    float My = (x->observedMzs[i]*x->observedCharges[i]) - x->observedCharges[i];
+                    float deltaM = abs(x->deconvolutedMass - My);
+                    totalError += deltaM*deltaM;
+                    _brotherData.totalIntensity += x->observedIntensities[i];
+            }
+            //cout << "\t" << mzfocus << " matches=" << x->countMatches << " totalInts=" << x->totalIntensity << " Score=" << x->qscore << endl;
+            x->error = sqrt(totalError/x->countMatches);
+            //cout << "-------- total Error= " << sqrt(totalError/x->countMatches) << " total Intensity=" << totalIntensity << endl;
+}
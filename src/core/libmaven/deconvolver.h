@@ -0,0 +1,87 @@
+#ifndef DECONVOLVER_H
+#define DECONVOLVER_H
+
+#include "standardincludes.h"
+
+class ChargedSpecies;
+class MassCutoff;
+class Scan;
+
+using namespace std;
+
+/**
+ * @class Deconvolver
+ * @ingroup libmaven
+ * @brief Charge state deconvolution of a peak in a scan.
+ * @details Looks for the brother peaks of a parent m/z, i.e. peaks of the
+ * same neutral mass at neighbouring charge states, and reports the charge
+ * series that explains most of the intensity. The bookkeeping needed while
+ * searching lives here rather than in Scan, so that scans do not carry it.
+ */
+class Deconvolver
+{
+  public:
+    Deconvolver(Scan* scan);
+
+    /**
+     * @brief Deconvolute the charge series of a parent m/z.
+     * @return Newly allocated charged species, or null if the parent peak
+     * is missing or too few charge states were found.
+     */
+    ChargedSpecies* deconvolute(float mzfocus,
+                                float noiseLevel,
+                                MassCutoff* massCutoffMerge,
+                                float minSigNoiseRatio,
+                                int minDeconvolutionCharge,
+                                int maxDeconvolutionCharge,
+                                int minDeconvolutionMass,
+                                int maxDeconvolutionMass,
+                                int minChargedStates);
+
+  private:
+    struct BrotherData
+    {
+        float expectedMass;
+        int countMatches;
+        float totalIntensity;
+        int upCount;
+        int downCount;
+        int minZ;
+        int maxZ;
+    };
+
+    Scan* _scan;
+    float _parentPeakIntensity;
+    BrotherData _brotherData;
+
+    bool setParentPeakData(float mzfocus,
+                           float noiseLevel,
+                           MassCutoff* massCutoffMerge,
+                           float minSigNoiseRatio);
+    void initialiseBrotherData(int z, float mzfocus);
+    void updateBrotherDataIfPeakFound(int loopdirection,
+                                      int ii,
+                                      bool* flag,
+                                      bool* lastMatched,
+                                      float* lastIntensity,
+                                      float noiseLevel,
+                                      MassCutoff* massCutoffMerge);
+    void updateChargedSpeciesDataAndFindQScore(ChargedSpecies* x,
+                                               int z,
+                                               float mzfocus,
+                                               float noiseLevel,
+                                               MassCutoff* massCutoffMerge,
+                                               int minChargedStates);
+    void findBrotherPeaks(ChargedSpecies* x,
+                          float mzfocus,
+                          float noiseLevel,
+                          MassCutoff* massCutoffMerge,
+                          int minDeconvolutionCharge,
+                          int maxDeconvolutionCharge,
+                          int minDeconvolutionMass,
+                          int maxDeconvolutionMass,
+                          int minChargedStates);
+    void findError(ChargedSpecies* x);
+};
+
+#endif // DECONVOLVER_H
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <mutex>
+
+#include "eicpool.h"
+#include "EIC.h"
+#include "mzUtils.h"
+
+atomic<size_t> EICPool::_maxPooled(10000);
+atomic<size_t> EICPool::_acquired(0);
+atomic<size_t> EICPool::_reused(0);
+atomic<size_t> EICPool::_released(0);
+atomic<size_t> EICPool::_discarded(0);
+atomic<size_t> EICPool::_bufferAllocationsAtReset(0);
+
+namespace {
+    struct ThreadPool;
+
+    // pools of all live threads, so that any thread can free them
+    mutex& registryMutex()
+    {
+        static mutex registryMutex;
+        return registryMutex;
+    }
+
+    vector<ThreadPool*>& registry()
+    {
+        static vector<ThreadPool*> pools;
+        return pools;
+    }
+
+    // owns the EICs pooled by a thread and frees them when it exits; the
+    // lock is only contended while another thread clears all pools
+    struct ThreadPool {
+        mutex lock;
+        vector<EIC*> eics;
+
+        ThreadPool()
+        {
+            lock_guard<mutex> guard(registryMutex());
+            registry().push_back(this);
+        }
+
+        ~ThreadPool()
+        {
+            {
+                lock_guard<mutex> guard(registryMutex());
+                auto& pools = registry();
+                pools.erase(remove(pools.begin(), pools.end(), this),
+                            pools.end());
+            }
+            mzUtils::delete_all(eics);
+        }
+    };
+
+    ThreadPool& threadPool()
+    {
+        static thread_local ThreadPool pool;
+        return pool;
+    }
+}
+
+EIC* EICPool::acquire()
+{
+    _acquired++;
+    ThreadPool& pool = threadPool();
+    EIC* eic = nullptr;
+    {
+        lock_guard<mutex> guard(pool.lock);
+        if (!pool.eics.empty()) {
+            eic = pool.eics.back();
+            pool.eics.pop_back();
+        }
+    }
+    if (eic == nullptr)
+        return new EIC();
+
+    _reused++;
+    return eic;
+}
+
+void EICPool::release(EIC* eic)
+{
+    if (eic == nullptr)
+        return;
+
+    _released++;
+    eic->reset();
+    ThreadPool& pool = threadPool();
+    {
+        lock_guard<mutex> guard(pool.lock);
+        if (pool.eics.size() < _maxPooled) {
+            pool.eics.push_back(eic);
+            return;
+        }
+    }
+    _discarded++;
+    delete eic;
+}
+
+void EICPool::release(vector<EIC*>& eics)
+{
+    for (auto eic : eics)
+        release(eic);
+    eics.clear();
+}
+
+void EICPool::clear()
+{
+    lock_guard<mutex> guard(registryMutex());
+    for (auto pool : registry()) {
+        lock_guard<mutex> poolGuard(pool->lock);
+        mzUtils::delete_all(pool->eics);
+    }
+}
+
+size_t EICPool::pooled()
+{
+    size_t pooled = 0;
+    lock_guard<mutex> guard(registryMutex());
+    for (auto pool : registry()) {
+        lock_guard<mutex> poolGuard(pool->lock);
+        pooled += pool->eics.size();
+    }
+    return pooled;
+}
+
+EICPool::Stats EICPool::stats()
+{
+    Stats stats;
+    stats.acquired = _acquired;
+    stats.reused = _reused;
+    stats.released = _released;
+    stats.discarded = _discarded;
+    stats.bufferAllocations = EIC::bufferAllocations()
+                              - _bufferAllocationsAtReset;
+    return stats;
+}
+
+void EICPool::resetStats()
+{
+    _acquired = 0;
+    _reused = 0;
+    _released = 0;
+    _discarded = 0;
+    _bufferAllocationsAtReset = EIC::bufferAllocations();
+}
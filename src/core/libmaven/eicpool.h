@@ -0,0 +1,89 @@
+#ifndef EICPOOL_H
+#define EICPOOL_H
+
+#include <atomic>
+#include <vector>
+
+class EIC;
+
+using namespace std;
+
+/**
+ * @class EICPool
+ * @ingroup libmaven
+ * @brief Per-thread pools of EICs, so that the EICs of one slice reuse the
+ * memory of those of previous slices.
+ * @details Peak detection pulls an EIC per sample for every slice and
+ * discards them as soon as the slice has been grouped. Released EICs are
+ * reset (see EIC::reset) and kept by the releasing thread, data vectors,
+ * spline and baseline included, and handed out again by `acquire` on that
+ * thread. Each pool keeps at most `maxPooled` EICs and frees its EICs when
+ * the thread exits. The pools of all threads can also be freed at once by
+ * `clear`, as worker threads of OpenMP usually outlive a detection.
+ *
+ * EICs from a pool are plain heap objects, so those that are never released
+ * can still be deleted as usual.
+ */
+class EICPool
+{
+    public:
+    /**
+     * @brief Counters of all pools since the start of the process or the
+     * last call to `resetStats`.
+     */
+    struct Stats {
+        size_t acquired;          /**< EICs handed out */
+        size_t reused;            /**< EICs handed out from a pool */
+        size_t released;          /**< EICs given back */
+        size_t discarded;         /**< released EICs deleted, pool full */
+        size_t bufferAllocations; /**< spline and baseline allocations */
+    };
+
+    /**
+     * @brief An empty EIC, from the pool of this thread if possible.
+     */
+    static EIC* acquire();
+
+    /**
+     * @brief Give an EIC back to the pool of this thread.
+     */
+    static void release(EIC* eic);
+
+    /**
+     * @brief Give all EICs of a vector back and clear it.
+     */
+    static void release(vector<EIC*>& eics);
+
+    /**
+     * @brief Free the EICs pooled by all threads.
+     * @details Threads can keep using their pools meanwhile, EICs they
+     * release afterwards are pooled again.
+     */
+    static void clear();
+
+    /**
+     * @brief Number of EICs currently pooled by all threads.
+     */
+    static size_t pooled();
+
+    /**
+     * @brief Set the number of EICs kept by every pool.
+     */
+    static void setMaxPooled(size_t maxPooled) { _maxPooled = maxPooled; }
+
+    static size_t maxPooled() { return _maxPooled; }
+
+    static Stats stats();
+
+    static void resetStats();
+
+    private:
+    static atomic<size_t> _maxPooled;
+    static atomic<size_t> _acquired;
+    static atomic<size_t> _reused;
+    static atomic<size_t> _released;
+    static atomic<size_t> _discarded;
+    static atomic<size_t> _bufferAllocationsAtReset;
+};
+
+#endif // EICPOOL_H
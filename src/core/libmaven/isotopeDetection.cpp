@@ -1,3 +1,5 @@
+#include <omp.h>
+
 #include "Compound.h"
 #include "classifierNeuralNet.h"
 #include "constants.h"
@@ -63,6 +65,23 @@ map<string, PeakGroup> IsotopeDetection::getIsotopes(PeakGroup* parentgroup, vec
     //iterate over samples to find properties for parent's isotopes.
     map<string, PeakGroup> isotopes;
 
+    // samples are searched in parallel, each keeping the nearest peak it
+    // found for every isotope, and merged in sample order below so that the
+    // groups are the same as when searched one after another. Within a
+    // parallel search of parent groups this loop runs serially.
+    vector<vector<pair<unsigned int, Peak>>> samplePeaks(
+        _mavenParameters->samples.size());
+
+    // the parent trace correlated with every isotope is the same for all
+    // isotopes of a sample, it is pulled once per sample on first use
+    float parentMass = 0;
+    if (parentgroup->getCompound()) {
+        Compound* compound = parentgroup->getCompound();
+        parentMass = MassCalculator::adjustMass(compound->parsedFormula()->neutralMass,
+                                                _mavenParameters->getCharge(compound));
+    }
+    vector<EIC*> parentEics(_mavenParameters->samples.size(), nullptr);
+#pragma omp parallel for schedule(dynamic, 1) if (!omp_in_parallel())
     for (unsigned int s = 0; s < _mavenParameters->samples.size(); s++) {
         mzSample* sample = _mavenParameters->samples[s];
         for (unsigned int k = 0; k < masslist.size(); k++) {
@@ -100,12 +119,34 @@ map<string, PeakGroup> IsotopeDetection::getIsotopes(PeakGroup* parentgroup, vec
 
             if (isotopePeakIntensity == 0 || rt == 0) continue;
 
-            if (filterIsotope(x, isotopePeakIntensity, parentPeakIntensity, sample, parentgroup))
+            if (filterIsotope(x,
+                              isotopePeakIntensity,
+                              parentPeakIntensity,
+                              sample,
+                              parentgroup,
+                              parentMass,
+                              parentEics[s]))
                 continue;
 
             vector<Peak> allPeaks;
 
-            EIC * eic = sample->getEIC(mzmin, mzmax, sample->minRt,sample->maxRt, 1, _mavenParameters->eicType,
+            float maxRtDiff=_mavenParameters->maxIsotopeScanDiff * _mavenParameters->avgScanTime;
+            //why are we even doing this calculation, why not have the parameter be in units of RT?
+
+            // peaks farther than maxRtDiff from the isotope are never picked,
+            // so the EIC only needs to cover the parent's peak and that
+            // distance, plus a margin for the baseline and for peaks running
+            // over the edges of the window
+            float eicRtMin = sample->minRt;
+            float eicRtMax = sample->maxRt;
+            if (_mavenParameters->windowedIsotopeEicFlag) {
+                float margin = _mavenParameters->isotopeEicMarginScans
+                               * _mavenParameters->avgScanTime;
+                eicRtMin = max(eicRtMin, min(rtmin, rt - maxRtDiff) - margin);
+                eicRtMax = min(eicRtMax, max(rtmax, rt + maxRtDiff) + margin);
+            }
+
+            EIC * eic = sample->getEIC(mzmin, mzmax, eicRtMin, eicRtMax, 1, _mavenParameters->eicType,
                                         _mavenParameters->filterline);
             //actually last parameter should probably be deepest MS level?
             //TODO: decide how isotope children should even work in MS mode
@@ -118,8 +159,6 @@ map<string, PeakGroup> IsotopeDetection::getIsotopes(PeakGroup* parentgroup, vec
             eic->setBaselineDropTopX(_mavenParameters->baseline_dropTopX);
             eic->setFilterSignalBaselineDiff(_mavenParameters->isotopicMinSignalBaselineDifference);
             eic->getPeakPositions(_mavenParameters->eic_smoothingWindow);
-            //TODO: this needs be optimized to not bother finding peaks outside of
-            //maxIsotopeScanDiff window
             allPeaks = eic->peaks;
 
             //Set peak quality
@@ -133,10 +172,8 @@ map<string, PeakGroup> IsotopeDetection::getIsotopes(PeakGroup* parentgroup, vec
 			PeakFiltering peakFiltering(_mavenParameters, isIsotope);
             peakFiltering.filter(allPeaks);                               
 
-            delete(eic);
+            delete eic;
             // find nearest peak as long as it is within RT window
-            float maxRtDiff=_mavenParameters->maxIsotopeScanDiff * _mavenParameters->avgScanTime;
-            //why are we even doing this calculation, why not have the parameter be in units of RT?
             Peak* nearestPeak = NULL;
             float d = FLT_MAX;
             for (unsigned int i = 0; i < allPeaks.size(); i++) {
@@ -151,34 +188,82 @@ map<string, PeakGroup> IsotopeDetection::getIsotopes(PeakGroup* parentgroup, vec
             }
 
             //delete (nearestPeak);
-            if (nearestPeak) { //if nearest peak is present
-                if (isotopes.count(isotopeName) == 0) { //label the peak of isotope
-                    PeakGroup g;
-                    g.meanMz = isotopeMass; //This get's updated in groupStatistics function
-                    g.expectedMz = isotopeMass;
-                    g.tagString = isotopeName;
-                    g.expectedAbundance = expectedAbundance;
-                    g.isotopeC13count = x.C13;
-                    g.setSelectedSamples(parentgroup->samples);
-
-                    // create a slice for this group; RT will be updated later
-                    mzSlice childSlice(mzmin,
-                                       mzmax,
-                                       0.0f,
-                                       numeric_limits<float>::max());
-                    g.setSlice(childSlice);
-                    isotopes[isotopeName] = g;
-                }
-                isotopes[isotopeName].addPeak(*nearestPeak); //add nearestPeak to isotope peak list
-            }
+            if (nearestPeak) //if nearest peak is present
+                samplePeaks[s].push_back(make_pair(k, *nearestPeak));
             vector<Peak>().swap(allPeaks);
         }
     }
+
+    for (auto eic : parentEics)
+        delete eic;
+
+    for (unsigned int s = 0; s < samplePeaks.size(); s++) {
+        for (auto& isotopePeak : samplePeaks[s]) {
+            Isotope& x = masslist[isotopePeak.first];
+            string isotopeName = x.name;
+            double isotopeMass = x.mass;
+            double expectedAbundance = x.abundance;
+
+            float mzmin = isotopeMass -_mavenParameters->compoundMassCutoffWindow->massCutoffValue(isotopeMass);
+            float mzmax = isotopeMass +_mavenParameters->compoundMassCutoffWindow->massCutoffValue(isotopeMass);
+
+            if (isotopes.count(isotopeName) == 0) { //label the peak of isotope
+                PeakGroup g;
+                g.meanMz = isotopeMass; //This get's updated in groupStatistics function
+                g.expectedMz = isotopeMass;
+                g.tagString = isotopeName;
+                g.expectedAbundance = expectedAbundance;
+                g.isotopeC13count = x.C13;
+                g.setQuantitationType(parentgroup->quantitationType);
+                g.setSelectedSamples(parentgroup->samples);
+
+                // create a slice for this group; RT will be updated later
+                mzSlice childSlice(mzmin,
+                                   mzmax,
+                                   0.0f,
+                                   numeric_limits<float>::max());
+                g.setSlice(childSlice);
+                isotopes[isotopeName] = g;
+            }
+            isotopes[isotopeName].addPeak(isotopePeak.second); //add nearestPeak to isotope peak list
+        }
+    }
     return isotopes;
 }
 
 bool IsotopeDetection::filterIsotope(Isotope x, float isotopePeakIntensity, float parentPeakIntensity, mzSample* sample, PeakGroup* parentGroup)
-{    
+{
+    // without a compound there is no parent mass to correlate against
+    if (parentGroup && parentGroup->getCompound() == nullptr)
+        parentGroup = nullptr;
+
+    float parentMass = 0;
+    if (parentGroup) {
+        Compound* compound = parentGroup->getCompound();
+        parentMass = MassCalculator::adjustMass(compound->parsedFormula()->neutralMass,
+                                                _mavenParameters->getCharge(compound));
+    }
+
+    EIC* parentEic = nullptr;
+    bool filtered = filterIsotope(x,
+                                  isotopePeakIntensity,
+                                  parentPeakIntensity,
+                                  sample,
+                                  parentGroup,
+                                  parentMass,
+                                  parentEic);
+    delete parentEic;
+    return filtered;
+}
+
+bool IsotopeDetection::filterIsotope(Isotope& x,
+                                     float isotopePeakIntensity,
+                                     float parentPeakIntensity,
+                                     mzSample* sample,
+                                     PeakGroup* parentGroup,
+                                     float parentMass,
+                                     EIC*& parentEic)
+{
     //natural abundance check
     //TODO: I think this loop will never run right? Since we're now only pulling the relevant isotopes
     //if x.C13>0 then _mavenParameters->C13Labeled_BPE must have been true
@@ -213,9 +298,6 @@ bool IsotopeDetection::filterIsotope(Isotope x, float isotopePeakIntensity, floa
     if (parentGroup)
     {
         float isotopeMass = x.mass;
-        Compound* compound = parentGroup->getCompound();
-        float parentMass = MassCalculator::computeMass(compound->formula(),
-                                                       _mavenParameters->getCharge(compound));
 
         Peak* parentPeak = parentGroup->getPeak(sample);
         float rtmin = parentGroup->minRt;
@@ -227,11 +309,31 @@ bool IsotopeDetection::filterIsotope(Isotope x, float isotopePeakIntensity, floa
         }
         float w = _mavenParameters->maxIsotopeScanDiff
             * _mavenParameters->avgScanTime;
-        double c = sample->correlation(
-                isotopeMass, parentMass,
-                _mavenParameters->compoundMassCutoffWindow, rtmin - w,
-                rtmax + w, _mavenParameters->eicType,
-            _mavenParameters->filterline);  // find correlation for isotopes
+
+        // both traces cover the same scans, so their intensities are
+        // correlated point by point
+        MassCutoff* massCutoff = _mavenParameters->compoundMassCutoffWindow;
+        if (parentEic == nullptr) {
+            float parentCutoff = massCutoff->massCutoffValue(parentMass);
+            parentEic = sample->getEIC(parentMass - parentCutoff,
+                                       parentMass + parentCutoff,
+                                       rtmin - w,
+                                       rtmax + w,
+                                       1,
+                                       _mavenParameters->eicType,
+                                       _mavenParameters->filterline);
+        }
+        float isotopeCutoff = massCutoff->massCutoffValue(isotopeMass);
+        EIC* isotopeEic = sample->getEIC(isotopeMass - isotopeCutoff,
+                                         isotopeMass + isotopeCutoff,
+                                         rtmin - w,
+                                         rtmax + w,
+                                         1,
+                                         _mavenParameters->eicType,
+                                         _mavenParameters->filterline);
+        double c = mzUtils::correlation(isotopeEic->intensity,
+                                        parentEic->intensity);  // find correlation for isotopes
+        delete isotopeEic;
         if (c < _mavenParameters->minIsotopicCorrelation)
             return true;
     }
@@ -3,6 +3,7 @@
 
 #include "standardincludes.h"
 
+class EIC;
 class Isotope;
 class MavenParameters;
 class mzSample;
@@ -36,7 +37,7 @@ class IsotopeDetection
 	
 	/**
 	 * @brief checks for natural abundance error and parent-isotope correlation
-	 * @details if parent group is not available, correlation check if skipped
+	 * @details if parent group is not available, or has no compound, correlation check if skipped
 	 * @return bool. true if isotope has to be skipped. false if it passes the checks
 	 **/
 	bool filterIsotope(Isotope x, float isotopePeakIntensity, float parentPeakIntensity, mzSample* sample, PeakGroup* parentGroup = NULL);
@@ -55,6 +56,21 @@ class IsotopeDetection
 	void addChild(PeakGroup *parentgroup, PeakGroup &child, string isotopeName);
 	bool checkChildExist(vector<PeakGroup> &children, string isotopeName);
 
+	/**
+	 * @brief filterIsotope for isotopes of a parent group whose mass is
+	 * already known
+	 * @param parentEic EIC of the parent in this sample over the
+	 * correlation window. Pulled on first use if null and left for the
+	 * caller to release, so that every isotope of the sample reuses it
+	 **/
+	bool filterIsotope(Isotope& x,
+					   float isotopePeakIntensity,
+					   float parentPeakIntensity,
+					   mzSample* sample,
+					   PeakGroup* parentGroup,
+					   float parentMass,
+					   EIC*& parentEic);
+
 };
 
 #endif // ISOTOPEDETECTION_H
@@ -260,46 +260,57 @@ void JSONReports::_writeEIC(PeakGroup& grp, ofstream& filename, mzSample* sample
 
 void JSONReports::save(string filename, vector<PeakGroup> allgroups, vector<mzSample*> samples)
 {
-    ofstream file(filename.c_str());
-    file << setprecision(10);
-
-    file << "{\"groups\": [" <<endl;
-
-    int groupId = 0;
-    int metaGroupId = 0;
-   
-    for(size_t i=0; i < allgroups.size() ; i++ ) {
-        PeakGroup& grp = allgroups[i];
+    openFile(filename, samples);
+    for(size_t i=0; i < allgroups.size() ; i++ )
+        addGroup(allgroups[i]);
+    closeFile();
+}
 
-        //if compound is unknown, output only the unlabeled form information
-        if(grp.getCompound() == NULL || grp.childCount() == 0) {
-            grp.groupId = ++groupId;
-            grp.metaGroupId = ++metaGroupId;
-            if(groupId > 1) file<< "\n,";
+void JSONReports::openFile(string filename, vector<mzSample*> samples)
+{
+    _file.open(filename.c_str());
+    _file << setprecision(10);
+    _file << "{\"groups\": [" <<endl;
 
-            _writeGroup(grp,file);
-            if(grp.hasCompoundLink())
-                _writeCompoundLink(grp, file);
-            _writePeak(grp, file, samples);
+    _samples = samples;
+    _groupId = 0;
+    _metaGroupId = 0;
+}
 
-        } else {
-            //output all relevant isotope info otherwise
-            //does this work? is children[0] always the same as grp (parent)?
-            grp.metaGroupId = ++ metaGroupId;
-            for (unsigned int k = 0; k < grp.children.size(); k++) {
-                grp.children[k].metaGroupId = grp.metaGroupId;
-                grp.children[k].groupId = ++groupId;
-                if(groupId > 1) file << "\n,";
-            
-                _writeGroup(grp.children[k], file);
-                if( grp.children[k].hasCompoundLink() )
-                    _writeCompoundLink(grp, file);
-                _writePeak(grp.children[k], file, samples);
-            }
+void JSONReports::addGroup(PeakGroup& grp)
+{
+    //if compound is unknown, output only the unlabeled form information
+    if(grp.getCompound() == NULL || grp.childCount() == 0) {
+        grp.groupId = ++_groupId;
+        grp.metaGroupId = ++_metaGroupId;
+        if(_groupId > 1) _file<< "\n,";
+
+        _writeGroup(grp,_file);
+        if(grp.hasCompoundLink())
+            _writeCompoundLink(grp, _file);
+        _writePeak(grp, _file, _samples);
+
+    } else {
+        //output all relevant isotope info otherwise
+        //does this work? is children[0] always the same as grp (parent)?
+        grp.metaGroupId = ++ _metaGroupId;
+        for (unsigned int k = 0; k < grp.children.size(); k++) {
+            grp.children[k].metaGroupId = grp.metaGroupId;
+            grp.children[k].groupId = ++_groupId;
+            if(_groupId > 1) _file << "\n,";
+
+            _writeGroup(grp.children[k], _file);
+            if( grp.children[k].hasCompoundLink() )
+                _writeCompoundLink(grp, _file);
+            _writePeak(grp.children[k], _file, _samples);
         }
     }
-    file << "]}"; //groups
-    file.close();
+}
+
+void JSONReports::closeFile()
+{
+    _file << "]}"; //groups
+    _file.close();
 }
 
 string JSONReports::_sanitizeJSONstring(string s)
@@ -26,6 +26,25 @@ public:
      */
     void save(string filename, vector<PeakGroup> allgroups, vector<mzSample*> vsampleNames);
 
+    /**
+     * @brief openFile Starts a json file to which groups are written one at
+     * a time, e.g. as they are detected.
+     * @param filename Output filename.
+     * @param vsampleNames vector of samples uploaded.
+     */
+    void openFile(string filename, vector<mzSample*> vsampleNames);
+
+    /**
+     * @brief addGroup Appends a group (or its isotopes) to the open file.
+     * @param grp Group to be written. Its group IDs are assigned here.
+     */
+    void addGroup(PeakGroup& grp);
+
+    /**
+     * @brief closeFile Finishes the file started by openFile.
+     */
+    void closeFile();
+
 private:  
     /**
      * @brief _writeGroup write specific group information to the file.
@@ -60,6 +79,11 @@ private:
     float _outputRtWindow = 2.0;
     bool _uploadToPolly;
     MavenParameters* _mavenParameters;
+
+    ofstream _file;
+    vector<mzSample*> _samples;
+    int _groupId;
+    int _metaGroupId;
 };
 
 #endif
@@ -81,6 +81,7 @@ SOURCES = 	base64.cpp \
             Fragment.cpp \
 	        EIC.cpp \
 	        Scan.cpp \
+	        deconvolver.cpp \
                 SRMList.cpp \
 	        Peak.cpp  \
 	        Compound.cpp \
@@ -107,6 +108,11 @@ SOURCES = 	base64.cpp \
                 groupClassifier.cpp \
                 groupFeatures.cpp \
                 svmPredictor.cpp \
+                samplecache.cpp \
+                mzrtindex.cpp \
+                eicpool.cpp \
+                progressreporter.cpp \
+                xmlstream.cpp \
                 zlib.cpp
                
 
@@ -138,6 +144,7 @@ HEADERS += 	constants.h \
                 eiclogic.h \
                 EIC.h \
 	            Scan.h \
+	            deconvolver.h \
                 SRMList.h \
                 databases.h \
                 Peptide.hpp \
@@ -152,4 +159,9 @@ HEADERS += 	constants.h \
                 settings.h \
                 groupClassifier.h \
                 groupFeatures.h \
-                svmPredictor.h
+                svmPredictor.h \
+                samplecache.h \
+                mzrtindex.h \
+                eicpool.h \
+                progressreporter.h \
+                xmlstream.h
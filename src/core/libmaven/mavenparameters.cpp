@@ -95,6 +95,8 @@ MavenParameters::MavenParameters(string settingsPath):lastUsedSettingsPath(setti
         filterline = "";
 
         maxIsotopeScanDiff = 10;
+        windowedIsotopeEicFlag = false;
+        isotopeEicMarginScans = 50;
         maxNaturalAbundanceErr = 100;
         minIsotopicCorrelation = 0;
         isotopeC13Correction = 0;
@@ -200,6 +202,12 @@ void  MavenParameters::setIsotopeDialogSettings(const char* key, const char* val
     if(strcmp(key, "maxIsotopeScanDiff") == 0)
         maxIsotopeScanDiff = atof(value);
 
+    if(strcmp(key, "windowedIsotopeEic") == 0)
+        windowedIsotopeEicFlag = atof(value);
+
+    if(strcmp(key, "isotopeEicMarginScans") == 0)
+        isotopeEicMarginScans = atof(value);
+
     if(strcmp(key, "maxNaturalAbundanceError") == 0)
         maxNaturalAbundanceErr = atof(value);
 }
@@ -215,6 +215,14 @@ class MavenParameters
         string ligandDbFilename;
 
         double maxIsotopeScanDiff;
+        /**
+        * pull isotope EICs around the RT window of their parent only
+        */
+        bool windowedIsotopeEicFlag;
+        /**
+        * scans added on either side of that window, to keep baselines stable
+        */
+        int isotopeEicMarginScans;
         double maxNaturalAbundanceErr;
         double minIsotopicCorrelation;
         bool isotopeC13Correction;
@@ -11,6 +11,7 @@
 #include "mavenparameters.h"
 #include "Peak.h"
 #include "Scan.h"
+#include "progressreporter.h"
 
 mzSample* Aligner::refSample = nullptr;
 
@@ -345,6 +346,9 @@ bool Aligner::alignSampleRts(mzSample* sample,
     vector<float> rtPoints;
     vector<vector<float> > mxn;
 
+    // the binning below reads the arrays of every scan directly
+    sample->loadAllScanData();
+
     int intervalCounter = 0;
     for(auto scan: sample->scans) {
         if (mp->stop) return (true);
@@ -431,6 +435,7 @@ bool Aligner::alignWithObiWarp(vector<mzSample*> samples,
     float minMzRange = 1e9;
     float maxMzRange = 0;
 
+    refSample->loadAllScanData();
     for(const auto scan: refSample->scans) {
         // PRM/DDA data have both mslevel 1 and mslevel 2 scans. We only want to align mslevel 1 scans
         if(scan->mslevel == 1) {
@@ -461,8 +466,13 @@ bool Aligner::alignWithObiWarp(vector<mzSample*> samples,
 
     _alignmentSegments.clear();
     setSamples(samples);
-    int samplesAligned = 0;
-    #pragma omp parallel for shared(samplesAligned)
+    ProgressReporter progress(
+        [this](const string& progressText, unsigned int completed, int total) {
+            setAlignmentProgress(progressText, completed, total);
+        },
+        "Aligning samples",
+        samples.size() - 1);
+    #pragma omp parallel for
     for (int i = 0; i < samples.size(); ++i) {
         if (samples[i] == refSample)
             continue;
@@ -474,14 +484,14 @@ bool Aligner::alignWithObiWarp(vector<mzSample*> samples,
         if (alignSampleRts(samples[i], mzPoints, *obiWarp, false, mp)) {
             stopped = true;
         } else {
-            samplesAligned++;
-            setAlignmentProgress("Aligning samples", samplesAligned, samples.size()-1);
+            progress.advance();
         }
     }
+    progress.stop();
     setAlignmentProgress("Performing post-alignment interpolation…", 1, 1);
     performSegmentedAlignment();
 
-    cerr << "Samples modified: " << samplesAligned << endl;
+    cerr << "Samples modified: " << progress.completed() << endl;
     delete obiWarp;
     return(stopped);
 }
@@ -7,6 +7,11 @@
 #include "mzSample.h"
 #include "mzUtils.h"
 
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
 using namespace mzUtils;
 using namespace std;
 
@@ -26,55 +31,90 @@ double MassCalculator::getElementMass(string elmnt) {
 
 
 
-map<string, int> MassCalculator::getComposition(string formula) {
+namespace {
+    map<string, int> parseComposition(const string& formula) {
+
+        /* define some variable */
+        int SIZE = formula.length();
+        map<string, int> atoms;
 
-    /* define some variable */
-    int SIZE = formula.length();
-    map<string, int> atoms;
+        /* parse the formula */
+        for (int i = 0; i < SIZE; i++) {
+            string bloc, coeff_txt;
+            int coeff;
 
-    /* parse the formula */
-    for (int i = 0; i < SIZE; i++) {
-        string bloc, coeff_txt;
-        int coeff;
+            /* start of symbol must be uppercase letter */
+            if (CHE_FORMULA_ALPHA_UPP.find(formula[i]) != string::npos) {
+                bloc = formula[i];
+                if (CHE_FORMULA_ALPHA_LOW.find(formula[i + 1]) != string::npos) {
+                    bloc += formula[i + 1];
+                    i++;
+                }
+            }
 
-        /* start of symbol must be uppercase letter */
-        if (CHE_FORMULA_ALPHA_UPP.find(formula[i]) != string::npos) {
-            bloc = formula[i];
-            if (CHE_FORMULA_ALPHA_LOW.find(formula[i + 1]) != string::npos) {
-                bloc += formula[i + 1];
+            while (CHE_FORMULA_COFF.find(formula[i + 1]) != string::npos) {
+                coeff_txt += formula[i + 1];
                 i++;
             }
-        }
 
-        while (CHE_FORMULA_COFF.find(formula[i + 1]) != string::npos) {
-            coeff_txt += formula[i + 1];
-            i++;
-        }
+            if (coeff_txt.length() > 0) {
+                coeff = string2integer(coeff_txt);
+            } else {
+                coeff = 1;
+            }
 
-        if (coeff_txt.length() > 0) {
-            coeff = string2integer(coeff_txt);
-        } else {
-            coeff = 1;
+            /* compute normally if there was no open bracket */
+            // cout << bloc <<  " " << coeff << endl;
+            atoms[bloc] += coeff;
         }
 
-        /* compute normally if there was no open bracket */
-        // cout << bloc <<  " " << coeff << endl;
-        atoms[bloc] += coeff;
+        return (atoms);
+        /* send back value to main.cpp */
     }
 
-    return (atoms);
-    /* send back value to main.cpp */
+    // interned formulas; elements of an unordered_map keep their address
+    // when it grows, so the parses can be handed out by pointer
+    mutex formulaCacheMutex;
+    unordered_map<string, ParsedFormula> formulaCache;
 }
 
-double MassCalculator::computeNeutralMass(string formula) {
-    map<string, int> atoms = getComposition(formula);
-    map<string, int>::iterator itr;
+int ParsedFormula::count(const string& element) const
+{
+    for (const auto& atoms : elements) {
+        if (atoms.first == element)
+            return atoms.second;
+    }
+    return 0;
+}
 
-    double mass = 0;
-    for (itr = atoms.begin(); itr != atoms.end(); itr++) {
-        mass += getElementMass((*itr).first) * (*itr).second;
+const ParsedFormula* MassCalculator::parseFormula(const string& formula)
+{
+    {
+        lock_guard<mutex> lock(formulaCacheMutex);
+        auto cached = formulaCache.find(formula);
+        if (cached != formulaCache.end())
+            return &cached->second;
     }
-    return mass;
+
+    ParsedFormula parsed;
+    map<string, int> atoms = parseComposition(formula);
+    parsed.elements.assign(atoms.begin(), atoms.end());
+    parsed.neutralMass = 0;
+    for (const auto& element : parsed.elements)
+        parsed.neutralMass += getElementMass(element.first) * element.second;
+
+    // a formula parsed concurrently by another thread keeps its first parse
+    lock_guard<mutex> lock(formulaCacheMutex);
+    return &formulaCache.insert(make_pair(formula, parsed)).first->second;
+}
+
+map<string, int> MassCalculator::getComposition(string formula) {
+    const ParsedFormula* parsed = parseFormula(formula);
+    return map<string, int>(parsed->elements.begin(), parsed->elements.end());
+}
+
+double MassCalculator::computeNeutralMass(string formula) {
+    return parseFormula(formula)->neutralMass;
 }
 
 double MassCalculator::adjustMass(double mass, int charge) {
@@ -92,8 +132,17 @@ double MassCalculator::adjustMass(double mass, int charge) {
 }
 
 double MassCalculator::computeMass(string formula, int charge) {
-    double mass = computeNeutralMass(formula);
-    return adjustMass(mass, charge);
+    return adjustMass(parseFormula(formula)->neutralMass, charge);
+}
+
+namespace {
+    // formula, charge, ionization type and label flags
+    typedef tuple<string, int, int, int> IsotopeKey;
+
+    mutex isotopeCacheMutex;
+    map<IsotopeKey, vector<Isotope>> isotopeCache;
+    atomic<size_t> isotopeCacheHits(0);
+    atomic<size_t> isotopeCacheMisses(0);
 }
 
 vector<Isotope> MassCalculator::computeIsotopes(
@@ -105,14 +154,68 @@ vector<Isotope> MassCalculator::computeIsotopes(
     bool D2Flag
 )
 {
-    map<string, int> atoms = getComposition(formula);
-    int CatomCount = atoms[C_STRING_ID];
-    int NatomCount = atoms[N_STRING_ID];
-    int SatomCount = atoms[S_STRING_ID];
-    int HatomCount = atoms[H_STRING_ID];
+    int labels = C13Flag | N15Flag << 1 | S34Flag << 2 | D2Flag << 3;
+    IsotopeKey key(formula, charge, ionizationType, labels);
+    {
+        lock_guard<mutex> lock(isotopeCacheMutex);
+        auto cached = isotopeCache.find(key);
+        if (cached != isotopeCache.end()) {
+            isotopeCacheHits++;
+            return cached->second;
+        }
+    }
+
+    // enumerated without the lock, a list computed concurrently by another
+    // thread is identical and simply kept
+    vector<Isotope> isotopes = enumerateIsotopes(formula,
+                                                 charge,
+                                                 C13Flag,
+                                                 N15Flag,
+                                                 S34Flag,
+                                                 D2Flag);
+    isotopeCacheMisses++;
+
+    lock_guard<mutex> lock(isotopeCacheMutex);
+    isotopeCache.insert(make_pair(key, isotopes));
+    return isotopes;
+}
+
+MassCalculator::IsotopeCacheStats MassCalculator::isotopeCacheStats()
+{
+    IsotopeCacheStats stats;
+    stats.hits = isotopeCacheHits;
+    stats.misses = isotopeCacheMisses;
+
+    lock_guard<mutex> lock(isotopeCacheMutex);
+    stats.entries = isotopeCache.size();
+    return stats;
+}
+
+void MassCalculator::clearIsotopeCache()
+{
+    lock_guard<mutex> lock(isotopeCacheMutex);
+    isotopeCache.clear();
+    isotopeCacheHits = 0;
+    isotopeCacheMisses = 0;
+}
+
+vector<Isotope> MassCalculator::enumerateIsotopes(
+    string formula,
+    int charge,
+    bool C13Flag,
+    bool N15Flag,
+    bool S34Flag,
+    bool D2Flag
+)
+{
+    const ParsedFormula* atoms = parseFormula(formula);
+    int CatomCount = atoms->count(C_STRING_ID);
+    int NatomCount = atoms->count(N_STRING_ID);
+    int SatomCount = atoms->count(S_STRING_ID);
+    int HatomCount = atoms->count(H_STRING_ID);
 
     vector<Isotope> isotopes;
-    double parentMass = computeNeutralMass(formula);
+    double parentMass = atoms->neutralMass;
 
     Isotope parent(C12_PARENT_LABEL, parentMass);
     isotopes.push_back(parent);
@@ -20,6 +20,32 @@ using namespace std;
 // FAB   M+X M+N
 // ACPI  M+H  M+X
 
+/**
+ * @class ParsedFormula
+ * @ingroup libmaven
+ * @brief Element counts and monoisotopic mass of a chemical formula.
+ * @details Obtained from `MassCalculator::parseFormula`, which parses every
+ * distinct formula once and hands out the same instance for it afterwards.
+ * Instances are never freed, so holders can keep the pointer.
+ */
+class ParsedFormula {
+    public:
+        /**
+         * @brief Element symbols with their counts, ordered by symbol.
+         */
+        vector<pair<string, int>> elements;
+
+        /**
+         * @brief Monoisotopic mass of the neutral molecule.
+         */
+        double neutralMass;
+
+        /**
+         * @brief Number of atoms of an element, 0 if absent.
+         */
+        int count(const string& element) const;
+};
+
 /**
  * @class MassCalculator
  * @ingroup libmaven
@@ -76,6 +102,17 @@ class MassCalculator {
          */
         static map<string,int> getComposition(string formula);
 
+        /**
+         * [parseFormula interned parse of a formula]
+         * @method parseFormula
+         * @details Formulas are parsed on their first use only, later calls
+         * with the same formula return the same instance. Safe to call from
+         * any thread.
+         * @param  formula        string formula
+         * @return                element counts and neutral mass
+         */
+        static const ParsedFormula* parseFormula(const string& formula);
+
 
         /**
          * [prettyName ]
@@ -101,6 +138,24 @@ class MassCalculator {
         void enumerateMasses(double inputMass, double charge, MassCutoff *massCutoff, vector<Match*>& matches);
 
 
+        /**
+         * @brief Counters of the isotope cache since the start of the
+         * process or the last call to `clearIsotopeCache`.
+         */
+        struct IsotopeCacheStats {
+            size_t hits;    /**< isotope lists served from the cache */
+            size_t misses;  /**< isotope lists computed */
+            size_t entries; /**< isotope lists held by the cache */
+        };
+
+        /**
+         * [computeIsotopes isotopes of a formula for the given labels]
+         * @method computeIsotopes
+         * @details Isotope lists are memoized by formula, charge, ionization
+         * type and labels, so that formulas recurring across groups and
+         * exports are only enumerated once. Safe to call from any thread.
+         * @return                [parent followed by its labelled isotopes]
+         */
         static vector<Isotope> computeIsotopes(
             string formula,
             int charge,
@@ -110,6 +165,13 @@ class MassCalculator {
             bool D2Flag 
         );
 
+        static IsotopeCacheStats isotopeCacheStats();
+
+        /**
+         * @brief Drop all memoized isotope lists and reset the counters.
+         */
+        static void clearIsotopeCache();
+
         /**
          * [adjustMass ]
          * @method adjustMass
@@ -142,6 +204,18 @@ class MassCalculator {
         static double getElementMass(string elmnt);
         static void generateElementMassMap(string filename);
 
+        /**
+         * [enumerateIsotopes uncached computeIsotopes]
+         */
+        static vector<Isotope> enumerateIsotopes(
+            string formula,
+            int charge,
+            bool C13Flag,
+            bool N15Flag,
+            bool S34Flag,
+            bool D2Flag
+        );
+
 };
 
 #endif
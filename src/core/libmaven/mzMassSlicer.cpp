@@ -1,4 +1,5 @@
 #include "EIC.h"
+#include "eicpool.h"
 #include "mavenparameters.h"
 #include "mzMassSlicer.h"
 #include "mzSample.h"
@@ -29,6 +30,15 @@ void MassSlices::sendSignal(const string& progressText,
     mavenParameters->sig(progressText, completed_samples, total_samples);
 }
 
+ProgressReporter::Callback MassSlices::_progressCallback()
+{
+    return [this](const string& progressText,
+                  unsigned int completed,
+                  int total) {
+        sendSignal(progressText, completed, total);
+    };
+}
+
 /**
  * MassSlices::algorithmA This is function is called when mass Slicing using 
  * AlgorithmB returns no slices. The slices here are created using the filterLine
@@ -82,7 +92,6 @@ void MassSlices::algorithmB(MassCutoff* massCutoff, int rtStep )
     this->massCutoff = massCutoff;
 
     int totalScans = 0;
-    int currentScans = 0;
 
     // Calculate the total number of scans
     for (auto s : samples)
@@ -103,101 +112,92 @@ void MassSlices::algorithmB(MassCutoff* massCutoff, int rtStep )
 
     sendSignal("Status", 0 , 1);
 
-    // #pragma omp parallel for ordered
-    // Looping over every sample
-    for (unsigned int i = 0; i < samples.size(); i++) {
-        if (slices.size() > _maxSlices) break;
-
+    // every sample is sliced into its own sorted set of points, in parallel
+    vector<vector<SliceBounds>> sampleBounds(samples.size());
+    atomic<int> completedSamples(0);
+    ProgressReporter progress(mavenParameters->showProgressFlag
+                                  ? _progressCallback()
+                                  : nullptr,
+                              "",
+                              totalScans);
+    progress.setText([&]() {
+        return "Processed "
+               + to_string(completedSamples.load())
+               + " out of "
+               + to_string(samples.size())
+               + " sample(s)…";
+    });
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < static_cast<int>(samples.size()); i++) {
         // Check if Peak detection has been cancelled by the user
-        if (mavenParameters->stop) {
-            stopSlicing();
-            break;
-        }
-
-        // updating progress on samples
-        if (mavenParameters->showProgressFlag ) {
-            string progressText = "Processing "
-                                  + to_string(i + 1)
-                                  + " out of "
-                                  + to_string(mavenParameters->samples.size())
-                                  + " sample(s)…";
-            sendSignal(progressText, currentScans, totalScans);
-        }
-
-        // #pragma omp cancel for
-        // for loop for iterating over every scan of a sample
-        for (auto scan : samples[i]->scans) {
-            // Check if Peak detection has been cancelled by the user
-            if (mavenParameters->stop) {
-                stopSlicing();
-                break;
-            }
-
-            currentScans++;
-
-            if (scan->mslevel != 1)
-                continue;
-
-            // Checking if RT is in the given min to max RT range
-            if (_maxRt && !isBetweenInclusive(scan->rt, _minRt, _maxRt))
-                continue;
-
-            float rt = scan->rt;
+        if (mavenParameters->stop)
+            continue;
 
-            for (unsigned int k = 0; k < scan->nobs(); k++) {
-                float mz = scan->mz[k];
-                float intensity = scan->intensity[k];
+        _slicePoints(samples[i], rtWindow, sampleBounds[i]);
 
-                // Checking if mz, intensity are within specified ranges
-                if (_maxMz && !isBetweenInclusive(mz,
-                                                  _minMz,
-                                                  _maxMz)) {
-                    continue;
-                }
-                if (_maxIntensity && !isBetweenInclusive(intensity,
-                                                         _minIntensity,
-                                                         _maxIntensity)) {
-                    continue;
-                }
+        completedSamples++;
+        progress.advance(samples[i]->scans.size());
+    }
+    progress.stop();
 
-                // create new slice with the given bounds
-                float cutoff = massCutoff->massCutoffValue(mz);
-                mzSlice* s = new mzSlice(mz - cutoff,
-                                         mz + cutoff,
-                                         rt - rtWindow,
-                                         rt + rtWindow);
-                s->ionCount = intensity;
-                s->rt = scan->rt;
-                s->mz = mz;
-                slices.push_back(s);
-            }
+    if (mavenParameters->stop) {
+        sampleBounds.clear();
+        stopSlicing();
+    }
 
-            // progress update 
-            if (mavenParameters->showProgressFlag ) {
-                string progressText = "Processing "
-                                      + to_string(i + 1)
-                                      + " out of "
-                                      + to_string(mavenParameters->samples.size())
-                                      + " sample(s)…\n"
-                                      + to_string(slices.size())
-                                      + " slices created";
-                sendSignal(progressText,currentScans,totalScans);
-            }
+    // samples are taken in order until the slice limit is exceeded
+    size_t pointCount = 0;
+    size_t sampleCount = 0;
+    while (sampleCount < sampleBounds.size() && pointCount <= _maxSlices)
+        pointCount += sampleBounds[sampleCount++].size();
+    sampleBounds.resize(sampleCount);
+
+    // k-way merge of the sorted points of all samples, by m/z first and
+    // then by rt, ties going to the earlier sample
+    typedef pair<size_t, size_t> Cursor;
+    auto later = [&](const Cursor& a, const Cursor& b) {
+        const SliceBounds& first = sampleBounds[a.first][a.second];
+        const SliceBounds& second = sampleBounds[b.first][b.second];
+        if (_boundsBefore(second, first))
+            return true;
+        if (_boundsBefore(first, second))
+            return false;
+        return a.first > b.first;
+    };
+    vector<Cursor> heap;
+    for (size_t i = 0; i < sampleBounds.size(); i++) {
+        if (!sampleBounds[i].empty())
+            heap.push_back(make_pair(i, 0));
+    }
+    make_heap(heap.begin(), heap.end(), later);
+
+    vector<SliceBounds> bounds;
+    bounds.reserve(pointCount);
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), later);
+        Cursor& cursor = heap.back();
+        bounds.push_back(sampleBounds[cursor.first][cursor.second]);
+        if (++cursor.second < sampleBounds[cursor.first].size()) {
+            push_heap(heap.begin(), heap.end(), later);
+        } else {
+            vector<SliceBounds>().swap(sampleBounds[cursor.first]);
+            heap.pop_back();
         }
     }
 
-    cerr << "Found " << slices.size() << " slices" << endl;
+    cerr << "Found " << bounds.size() << " slices" << endl;
 
-    // before reduction sort by mz first then by rt
-    sort(begin(slices),
-         end(slices),
-         [](const mzSlice* slice, const mzSlice* compSlice) {
-             if (slice->mz == compSlice->mz) {
-                 return slice->rt < compSlice->rt;
-             }
-             return slice->mz < compSlice->mz;
-         });
-    _reduceSlices();
+    _reduceSlices(bounds);
+
+    slices.reserve(bounds.size());
+    for (const SliceBounds& b : bounds) {
+        mzSlice* s = new mzSlice(b.mzmin, b.mzmax, b.rtmin, b.rtmax);
+        s->ionCount = b.ionCount;
+        s->rt = b.rt;
+        s->mz = b.mz;
+        slices.push_back(s);
+    }
+    vector<SliceBounds>().swap(bounds);
 
     cerr << "Reduced to " << slices.size() << " slices" << endl;
 
@@ -212,6 +212,91 @@ void MassSlices::algorithmB(MassCutoff* massCutoff, int rtStep )
     sendSignal("Mass slicing done.", 1 , 1);
 }
 
+bool MassSlices::_boundsBefore(const SliceBounds& slice,
+                               const SliceBounds& compSlice)
+{
+    if (slice.mz == compSlice.mz)
+        return slice.rt < compSlice.rt;
+    return slice.mz < compSlice.mz;
+}
+
+void MassSlices::_slicePoints(mzSample* sample,
+                              float rtWindow,
+                              vector<SliceBounds>& bounds)
+{
+    // peaks are streamed from the contiguous columns of the sample when
+    // they have been built
+    const ScanColumns* columns = sample->scanColumns();
+    if (columns != nullptr
+        && columns->scanCount() != sample->scans.size())
+        columns = nullptr;
+
+    // for loop for iterating over every scan of a sample
+    for (unsigned int j = 0; j < sample->scans.size(); j++) {
+        // Check if Peak detection has been cancelled by the user
+        if (mavenParameters->stop)
+            break;
+
+        Scan* scan = sample->scans[j];
+        int mslevel = columns ? columns->mslevel[j] : scan->mslevel;
+        if (mslevel != 1)
+            continue;
+
+        float rt = columns ? columns->rt[j] : scan->rt;
+
+        // Checking if RT is in the given min to max RT range
+        if (_maxRt && !isBetweenInclusive(rt, _minRt, _maxRt))
+            continue;
+
+        const float* mzs;
+        const float* intensities;
+        size_t nobs;
+        if (columns) {
+            mzs = columns->mz(j);
+            intensities = columns->intensity(j);
+            nobs = columns->nobs(j);
+        } else {
+            scan->loadData();
+            mzs = scan->mz.data();
+            intensities = scan->intensity.data();
+            nobs = scan->nobs();
+        }
+
+        for (size_t k = 0; k < nobs; k++) {
+            float mz = mzs[k];
+            float intensity = intensities[k];
+
+            // Checking if mz, intensity are within specified ranges
+            if (_maxMz && !isBetweenInclusive(mz,
+                                              _minMz,
+                                              _maxMz)) {
+                continue;
+            }
+            if (_maxIntensity && !isBetweenInclusive(intensity,
+                                                     _minIntensity,
+                                                     _maxIntensity)) {
+                continue;
+            }
+
+            // create new slice with the given bounds
+            float cutoff = massCutoff->massCutoffValue(mz);
+            SliceBounds b;
+            b.mzmin = mz - cutoff;
+            b.mzmax = mz + cutoff;
+            b.rtmin = rt - rtWindow;
+            b.rtmax = rt + rtWindow;
+            b.mz = mz;
+            b.rt = rt;
+            b.ionCount = intensity;
+            bounds.push_back(b);
+        }
+
+    }
+
+    // before reduction sort by mz first then by rt
+    sort(begin(bounds), end(bounds), _boundsBefore);
+}
+
 void MassSlices::algorithmC(float ppm, float minIntensity, float rtWindow) {
     delete_all(slices);
     slices.clear();
@@ -294,78 +379,94 @@ mzSlice* MassSlices::sliceExists(float mzMinBound,
     return best;
 }
 
-void MassSlices::_reduceSlices()
+void MassSlices::_reduceSlices(vector<SliceBounds>& bounds)
 {
-    for (auto first = begin(slices); first != end(slices); ++first) {
+    // slices are never merged into slices that come before them, so the
+    // slices after the current one still have their original bounds and
+    // are sorted by their lower m/z bound as well. Merged slices are
+    // skipped through `nextLive`, a disjoint set of every slice and the
+    // next slice that has not been merged, compressed while it is walked.
+    size_t n = bounds.size();
+    vector<size_t> nextLive(n + 1);
+    for (size_t i = 0; i <= n; i++)
+        nextLive[i] = i;
+    auto findLive = [&](size_t i) {
+        while (nextLive[i] != i) {
+            nextLive[i] = nextLive[nextLive[i]];
+            i = nextLive[i];
+        }
+        return i;
+    };
+
+    ProgressReporter progress(_progressCallback(),
+                              "Reducing redundant slices…",
+                              n);
+    for (size_t first = findLive(0); first < n; first = findLive(first + 1)) {
         if (mavenParameters->stop) {
+            bounds.clear();
             stopSlicing();
-            break;
+            return;
         }
 
-        auto firstSlice = *first;
-        if (mzUtils::almostEqual(firstSlice->ionCount, -1.0f))
-            continue;
-
-        for (auto second = next(first); second != end(slices); ++second) {
-            auto secondSlice = *second;
+        SliceBounds& firstSlice = bounds[first];
+        for (size_t second = findLive(first + 1);
+             second < n;
+             second = findLive(second + 1)) {
+            SliceBounds& secondSlice = bounds[second];
 
             // stop iterating if the rest of the slices are too far
-            if (firstSlice->mzmax < secondSlice->mzmin)
+            if (firstSlice.mzmax < secondSlice.mzmin)
                 break;
 
-            if (mzUtils::almostEqual(secondSlice->ionCount, -1.0f))
-                continue;
-
             // check if center of one of the slices lies in the other
-            if ((firstSlice->mz > secondSlice->mzmin
-                 && firstSlice->mz < secondSlice->mzmax
-                 && firstSlice->rt > secondSlice->rtmin
-                 && firstSlice->rt < secondSlice->rtmax)
+            if ((firstSlice.mz > secondSlice.mzmin
+                 && firstSlice.mz < secondSlice.mzmax
+                 && firstSlice.rt > secondSlice.rtmin
+                 && firstSlice.rt < secondSlice.rtmax)
                 ||
-                (secondSlice->mz > firstSlice->mzmin
-                 && secondSlice->mz < firstSlice->mzmax
-                 && secondSlice->rt > firstSlice->rtmin
-                 && secondSlice->rt < firstSlice->rtmax)) {
-                firstSlice->ionCount = std::max(firstSlice->ionCount,
-                                                secondSlice->ionCount);
-                firstSlice->rtmax = std::max(firstSlice->rtmax,
-                                             secondSlice->rtmax);
-                firstSlice->rtmin = std::min(firstSlice->rtmin,
-                                             secondSlice->rtmin);
-                firstSlice->mzmax = std::max(firstSlice->mzmax,
-                                             secondSlice->mzmax);
-                firstSlice->mzmin = std::min(firstSlice->mzmin,
-                                             secondSlice->mzmin);
-
-                firstSlice->mz = (firstSlice->mzmin + firstSlice->mzmax) / 2.0f;
-                firstSlice->rt = (firstSlice->rtmin + firstSlice->rtmax) / 2.0f;
-                float cutoff = massCutoff->massCutoffValue(firstSlice->mz);
+                (secondSlice.mz > firstSlice.mzmin
+                 && secondSlice.mz < firstSlice.mzmax
+                 && secondSlice.rt > firstSlice.rtmin
+                 && secondSlice.rt < firstSlice.rtmax)) {
+                firstSlice.ionCount = std::max(firstSlice.ionCount,
+                                               secondSlice.ionCount);
+                firstSlice.rtmax = std::max(firstSlice.rtmax,
+                                            secondSlice.rtmax);
+                firstSlice.rtmin = std::min(firstSlice.rtmin,
+                                            secondSlice.rtmin);
+                firstSlice.mzmax = std::max(firstSlice.mzmax,
+                                            secondSlice.mzmax);
+                firstSlice.mzmin = std::min(firstSlice.mzmin,
+                                            secondSlice.mzmin);
+
+                firstSlice.mz = (firstSlice.mzmin + firstSlice.mzmax) / 2.0f;
+                firstSlice.rt = (firstSlice.rtmin + firstSlice.rtmax) / 2.0f;
+                float cutoff = massCutoff->massCutoffValue(firstSlice.mz);
 
                 // make sure that mz window does not get out of control
-                if (firstSlice->mzmin < firstSlice->mz - cutoff)
-                    firstSlice->mzmin =  firstSlice->mz - cutoff;
-                if (firstSlice->mzmax > firstSlice->mz + cutoff)
-                    firstSlice->mzmax =  firstSlice->mz + cutoff;
+                if (firstSlice.mzmin < firstSlice.mz - cutoff)
+                    firstSlice.mzmin =  firstSlice.mz - cutoff;
+                if (firstSlice.mzmax > firstSlice.mz + cutoff)
+                    firstSlice.mzmax =  firstSlice.mz + cutoff;
 
                 // recalculate center mz in case bounds changed
-                firstSlice->mz = (firstSlice->mzmin + firstSlice->mzmax) / 2.0f;
+                firstSlice.mz = (firstSlice.mzmin + firstSlice.mzmax) / 2.0f;
 
                 // flag this slice as already merged, and ignore henceforth
-                secondSlice->ionCount = -1.0f;
+                secondSlice.ionCount = -1.0f;
+                nextLive[second] = second + 1;
             }
         }
-        sendSignal("Reducing redundant slices…",
-                   first - begin(slices),
-                   slices.size());
+        progress.setCompleted(first);
     }
 
     // remove merged slices
-    slices.erase(remove_if(slices.begin(),
-                           slices.end(),
-                           [](mzSlice* slice) {
-                               return (slice->ionCount == -1.0f);
+    bounds.erase(remove_if(bounds.begin(),
+                           bounds.end(),
+                           [](const SliceBounds& slice) {
+                               return (slice.ionCount == -1.0f);
                            }),
-                 slices.end());
+                 bounds.end());
 }
 
 void MassSlices::_mergeSlices(const MassCutoff* massCutoff,
@@ -398,70 +499,93 @@ void MassSlices::_mergeSlices(const MassCutoff* massCutoff,
         mergeInto->mz = (mergeInto->mzmin + mergeInto->mzmax) / 2.0f;
     };
 
-    for(auto it = begin(slices); it != end(slices); ++it) {
-        if (mavenParameters->stop) {
-            stopSlicing();
+    // merged slices are unlinked from a list threaded through the slice
+    // vector, which is compacted once at the end; `n` marks either end
+    size_t n = slices.size();
+    vector<size_t> nextSlice(n), prevSlice(n);
+    for (size_t i = 0; i < n; i++) {
+        nextSlice[i] = i + 1;
+        prevSlice[i] = i > 0 ? i - 1 : n;
+    }
+    size_t head = 0;
+    size_t position = 0;
+    size_t remaining = n;
+    auto unlink = [&](size_t i) {
+        if (prevSlice[i] != n)
+            nextSlice[prevSlice[i]] = nextSlice[i];
+        if (nextSlice[i] != n)
+            prevSlice[nextSlice[i]] = prevSlice[i];
+        if (i == head)
+            head = nextSlice[i];
+        delete slices[i];
+        slices[i] = nullptr;
+        remaining--;
+    };
+
+    ProgressReporter progress(_progressCallback(),
+                              "Merging adjacent slices…",
+                              remaining);
+    for (size_t it = head; it < n; it = nextSlice[it], position++) {
+        if (mavenParameters->stop)
             break;
-        }
 
-        sendSignal("Merging adjacent slices…",
-                   it - begin(slices),
-                   slices.size());
+        progress.setCompleted(position);
+        progress.setTotal(remaining);
 
-        auto slice = *it;
-        vector<mzSlice*> slicesToMerge;
+        auto slice = slices[it];
+        vector<size_t> toMerge;
 
         // search ahead
-        for (auto ahead = next(it);
-             ahead != end(slices) && it != end(slices);
-             ++ahead) {
-            auto comparisonSlice = *ahead;
+        for (size_t ahead = nextSlice[it]; ahead != n; ahead = nextSlice[ahead]) {
             auto comparison = _compareSlices(samples,
                                              slice,
-                                             comparisonSlice,
+                                             slices[ahead],
                                              massCutoff,
                                              rtTolerance);
             auto shouldMerge = comparison.first;
             auto continueIteration = comparison.second;
             if (shouldMerge)
-                slicesToMerge.push_back(comparisonSlice);
+                toMerge.push_back(ahead);
             if (!continueIteration)
                 break;
         }
 
-        // search behind
-        for (auto behind = prev(it);
-             behind != begin(slices) && it != begin(slices);
-             --behind) {
-            auto comparisonSlice = *behind;
-            auto comparison = _compareSlices(samples,
-                                             slice,
-                                             comparisonSlice,
-                                             massCutoff,
-                                             rtTolerance);
-            auto shouldMerge = comparison.first;
-            auto continueIteration = comparison.second;
-            if (shouldMerge)
-                slicesToMerge.push_back(comparisonSlice);
-            if (!continueIteration)
-                break;
+        // search behind, up to but excluding the first slice
+        if (it != head) {
+            for (size_t behind = prevSlice[it];
+                 behind != head;
+                 behind = prevSlice[behind]) {
+                auto comparison = _compareSlices(samples,
+                                                 slice,
+                                                 slices[behind],
+                                                 massCutoff,
+                                                 rtTolerance);
+                auto shouldMerge = comparison.first;
+                auto continueIteration = comparison.second;
+                if (shouldMerge)
+                    toMerge.push_back(behind);
+                if (!continueIteration)
+                    break;
+            }
         }
 
         // expand the current slice by merging all slices classified to be
         // part of the same, and then remove (and free) the slices already
         // merged
+        vector<mzSlice*> slicesToMerge;
+        for (auto i : toMerge)
+            slicesToMerge.push_back(slices[i]);
         expandSlice(slice, slicesToMerge);
-        for (auto merged : slicesToMerge) {
-            slices.erase(remove_if(begin(slices),
-                                   end(slices),
-                                   [&](mzSlice* s) { return s == merged; }),
-                         slices.end());
-            delete merged;
+        for (auto i : toMerge) {
+            if (i < it)
+                position--;
+            unlink(i);
         }
-        it = find_if(begin(slices),
-                     end(slices),
-                     [&](mzSlice* s) { return s == slice; });
     }
+
+    slices.erase(remove(slices.begin(), slices.end(), nullptr), slices.end());
+    if (mavenParameters->stop)
+        stopSlicing();
 }
 
 pair<bool, bool> MassSlices::_compareSlices(vector<mzSample*>& samples,
@@ -590,7 +714,9 @@ pair<bool, bool> MassSlices::_compareSlices(vector<mzSample*>& samples,
 
 void MassSlices::adjustSlices()
 {
-    size_t progressCount = 0;
+    ProgressReporter progress(_progressCallback(),
+                              "Adjusting slices…",
+                              slices.size());
     for (auto slice : slices) {
         if (mavenParameters->stop) {
             stopSlicing();
@@ -614,9 +740,7 @@ void MassSlices::adjustSlices()
         slice->mzmax =  mzAtHighestIntensity + cutoff;
         slice->mz = (slice->mzmin + slice->mzmax) / 2.0f;
 
-        delete_all(eics);
-
-        ++progressCount;
-        sendSignal("Adjusting slices…", progressCount, slices.size());
+        EICPool::release(eics);
+        progress.advance();
     }
 }
@@ -7,6 +7,7 @@
 #include <boost/bind.hpp>
 
 #include "standardincludes.h"
+#include "progressreporter.h"
 
 class MassCutoff;
 class mzSample;
@@ -178,9 +179,51 @@ class MassSlices {
                                         const float rtTolerance);
 
         /**
-         * @brief This method will reduce the internal slice vector by merging
+         * @brief Bounds, center and ion count of a slice while slicing.
+         * @details algorithmB creates one of these for every data point, by
+         * value, and only allocates `mzSlice` objects for those that remain
+         * after reduction.
+         */
+        struct SliceBounds {
+            float mzmin;
+            float mzmax;
+            float rtmin;
+            float rtmax;
+            float mz;
+            float rt;
+            float ionCount;
+        };
+
+        /**
+         * @brief This method will reduce the given slices by merging
          * and resizing them if they share a signifant region of interest.
+         * @param bounds Slices sorted by m/z and then rt.
+         */
+        void _reduceSlices(vector<SliceBounds>& bounds);
+
+        /**
+         * @brief Callback for a `ProgressReporter` that forwards progress
+         * to `sendSignal`.
+         */
+        ProgressReporter::Callback _progressCallback();
+
+        /**
+         * @brief Order of slices by m/z first and then by rt.
+         */
+        static bool _boundsBefore(const SliceBounds& slice,
+                                  const SliceBounds& compSlice);
+
+        /**
+         * @brief Create the bounds of a slice around every MS1 data point of
+         * a sample that passes the m/z, rt and intensity filters.
+         * @details Only touches the given sample and its own output, so that
+         * samples can be sliced concurrently.
+         * @param sample Sample to be sliced.
+         * @param rtWindow Half width of every slice in rt.
+         * @param bounds Filled with the slices, sorted by m/z and then rt.
          */
-        void _reduceSlices();
+        void _slicePoints(mzSample* sample,
+                          float rtWindow,
+                          vector<SliceBounds>& bounds);
 };
 #endif
@@ -9,7 +9,11 @@
 #include "mzMassCalculator.h"
 #include "Matrix.h"
 #include "EIC.h"
+#include "eicpool.h"
 #include "Scan.h"
+#include "samplecache.h"
+#include "mzrtindex.h"
+#include "xmlstream.h"
 
 #include <MavenException.h>
 
@@ -20,6 +24,10 @@ int mzSample::filter_intensityQuantile = 0;
 int mzSample::filter_polarity = 0;
 int mzSample::filter_mslevel = 0;
 
+// tolerance within which the precursor m/z of MS2 scans is matched to a
+// peak of the preceding full scan
+static const float precursorPpm = 10;
+
 mzSample::mzSample() : _setName(""), injectionOrder(0)
 {
     _id = -1;
@@ -45,10 +53,25 @@ mzSample::mzSample() : _setName(""), injectionOrder(0)
     // list.
     color[0] = color[1] = color[2] = 0;
     color[3] = 1.0;
+    _lazyLoading = false;
+    _sampleCaching = false;
+    _lazyStream = nullptr;
+    _scanColumns = nullptr;
+    _rtIndexedScans = 0;
+    _mzRtIndexLimit = 0;
+    _mzRtIndex = nullptr;
+    _lazyMinMz = FLT_MAX;
+    _lazyMaxMz = 0;
+    _lazyMaxIntensity = 0;
+    _lazyTotalIntensity = 0;
 }
 
 mzSample::~mzSample()
 {
+    delete _lazyStream;
+    delete _scanColumns;
+    delete _mzRtIndex.load();
+
     for (unsigned int i = 0; i < scans.size(); i++)
         if (scans[i] != NULL)
             delete (scans[i]);
@@ -68,6 +91,25 @@ void mzSample::addScan(Scan* s)
         and s->getPolarity() != mzSample::filter_polarity)
         return;
 
+    // lazily loaded scans are filtered once their arrays are decoded
+    if (s->isDataLoaded())
+        filterScanData(s);
+
+    if (s->mslevel == 1)
+        ++_numMS1Scans;
+    if (s->mslevel == 2)
+        ++_numMS2Scans;
+
+    scans.push_back(s);
+    s->scannum = scans.size() - 1;
+
+    //recalculate precursorMz of MS2 scans
+    if (s->mslevel == 2 && _numMS1Scans > 0 && s->isDataLoaded())
+        s->recalculatePrecursorMz(precursorPpm);
+}
+
+void mzSample::filterScanData(Scan* s)
+{
     // unsigned int sizeBefore = s->intensity.size();
     if (mzSample::filter_centroidScans == true) {
         s->simpleCentroid();
@@ -86,20 +128,6 @@ void mzSample::addScan(Scan* s)
     // unsigned int sizeAfter3 = s->intensity.size();
     // cerr << "addScan " << sizeBefore <<  " " << sizeAfter1 << " " <<
     // sizeAfter2 << " " << sizeAfter3 << endl;
-
-    if (s->mslevel == 1)
-        ++_numMS1Scans;
-    if (s->mslevel == 2)
-        ++_numMS2Scans;
-
-    scans.push_back(s);
-    s->scannum = scans.size() - 1;
-
-    //recalculate precursorMz of MS2 scans
-    if (s->mslevel == 2 && _numMS1Scans > 0) {
-        float ppm = 10;
-        s->recalculatePrecursorMz(ppm);
-    }
 }
 
 string mzSample::getFileName(const string& filename)
@@ -157,14 +185,27 @@ void mzSample::checkSampleBlank(const char* filename)
 
 void mzSample::loadSample(const char* filename)
 {
+    // Setting Sample name, ahead of parsing so that errors can refer to it
+    sampleNaming(filename);
+
     // Loading and Decoding the file
     // catch any error while parsing
     try {
-        loadAnySample(filename);
+        // a valid cache replaces parsing of the source file
+        if (!_sampleCaching || !SampleCache::read(this, filename)) {
+            loadAnySample(filename);
+            if (_sampleCaching)
+                SampleCache::write(this, filename);
+        }
     }
 
     catch (MavenException& excp) {
         cerr << endl << "Error: " << excp.what() << endl;
+
+        // scans read before the error do not make a usable sample
+        delete_all(scans);
+        _numMS1Scans = 0;
+        _numMS2Scans = 0;
     }
 
     // getting the SRM scan type
@@ -173,11 +214,14 @@ void mzSample::loadSample(const char* filename)
     // set min and max values for rt and mz
     calculateMzRtRange();
 
-    // Setting Sample name
-    sampleNaming(filename);
+    buildRtIndex();
 
     // Checking if a sample is blank or not
     checkSampleBlank(filename);
+
+    // lazily loaded samples are indexed once their scans are decoded
+    if (_lazySourceFile.empty())
+        buildMzRtIndex();
 }
 
 void mzSample::parseMzCSV(const char* filename)
@@ -263,6 +307,8 @@ void mzSample::writeMzCSV(const char* filename)
         return;
     }
 
+    loadAllScanData();
+
     mzCSV << "scannum,rt,mz,intensity,mslevel,precursorMz,polarity,srmid"
           << endl;
     for (unsigned int i = 0; i < scans.size(); i++) {
@@ -285,33 +331,120 @@ int mzSample::getPolarity()
 }
 void mzSample::parseMzML(const char* filename)
 {
-    xml_document doc;
-
-    const unsigned int parse_options = parse_minimal;
+    if (_lazyLoading && !_sampleCaching && parseIndexedMzML(filename))
+        return;
 
-    pugi::xml_parse_result parseResult = doc.load_file(filename, parse_options);
-    if (parseResult.status != pugi::xml_parse_status::status_ok) {
+    // spectra and chromatograms are pulled out of the file one at a time so
+    // that only a single element is ever held in a DOM
+    XmlElementStream stream(filename,
+                            {"spectrum", "chromatogram"},
+                            {"run", "spectrumList"});
+    if (!stream.isOpen()) {
         throw MavenException(ErrorMsg::ParsemzMl);
     }
 
-    // Get injection time stamp
-    xml_node experimentRun =
-        doc.first_child().first_element_by_path("mzML/run");
-    if (!experimentRun.empty()) {
-        parseMzMLInjectionTimeStamp(experimentRun.attribute("startTimeStamp"));
+    const unsigned int parse_options = parse_minimal;
+
+    // Spectra are parsed and decoded by worker tasks while this thread
+    // carries on tokenizing the file. Decoded scans are added in file order
+    // whenever a batch completes, because addScan expects an MS1 scan to be
+    // added before the MS2 scans that follow it.
+    const size_t batchSize = 256;
+    vector<string> spectra(batchSize);
+    vector<Scan*> decoded(batchSize, nullptr);
+    vector<char> decodedOk(batchSize, 0);
+    size_t batchCount = 0;
+
+    int scannum = 0;
+    bool parseFailed = false;
+    bool foundElements = false;
+    bool hasSpectrumList = false;
+    bool hasChromatograms = false;
+
+    auto addDecodedSpectra = [&]() {
+        for (size_t i = 0; i < batchCount; i++) {
+            if (!decodedOk[i]) {
+                parseFailed = true;
+            } else if (decoded[i]) {
+                decoded[i]->scannum = scannum++;
+                addScan(decoded[i]);
+            }
+            decoded[i] = nullptr;
+        }
+        batchCount = 0;
+    };
+
+#pragma omp parallel default(shared)
+#pragma omp single
+    {
+        string name;
+        string markup;
+        while (!parseFailed && stream.next(name, markup)) {
+            foundElements = true;
+            if (name == "spectrumList") {
+                hasSpectrumList = true;
+                continue;
+            }
+
+            if (name == "spectrum") {
+                size_t i = batchCount++;
+                spectra[i].swap(markup);
+#pragma omp task firstprivate(i)
+                decodedOk[i] = decodeMzMLSpectrum(spectra[i], decoded[i]);
+
+                if (batchCount == batchSize) {
+#pragma omp taskwait
+                    addDecodedSpectra();
+                }
+                continue;
+            }
+
+            // everything else is handled in document order, after the
+            // spectra that precede it
+#pragma omp taskwait
+            addDecodedSpectra();
+
+            // chromatograms are only used when there is no spectrum list
+            if (name == "chromatogram" && hasSpectrumList)
+                continue;
+
+            xml_document doc;
+            pugi::xml_parse_result parseResult =
+                doc.load_buffer(markup.data(), markup.size(), parse_options);
+            if (parseResult.status != pugi::xml_parse_status::status_ok) {
+                parseFailed = true;
+                continue;
+            }
+            xml_node node = doc.first_child();
+
+            if (name == "run") {
+                // Get injection time stamp
+                parseMzMLInjectionTimeStamp(node.attribute("startTimeStamp"));
+            } else if (name == "chromatogram") {
+                if (!parseMzMLChromatogram(node, scannum))
+                    parseFailed = true;
+                hasChromatograms = true;
+            }
+        }
+        if (stream.truncated()) {
+            cerr << "parseMzML: " << filename << " is truncated"
+                 << endl;
+            parseFailed = true;
+        }
+#pragma omp taskwait
+        addDecodedSpectra();
     }
 
-    // Get a spectrumstore node
-    xml_node chromatogramList =
-        doc.first_child().first_element_by_path("mzML/run/chromatogramList");
-    xml_node spectrumList =
-        doc.first_child().first_element_by_path("mzML/run/spectrumList");
+    if (parseFailed) {
+        throw MavenException(ErrorMsg::ParsemzMl);
+    }
 
-    if (!spectrumList.empty()) {
-        parseMzMLSpectrumList(spectrumList);
-    } else if (!chromatogramList.empty()) {
-        parseMzMLChromatogramList(chromatogramList);
+    if (!foundElements) {
+        throw MavenException(ErrorMsg::ParsemzMl);
     }
+
+    if (hasChromatograms)
+        renumberScansByRt();
 }
 
 void mzSample::parseMzMLInjectionTimeStamp(
@@ -334,81 +467,101 @@ void mzSample::parseMzMLChromatogramList(const xml_node& chromatogramList)
     for (xml_node chromatogram = chromatogramList.child("chromatogram");
          chromatogram;
          chromatogram = chromatogram.next_sibling("chromatogram")) {
-        string chromatogramId = chromatogram.attribute("id").value();
-        int sampleNo = getSampleNoChromatogram(chromatogramId);
-
-        cleanFilterLine(chromatogramId);
-
-        vector<float> timeVector;
-        vector<float> intsVector;
-
-        xml_node binaryDataArrayList =
-            chromatogram.child("binaryDataArrayList");
-        string precursorMzStr =
-            chromatogram
-                .first_element_by_path("precursor/isolationWindow/cvParam")
-                .attribute("value")
-                .value();
-        string productMzStr =
-            chromatogram
-                .first_element_by_path("product/isolationWindow/cvParam")
-                .attribute("value")
-                .value();
-        float precursorMz = string2float(precursorMzStr);
-        float productMz = string2float(productMzStr);
-        // int mslevel=2;
-
-        for (xml_node binaryDataArray = binaryDataArrayList.child("binaryDataArray");
-             binaryDataArray;
-             binaryDataArray =
-                 binaryDataArray.next_sibling("binaryDataArray")) {
-
-            map<string, string> attr = mzML_cvParams(binaryDataArray);
-
-            int precision = 64;
-            if (attr.count("32-bit float"))
-                precision = 32;
-
-            bool decompress = false;
-            if(attr.count("zlib compression"))
-                decompress=true;
-
-            string binaryDataStr =
-                binaryDataArray.child("binary").child_value();
-            vector<float> binaryData = base64::decodeBase64(binaryDataStr,
-                                                             precision / 8,
-                                                             false,
-                                                             decompress);
-
-            if (attr.count("time array")) {
-                timeVector = binaryData;
-            }
-            if (attr.count("intensity array")) {
-                intsVector = binaryData;
-            }
+        if (!parseMzMLChromatogram(chromatogram, scannum))
+            throw MavenException(ErrorMsg::ParsemzMl);
+    }
+    renumberScansByRt();
+}
+
+bool mzSample::parseMzMLChromatogram(const xml_node& chromatogram,
+                                     int& scannum)
+{
+    string chromatogramId = chromatogram.attribute("id").value();
+    int sampleNo = getSampleNoChromatogram(chromatogramId);
+
+    cleanFilterLine(chromatogramId);
+
+    vector<float> timeVector;
+    vector<float> intsVector;
+
+    xml_node binaryDataArrayList =
+        chromatogram.child("binaryDataArrayList");
+    string precursorMzStr =
+        chromatogram
+            .first_element_by_path("precursor/isolationWindow/cvParam")
+            .attribute("value")
+            .value();
+    string productMzStr =
+        chromatogram
+            .first_element_by_path("product/isolationWindow/cvParam")
+            .attribute("value")
+            .value();
+    float precursorMz = string2float(precursorMzStr);
+    float productMz = string2float(productMzStr);
+    // int mslevel=2;
+
+    for (xml_node binaryDataArray = binaryDataArrayList.child("binaryDataArray");
+         binaryDataArray;
+         binaryDataArray =
+             binaryDataArray.next_sibling("binaryDataArray")) {
+
+        map<string, string> attr = mzML_cvParams(binaryDataArray);
+
+        int precision = 64;
+        if (attr.count("32-bit float"))
+            precision = 32;
+
+        bool decompress = false;
+        if(attr.count("zlib compression"))
+            decompress=true;
+
+        vector<float>* binaryData = nullptr;
+        if (attr.count("time array")) {
+            binaryData = &timeVector;
+        } else if (attr.count("intensity array")) {
+            binaryData = &intsVector;
         }
+        if (binaryData == nullptr)
+            continue;
 
-        //	cerr << chromatogramId << endl;
-        //	cerr << timeVector.size() << " ints=" << intsVector.size() <<
-        //endl; 	cerr << "pre: " << precursorMz << " prod=" << productMz << endl;
-
-        // if (precursorMz and precursorMz ) {
-        if (precursorMz) {  // naman Same expression on both sides of '&&'.
-            int mslevel =
-                2;  // naman The scope of the variable 'mslevel' can be reduced.
-            for (unsigned int i = 0; i < timeVector.size(); i++) {
-                Scan* scan = new Scan(
-                    this, scannum++, mslevel, timeVector[i], precursorMz, -1);
-                scan->productMz = productMz;
-                scan->mz.push_back(productMz);
-                scan->filterLine = chromatogramId;
-                sampleNumber = sampleNo;
-                scan->intensity.push_back(intsVector[i]);
-                addScan(scan);
-            }
+        const char* binaryDataStr =
+            binaryDataArray.child("binary").child_value();
+        if (!base64::decodeBase64(binaryDataStr,
+                                  strlen(binaryDataStr),
+                                  precision / 8,
+                                  false,
+                                  decompress,
+                                  *binaryData)) {
+            cerr << "Failed to decompress the binary data of chromatogram "
+                 << chromatogramId << " in " << fileName << endl;
+            return false;
+        }
+    }
+
+    //	cerr << chromatogramId << endl;
+    //	cerr << timeVector.size() << " ints=" << intsVector.size() <<
+    //endl; 	cerr << "pre: " << precursorMz << " prod=" << productMz << endl;
+
+    // if (precursorMz and precursorMz ) {
+    if (precursorMz) {  // naman Same expression on both sides of '&&'.
+        int mslevel =
+            2;  // naman The scope of the variable 'mslevel' can be reduced.
+        for (unsigned int i = 0; i < timeVector.size(); i++) {
+            Scan* scan = new Scan(
+                this, scannum++, mslevel, timeVector[i], precursorMz, -1);
+            scan->productMz = productMz;
+            scan->mz.push_back(productMz);
+            scan->filterLine = chromatogramId;
+            sampleNumber = sampleNo;
+            scan->intensity.push_back(intsVector[i]);
+            addScan(scan);
         }
     }
+    return true;
+}
 
+void mzSample::renumberScansByRt()
+{
     // renumber scans based on retention time
     std::sort(scans.begin(), scans.end(), Scan::compRt);
     for (unsigned int i = 0; i < scans.size(); i++) {
@@ -452,123 +605,562 @@ void mzSample::parseMzMLSpectrumList(const xml_node& spectrumList)
 
     for (xml_node spectrum = spectrumList.child("spectrum"); spectrum;
          spectrum = spectrum.next_sibling("spectrum")) {
-        string spectrumId = spectrum.attribute("id").value();
+        parseMzMLSpectrum(spectrum, scannum);
+    }
+}
 
-        if (spectrum.empty())
+void mzSample::parseMzMLSpectrum(const xml_node& spectrum, int& scannum)
+{
+    if (spectrum.empty())
+        return;
+
+    xml_node binaryDataArrayList = spectrum.child("binaryDataArrayList");
+    if (!binaryDataArrayList or binaryDataArrayList.empty())
+        return;
+
+    Scan* scan = parseMzMLSpectrumHeader(spectrum, scannum++);
+    if (!parseMzMLBinaryDataArrays(binaryDataArrayList, scan)) {
+        delete scan;
+        throw MavenException(ErrorMsg::ParsemzMl);
+    }
+    addScan(scan);
+}
+
+bool mzSample::decodeMzMLSpectrum(const string& markup, Scan*& scan)
+{
+    scan = nullptr;
+
+    xml_document doc;
+    pugi::xml_parse_result parseResult =
+        doc.load_buffer(markup.data(), markup.size(), parse_minimal);
+    if (parseResult.status != pugi::xml_parse_status::status_ok)
+        return false;
+
+    xml_node spectrum = doc.first_child();
+    if (spectrum.empty())
+        return true;
+
+    xml_node binaryDataArrayList = spectrum.child("binaryDataArrayList");
+    if (!binaryDataArrayList or binaryDataArrayList.empty())
+        return true;
+
+    // scans are numbered once they are added to the sample
+    scan = parseMzMLSpectrumHeader(spectrum, 0);
+    if (!parseMzMLBinaryDataArrays(binaryDataArrayList, scan)) {
+        delete scan;
+        scan = nullptr;
+        return false;
+    }
+    return true;
+}
+
+Scan* mzSample::parseMzMLSpectrumHeader(const xml_node& spectrum, int scannum)
+{
+    string spectrumId = spectrum.attribute("id").value();
+    map<string, string> cvParams = mzML_cvParams(spectrum);
+
+    int mslevel = 1;
+    int scanpolarity = 0;
+    float rt = 0;
+
+    if (cvParams.count("ms level")) {
+        string msLevelStr = cvParams["ms level"];
+        mslevel = (int)string2float(msLevelStr);
+    }
+
+    if (cvParams.count("positive scan"))
+        scanpolarity = 1;
+    else if (cvParams.count("negative scan"))
+        scanpolarity = -1;
+    else
+        scanpolarity = 0;
+
+    xml_node scanNode = spectrum.first_element_by_path("scanList/scan");
+    map<string, string> scanAttr = mzML_cvParams(scanNode);
+    if (scanAttr.count("scan start time minute")) {
+        string rtStr = scanAttr["scan start time minute"];
+        rt = string2float(rtStr);
+    } else if (scanAttr.count("scan start time second")) {
+        string rtStr = scanAttr["scan start time second"];
+        rt = string2float(rtStr) / 60.0f;
+    }
+
+    if (scanAttr.count("filter string")) {
+        spectrumId = scanAttr["filter string"];
+    }
+    cleanFilterLine(spectrumId);
+
+    map<string, string> isolationWindow =
+        mzML_cvParams(spectrum.first_element_by_path(
+            "precursorList/precursor/isolationWindow"));
+    string precursorMzStr = isolationWindow["isolation window target m/z"];
+    float precursorMz = 0;
+    if (string2float(precursorMzStr) > 0)
+        precursorMz = string2float(precursorMzStr);
+
+    string precursorIsolationStrLower =
+        isolationWindow["isolation window lower offset"];
+    string precursorIsolationStrUpper =
+        isolationWindow["isolation window upper offset"];
+
+    float precursorIsolationWindow = 0.0f;
+    if (string2float(precursorIsolationStrLower) > 0.0f)
+        precursorIsolationWindow +=
+            string2float(precursorIsolationStrLower);
+    if (string2float(precursorIsolationStrUpper) > 0.0f)
+        precursorIsolationWindow +=
+            string2float(precursorIsolationStrUpper);
+    if (precursorIsolationWindow <= 0.0f)
+        precursorIsolationWindow = 1.0f;
+
+    string productMzStr =
+        spectrum.first_element_by_path("product/isolationWindow/cvParam")
+            .attribute("value")
+            .value();
+    float productMz = 0;
+    if (string2float(productMzStr) > 0)
+        productMz = string2float(productMzStr);
+
+    Scan* scan =
+        new Scan(this, scannum, mslevel, rt, precursorMz, scanpolarity);
+    scan->isolationWindow = precursorIsolationWindow;
+    scan->productMz = productMz;
+    scan->filterLine = spectrumId;
+    return scan;
+}
+
+bool mzSample::parseMzMLBinaryDataArrays(const xml_node& binaryDataArrayList,
+                                         Scan* scan)
+{
+    for (xml_node binaryDataArray =
+             binaryDataArrayList.child("binaryDataArray");
+         binaryDataArray;
+         binaryDataArray =
+             binaryDataArray.next_sibling("binaryDataArray")) {
+        if (!binaryDataArray or binaryDataArray.empty())
             continue;
-        map<string, string> cvParams = mzML_cvParams(spectrum);
 
-        int mslevel = 1;
-        int scanpolarity = 0;
-        float rt = 0;
-        vector<float> mzVector;
-        vector<float> intsVector;
+        map<string, string> attr = mzML_cvParams(binaryDataArray);
+
+        int precision = 64;
+        if (attr.count("32-bit float"))
+            precision = 32;
 
-        if (cvParams.count("ms level")) {
-            string msLevelStr = cvParams["ms level"];
-            mslevel = (int)string2float(msLevelStr);
+        bool decompress = false;
+        if(attr.count("zlib compression"))
+            decompress=true;
+
+        vector<float>* binaryData = nullptr;
+        if (attr.count("m/z array")) {
+            binaryData = &scan->mz;
+        } else if (attr.count("intensity array")) {
+            binaryData = &scan->intensity;
         }
+        if (binaryData == nullptr)
+            continue;
 
-        if (cvParams.count("positive scan"))
-            scanpolarity = 1;
-        else if (cvParams.count("negative scan"))
-            scanpolarity = -1;
-        else
-            scanpolarity = 0;
+        // decode from the node text in place, straight into the scan
+        const char* binaryDataStr =
+            binaryDataArray.child("binary").child_value();
+        size_t binaryDataLength = strlen(binaryDataStr);
+        if (binaryDataLength > 0
+            && !base64::decodeBase64(binaryDataStr,
+                                     binaryDataLength,
+                                     precision / 8,
+                                     false,
+                                     decompress,
+                                     *binaryData)) {
+            cerr << "Failed to decompress the binary data of spectrum "
+                 << scan->filterLine << " in " << fileName << endl;
+            return false;
+        }
+    }
+    return true;
+}
 
-        xml_node scanNode = spectrum.first_element_by_path("scanList/scan");
-        map<string, string> scanAttr = mzML_cvParams(scanNode);
-        if (scanAttr.count("scan start time minute")) {
-            string rtStr = scanAttr["scan start time minute"];
-            rt = string2float(rtStr);
-        } else if (scanAttr.count("scan start time second")) {
-            string rtStr = scanAttr["scan start time second"];
-            rt = string2float(rtStr) / 60.0f;
+vector<streamoff> mzSample::readMzMLSpectrumOffsets(const char* filename)
+{
+    vector<streamoff> offsets;
+
+    // indexedmzML ends with the position of the index list
+    ifstream file(filename, ios::in | ios::binary);
+    if (!file.is_open())
+        return offsets;
+    file.seekg(0, ios::end);
+    streamoff fileSize = file.tellg();
+    streamoff tailSize = min(fileSize, static_cast<streamoff>(4096));
+    string tail(static_cast<size_t>(tailSize), '\0');
+    file.seekg(fileSize - tailSize);
+    file.read(&tail[0], tailSize);
+
+    const string offsetTag = "<indexListOffset>";
+    size_t tagPos = tail.rfind(offsetTag);
+    if (tagPos == string::npos)
+        return offsets;
+    streamoff indexListOffset =
+        atoll(tail.c_str() + tagPos + offsetTag.size());
+    if (indexListOffset <= 0 || indexListOffset >= fileSize)
+        return offsets;
+
+    XmlElementStream stream(filename, {"index"});
+    if (!stream.seek(indexListOffset))
+        return offsets;
+
+    string name;
+    string markup;
+    while (stream.next(name, markup)) {
+        xml_document doc;
+        if (!doc.load_buffer(markup.data(), markup.size(), parse_minimal))
+            break;
+        xml_node index = doc.first_child();
+        if (strcmp(index.attribute("name").value(), "spectrum") != 0)
+            continue;
+        for (xml_node offset = index.child("offset"); offset;
+             offset = offset.next_sibling("offset")) {
+            offsets.push_back(atoll(offset.child_value()));
         }
+    }
+    return offsets;
+}
 
-        if (scanAttr.count("filter string")) {
-            spectrumId = scanAttr["filter string"];
+bool mzSample::parseIndexedMzML(const char* filename)
+{
+    vector<streamoff> offsets = readMzMLSpectrumOffsets(filename);
+    if (offsets.empty())
+        return false;
+
+    // small chunks, so that little more than the head of every spectrum is
+    // read off the disk
+    XmlElementStream stream(filename, set<string>(), {"run"}, 4096);
+    string name;
+    string markup;
+    xml_document runDoc;
+    if (stream.next(name, markup)
+        && runDoc.load_buffer(markup.data(), markup.size(), parse_minimal)) {
+        parseMzMLInjectionTimeStamp(
+            runDoc.first_child().attribute("startTimeStamp"));
+    }
+
+    vector<Scan*> headers;
+    bool indexValid = true;
+    int summarizedSpectra = 0;
+    int scannum = 0;
+    for (streamoff offset : offsets) {
+        if (!stream.seek(offset)) {
+            indexValid = false;
+            break;
         }
-        cleanFilterLine(spectrumId);
+        bool hasData = stream.nextHead("binaryDataArrayList", name, markup);
 
-        map<string, string> isolationWindow =
-            mzML_cvParams(spectrum.first_element_by_path(
-                "precursorList/precursor/isolationWindow"));
-        string precursorMzStr = isolationWindow["isolation window target m/z"];
-        float precursorMz = 0;
-        if (string2float(precursorMzStr) > 0)
-            precursorMz = string2float(precursorMzStr);
-
-        string precursorIsolationStrLower =
-            isolationWindow["isolation window lower offset"];
-        string precursorIsolationStrUpper =
-            isolationWindow["isolation window upper offset"];
-
-        float precursorIsolationWindow = 0.0f;
-        if (string2float(precursorIsolationStrLower) > 0.0f)
-            precursorIsolationWindow +=
-                string2float(precursorIsolationStrLower);
-        if (string2float(precursorIsolationStrUpper) > 0.0f)
-            precursorIsolationWindow +=
-                string2float(precursorIsolationStrUpper);
-        if (precursorIsolationWindow <= 0.0f)
-            precursorIsolationWindow = 1.0f;
-
-        string productMzStr =
-            spectrum.first_element_by_path("product/isolationWindow/cvParam")
-                .attribute("value")
-                .value();
-        float productMz = 0;
-        if (string2float(productMzStr) > 0)
-            productMz = string2float(productMzStr);
-
-        xml_node binaryDataArrayList = spectrum.child("binaryDataArrayList");
-        if (!binaryDataArrayList or binaryDataArrayList.empty())
+        // offsets that do not point at spectra mean the index is stale
+        if (name != "spectrum") {
+            indexValid = false;
+            break;
+        }
+        if (!hasData)
             continue;
 
-        for (xml_node binaryDataArray =
-                 binaryDataArrayList.child("binaryDataArray");
-             binaryDataArray;
-             binaryDataArray =
-                 binaryDataArray.next_sibling("binaryDataArray")) {
-            if (!binaryDataArray or binaryDataArray.empty())
-                continue;
+        xml_document doc;
+        if (!doc.load_buffer(markup.data(), markup.size(), parse_minimal)) {
+            indexValid = false;
+            break;
+        }
+        xml_node spectrum = doc.first_child();
 
-            map<string, string> attr = mzML_cvParams(binaryDataArray);
-
-            int precision = 64;
-            if (attr.count("32-bit float"))
-                precision = 32;
-
-            bool decompress = false;
-            if(attr.count("zlib compression"))
-                decompress=true;
-
-            string binaryDataStr =
-                binaryDataArray.child("binary").child_value();
-            if (!binaryDataStr.empty()) {
-                vector<float> binaryData = base64::decodeBase64(binaryDataStr,
-                                                                 precision / 8,
-                                                                 false,
-                                                                 decompress);
-                if (attr.count("m/z array")) {
-                    mzVector = binaryData;
-                }
-                if (attr.count("intensity array")) {
-                    intsVector = binaryData;
-                }
-            }
+        map<string, string> cvParams = mzML_cvParams(spectrum);
+        if (cvParams.count("lowest observed m/z")
+            && cvParams.count("highest observed m/z")) {
+            _lazyMinMz = min(_lazyMinMz,
+                             string2float(cvParams["lowest observed m/z"]));
+            _lazyMaxMz = max(_lazyMaxMz,
+                             string2float(cvParams["highest observed m/z"]));
+            _lazyMaxIntensity =
+                max(_lazyMaxIntensity,
+                    string2float(cvParams["base peak intensity"]));
+            _lazyTotalIntensity += string2float(cvParams["total ion current"]);
+            summarizedSpectra++;
         }
 
-        Scan* scan =
-            new Scan(this, scannum++, mslevel, rt, precursorMz, scanpolarity);
-        scan->isolationWindow = precursorIsolationWindow;
-        scan->productMz = productMz;
-        scan->filterLine = spectrumId;
-        scan->intensity = intsVector;
-        scan->mz = mzVector;
+        Scan* scan = parseMzMLSpectrumHeader(spectrum, scannum++);
+        scan->dataOffset = offset;
+        scan->setDataState(Scan::DataState::Pending);
+        headers.push_back(scan);
+    }
+
+    // without a usable index or spectrum summaries, the sample ranges can
+    // only be found by decoding everything
+    if (!indexValid || summarizedSpectra == 0) {
+        delete_all(headers);
+        _lazyMinMz = FLT_MAX;
+        _lazyMaxMz = 0;
+        _lazyMaxIntensity = 0;
+        _lazyTotalIntensity = 0;
+        return false;
+    }
+
+    _lazySourceFile = filename;
+    for (Scan* scan : headers)
         addScan(scan);
+    return true;
+}
+
+void mzSample::decodeLazyScan(Scan* scan)
+{
+    if (scan->dataState() != Scan::DataState::Pending)
+        return;
+
+    if (_lazyStream == nullptr) {
+        _lazyStream = new XmlElementStream(_lazySourceFile,
+                                           {"spectrum"},
+                                           set<string>(),
+                                           1 << 16);
+    }
+
+    string name;
+    string markup;
+    xml_document doc;
+    if (!_lazyStream->seek(scan->dataOffset)
+        || !_lazyStream->next(name, markup)
+        || !doc.load_buffer(markup.data(), markup.size(), parse_minimal)) {
+        cerr << "Failed to read scan " << scan->scannum << " from "
+             << _lazySourceFile << endl;
+        scan->mz.clear();
+        scan->intensity.clear();
+        scan->setDataState(Scan::DataState::Failed);
+        return;
+    }
+
+    if (!parseMzMLBinaryDataArrays(
+            doc.first_child().child("binaryDataArrayList"), scan)) {
+        scan->mz.clear();
+        scan->intensity.clear();
+        scan->setDataState(Scan::DataState::Failed);
+        return;
+    }
+    filterScanData(scan);
+
+    // the precursor is adjusted before the scan is published, so that no
+    // reader sees it change; the full scan it is taken from is decoded here
+    // as well, as the lock is already held
+    if (scan->mslevel == 2 && _numMS1Scans > 0) {
+        Scan* fullScan = scan->getLastFullScan();
+        if (fullScan)
+            decodeLazyScan(fullScan);
+        scan->recalculatePrecursorMz(precursorPpm);
+    }
+    scan->setDataState(Scan::DataState::Loaded);
+}
+
+void mzSample::loadScanData(Scan* scan)
+{
+    lock_guard<mutex> lock(_scanDataMutex);
+    restoreScanFromColumns(scan);
+    decodeLazyScan(scan);
+}
+
+void mzSample::loadAllScanData()
+{
+    if (_lazySourceFile.empty() && _scanColumns == nullptr)
+        return;
+
+    lock_guard<mutex> lock(_scanDataMutex);
+    for (Scan* scan : scans) {
+        restoreScanFromColumns(scan);
+        decodeLazyScan(scan);
+    }
+    if (_lazySourceFile.empty())
+        return;
+    delete _lazyStream;
+    _lazyStream = nullptr;
+    buildMzRtIndex();
+}
+
+const size_t ScanColumns::blockSize;
+
+size_t ScanColumns::memoryUsage() const
+{
+    size_t bytes = rt.capacity() * sizeof(float)
+                   + offsets.capacity() * sizeof(size_t)
+                   + (blocks.capacity() + peakCounts.capacity())
+                         * sizeof(unsigned int)
+                   + (mslevel.capacity() + polarity.capacity()) * sizeof(int);
+    for (size_t i = 0; i < mzBlocks.size(); i++) {
+        bytes += (mzBlocks[i].capacity() + intensityBlocks[i].capacity())
+                 * sizeof(float);
+    }
+    return bytes;
+}
+
+void mzSample::buildScanColumns()
+{
+    if (_scanColumns != nullptr) {
+        if (_scanColumns->scanCount() == scans.size())
+            return;
+        releaseScanColumns();
+    }
+
+    loadAllScanData();
+
+    lock_guard<mutex> lock(_scanDataMutex);
+    size_t peakCount = 0;
+    for (Scan* scan : scans)
+        peakCount += scan->mz.size();
+
+    ScanColumns* columns = new ScanColumns;
+    columns->blocks.reserve(scans.size());
+    columns->offsets.reserve(scans.size());
+    columns->peakCounts.reserve(scans.size());
+    columns->rt.reserve(scans.size());
+    columns->mslevel.reserve(scans.size());
+    columns->polarity.reserve(scans.size());
+
+    for (Scan* scan : scans) {
+        size_t nobs = scan->mz.size();
+        if (columns->mzBlocks.empty()
+            || columns->mzBlocks.back().size() + nobs
+                   > columns->mzBlocks.back().capacity()) {
+            size_t capacity = max(nobs,
+                                  min(ScanColumns::blockSize, peakCount));
+            columns->mzBlocks.emplace_back();
+            columns->mzBlocks.back().reserve(capacity);
+            columns->intensityBlocks.emplace_back();
+            columns->intensityBlocks.back().reserve(capacity);
+        }
+        vector<float>& mzBlock = columns->mzBlocks.back();
+        vector<float>& intensityBlock = columns->intensityBlocks.back();
+        columns->blocks.push_back(columns->mzBlocks.size() - 1);
+        columns->offsets.push_back(mzBlock.size());
+        columns->peakCounts.push_back(nobs);
+        mzBlock.insert(mzBlock.end(), scan->mz.begin(), scan->mz.end());
+        intensityBlock.insert(intensityBlock.end(),
+                              scan->intensity.begin(),
+                              scan->intensity.end());
+        columns->rt.push_back(scan->rt);
+        columns->mslevel.push_back(scan->mslevel);
+        columns->polarity.push_back(scan->getPolarity());
+        peakCount -= nobs;
+
+        // the scan gives up its arrays, so that the peaks are only held once
+        if (scan->isDataLoaded()) {
+            vector<float>().swap(scan->mz);
+            vector<float>().swap(scan->intensity);
+            scan->setDataState(Scan::DataState::InColumns);
+        }
+    }
+
+    _scanColumns = columns;
+}
+
+void mzSample::restoreScanFromColumns(Scan* scan)
+{
+    if (scan->dataState() != Scan::DataState::InColumns)
+        return;
+
+    size_t i = scan->scannum;
+    if (i >= scans.size() || scans[i] != scan)
+        i = find(scans.begin(), scans.end(), scan) - scans.begin();
+
+    const float* mz = _scanColumns->mz(i);
+    const float* intensity = _scanColumns->intensity(i);
+    size_t nobs = _scanColumns->nobs(i);
+    scan->mz.assign(mz, mz + nobs);
+    scan->intensity.assign(intensity, intensity + nobs);
+    scan->setDataState(Scan::DataState::Loaded);
+}
+
+void mzSample::releaseScanColumns()
+{
+    if (_scanColumns == nullptr)
+        return;
+
+    // scans are refilled from the last block to the first, freeing every
+    // block once its scans have their arrays back
+    lock_guard<mutex> lock(_scanDataMutex);
+    for (size_t i = _scanColumns->scanCount(); i > 0; i--) {
+        if (i <= scans.size())
+            restoreScanFromColumns(scans[i - 1]);
+        unsigned int block = _scanColumns->blocks[i - 1];
+        if (i == 1 || _scanColumns->blocks[i - 2] != block) {
+            vector<float>().swap(_scanColumns->mzBlocks[block]);
+            vector<float>().swap(_scanColumns->intensityBlocks[block]);
+        }
+    }
+    delete _scanColumns;
+    _scanColumns = nullptr;
+}
+
+void mzSample::buildRtIndex()
+{
+    _msLevelScans.clear();
+    for (unsigned int i = 0; i < scans.size(); i++)
+        _msLevelScans[scans[i]->mslevel].push_back(i);
+    _rtIndexedScans = scans.size();
+}
+
+void mzSample::buildMzRtIndex()
+{
+    if (_mzRtIndexLimit == 0 || _mzRtIndex.load() != nullptr || scans.empty())
+        return;
+
+    // samples too large for the limit keep scanning their spectra
+    if (MzRtIndex::estimateMemory(this, 1) > _mzRtIndexLimit)
+        return;
+
+    _mzRtIndex = new MzRtIndex(this, 1);
+}
+
+const MzRtIndex* mzSample::mzRtIndex() const
+{
+    MzRtIndex* index = _mzRtIndex.load();
+    if (index == nullptr || index->sampleScanCount() != scans.size()
+        || _rtIndexedScans != scans.size())
+        return nullptr;
+    return index;
+}
+
+const vector<unsigned int>& mzSample::scansOfMsLevel(
+    int mslevel,
+    vector<unsigned int>& scratch) const
+{
+    if (_rtIndexedScans != scans.size()) {
+        scratch.clear();
+        for (unsigned int i = 0; i < scans.size(); i++) {
+            if (scans[i]->mslevel == mslevel)
+                scratch.push_back(i);
+        }
+        return scratch;
+    }
+
+    auto level = _msLevelScans.find(mslevel);
+    if (level == _msLevelScans.end()) {
+        scratch.clear();
+        return scratch;
     }
+    return level->second;
+}
+
+void mzSample::scansInRtRange(int mslevel,
+                              float rtmin,
+                              float rtmax,
+                              vector<unsigned int>& scratch,
+                              const unsigned int*& first,
+                              const unsigned int*& last) const
+{
+    const vector<unsigned int>& levelScans = scansOfMsLevel(mslevel, scratch);
+    const unsigned int* begin = levelScans.data();
+    const unsigned int* end = begin + levelScans.size();
+    first = lower_bound(begin,
+                        end,
+                        rtmin,
+                        [this](unsigned int pos, float rt) {
+                            return scans[pos]->rt < rt;
+                        });
+    last = upper_bound(first,
+                       end,
+                       rtmax,
+                       [this](float rt, unsigned int pos) {
+                           return rt < scans[pos]->rt;
+                       });
 }
 
 map<string, string> mzSample::mzML_cvParams(xml_node node)
@@ -680,49 +1272,9 @@ void mzSample::parseMzData(const char* filename)
     }
 }
 
-xml_node mzSample::getmzXMLSpectrumData(xml_document& doc, const char* filename)
-{
-    // parse_minimal has all options turned off. This option mask means
-    // that pugixml does not add declaration nodes, document type declaration
-    // nodes, PI nodes, CDATA sections and comments to the resulting tree and
-    // does not perform any conversion for input data, so theoretically it is
-    // the fastest mode
-    bool loadok = doc.load_file(filename, pugi::parse_minimal);
-
-    // Checking if the file can be loaded if it can be loaded
-    if (!loadok) {
-        cerr << "Failed to load " << filename << endl;
-        // returning an empty node
-        return xml_node();
-    }
-
-    //"msRun" is the first child of the parent child "mzXML"
-    xml_node spectrumstore = doc.first_child().child("msRun");
-
-    // Checking if the node is empty which means that msRun is not there
-    // but then it might have scan which contain the data
-    if (spectrumstore.empty()) {
-        // Getting the first child named "scan"
-        xml_node scan = doc.first_child().child("scan");
-        // If scan is not present then there is no data
-        // which means that there is no information in the
-        // mzXML file
-        if (!scan.empty()) {
-            spectrumstore = doc.first_child();
-        } else {
-            // if the above condition is not satisfied return a empty
-            // spectrumstore
-            cerr << "parseMzXML: can't find <msRun> or <scan> section" << endl;
-            return xml_node();
-        }
-    }
-    return spectrumstore;
-}
-
-void mzSample::setInstrumentSettigs(xml_document& doc, xml_node spectrumstore)
+void mzSample::setInstrumentSettigs(const xml_node& msInstrument)
 {
     // Getting the instrument related information
-    xml_node msInstrument = spectrumstore.child("msInstrument");
     if (!msInstrument.empty()) {
         xml_node msManufacturer = msInstrument.child("msManufacturer");
         xml_node msModel = msInstrument.child("msModel");
@@ -740,41 +1292,134 @@ void mzSample::setInstrumentSettigs(xml_document& doc, xml_node spectrumstore)
     }
 }
 
-void mzSample::parseMzXMLData(const xml_node& spectrumstore)
+bool mzSample::parseMzXMLData(const xml_node& scan, vector<Scan*>& parsed)
 {
-    // Iterate through spectrums
-    int scannum = 0;
-
-    for (xml_node scan = spectrumstore.child("scan"); scan;
-         scan = scan.next_sibling("scan")) {
-        scannum++;
-        if (strncasecmp(scan.name(), "scan", 4) == 0) {
-            parseMzXMLScan(scan, scannum);
-        }
+    // scans are numbered once they are added to the sample
+    bool peaksDecoded = true;
+    if (strncasecmp(scan.name(), "scan", 4) == 0) {
+        parsed.push_back(readMzXMLScan(scan, 0, peaksDecoded));
+    }
 
-        for (xml_node child = scan.first_child(); child;
-             child = child.next_sibling()) {
-            scannum++;
-            if (strncasecmp(child.name(), "scan", 4) == 0) {
-                parseMzXMLScan(child, scannum);
-            }
+    for (xml_node child = scan.first_child(); child && peaksDecoded;
+         child = child.next_sibling()) {
+        if (strncasecmp(child.name(), "scan", 4) == 0) {
+            parsed.push_back(readMzXMLScan(child, 0, peaksDecoded));
         }
     }
+    return peaksDecoded;
 }
 
 void mzSample::parseMzXML(const char* filename)
 {
-    xml_document doc;
+    // top level scans (along with the scans nested in them) are pulled out of
+    // the file one at a time, so that the whole document is never loaded in
+    // memory at once
+    XmlElementStream stream(filename, {"msInstrument", "scan"}, {"msRun"});
+    if (!stream.isOpen()) {
+        cerr << "Failed to load " << filename << endl;
+        throw MavenException(ErrorMsg::ParsemzXml);
+    }
 
-    xml_node spectrumstore = getmzXMLSpectrumData(doc, filename);
+    // parse_minimal has all options turned off. This option mask means
+    // that pugixml does not add declaration nodes, document type declaration
+    // nodes, PI nodes, CDATA sections and comments to the resulting tree and
+    // does not perform any conversion for input data, so theoretically it is
+    // the fastest mode
+    const unsigned int parse_options = parse_minimal;
 
-    if (!spectrumstore.empty()) {
-        // Setting the instrument related information
-        setInstrumentSettigs(doc, spectrumstore);
-        // parse mzXML information from the scan
-        parseMzXMLData(spectrumstore);
-    } else
+    // Top level scans are parsed and decoded by worker tasks while this
+    // thread carries on tokenizing the file. Decoded scans are added in file
+    // order whenever a batch completes, because addScan expects an MS1 scan
+    // to be added before the MS2 scans that follow it.
+    const size_t batchSize = 256;
+    vector<string> elements(batchSize);
+    vector<vector<Scan*> > decoded(batchSize);
+    vector<char> decodedOk(batchSize, 0);
+    size_t batchCount = 0;
+
+    bool parseFailed = false;
+    bool foundSpectrumStore = false;
+
+    auto addDecodedScans = [&]() {
+        for (size_t i = 0; i < batchCount; i++) {
+            if (!decodedOk[i])
+                parseFailed = true;
+            for (Scan* scan : decoded[i])
+                addScan(scan);
+            decoded[i].clear();
+        }
+        batchCount = 0;
+    };
+
+#pragma omp parallel default(shared)
+#pragma omp single
+    {
+        string name;
+        string markup;
+        while (!parseFailed && stream.next(name, markup)) {
+            if (name == "msRun") {
+                foundSpectrumStore = true;
+                continue;
+            }
+
+            if (name == "scan") {
+                // parse mzXML information from the scan
+                foundSpectrumStore = true;
+                size_t i = batchCount++;
+                elements[i].swap(markup);
+#pragma omp task firstprivate(i)
+                {
+                    xml_document doc;
+                    pugi::xml_parse_result parseResult =
+                        doc.load_buffer(elements[i].data(),
+                                        elements[i].size(),
+                                        parse_options);
+                    decodedOk[i] = parseResult.status
+                                       == pugi::xml_parse_status::status_ok
+                                   && parseMzXMLData(doc.first_child(),
+                                                     decoded[i]);
+                }
+
+                if (batchCount == batchSize) {
+#pragma omp taskwait
+                    addDecodedScans();
+                }
+                continue;
+            }
+
+            xml_document doc;
+            pugi::xml_parse_result parseResult =
+                doc.load_buffer(markup.data(), markup.size(), parse_options);
+            if (parseResult.status != pugi::xml_parse_status::status_ok) {
+                parseFailed = true;
+                continue;
+            }
+
+            if (name == "msInstrument") {
+                // Setting the instrument related information
+                setInstrumentSettigs(doc.first_child());
+            }
+        }
+        if (stream.truncated()) {
+            cerr << "parseMzXML: " << filename << " is truncated"
+                 << endl;
+            parseFailed = true;
+        }
+#pragma omp taskwait
+        addDecodedScans();
+    }
+
+    if (parseFailed) {
+        cerr << "Failed to load " << filename << endl;
         throw MavenException(ErrorMsg::ParsemzXml);
+    }
+
+    // if neither <msRun> nor <scan> is present there is no information in
+    // the mzXML file
+    if (!foundSpectrumStore) {
+        cerr << "parseMzXML: can't find <msRun> or <scan> section" << endl;
+        throw MavenException(ErrorMsg::ParsemzXml);
+    }
 }
 
 /**
@@ -830,17 +1475,18 @@ int mzSample::getPolarityFromfilterLine(string filterLine)
     return scanpolarity;
 }
 
-vector<float> mzSample::parsePeaksFromMzXML(const xml_node& scan)
+bool mzSample::parsePeaksFromMzXML(const xml_node& scan, vector<float>& mzint)
 {
     xml_node peaks = scan.child("peaks");
-    vector<float> mzint;
+    mzint.clear();
 
     if (!peaks.empty()) {
-        string b64String(peaks.child_value());
+        const char* b64String = peaks.child_value();
+        size_t b64Length = strlen(b64String);
 
         // no m/z intensity values
-        if (b64String.empty())
-            return mzint;
+        if (b64Length == 0)
+            return true;
 
         // if the data is been compressed in zlib format this part will
         // take care.
@@ -869,13 +1515,15 @@ vector<float> mzSample::parsePeaksFromMzXML(const xml_node& scan)
         // << " precMz=" << precursorMz << " polar=" << scanpolarity
         //    << " prec=" << precision << endl;
 
-        mzint = base64::decodeBase64(
-            b64String, precision / 8, networkorder, decompress);
-
-        return mzint;
+        return base64::decodeBase64(b64String,
+                                    b64Length,
+                                    precision / 8,
+                                    networkorder,
+                                    decompress,
+                                    mzint);
     }
 
-    return mzint;
+    return true;
 }
 
 void mzSample::populateMzAndIntensity(const vector<float>& mzint, Scan* _scan)
@@ -915,6 +1563,17 @@ void mzSample::populateFilterline(const string& filterLine, Scan* _scan)
 }
 
 void mzSample::parseMzXMLScan(const xml_node& scan, const int& scannum)
+{
+    bool peaksDecoded = true;
+    Scan* parsed = readMzXMLScan(scan, scannum, peaksDecoded);
+    if (!peaksDecoded)
+        throw MavenException(ErrorMsg::ParsemzXml);
+    addScan(parsed);
+}
+
+Scan* mzSample::readMzXMLScan(const xml_node& scan,
+                              int scannum,
+                              bool& peaksDecoded)
 {
     float rt = 0.0, precursorMz = 0.0f, productMz = 0, collisionEnergy = 0;
     int scanpolarity = 0, msLevel = 1;
@@ -962,9 +1621,14 @@ void mzSample::parseMzXMLScan(const xml_node& scan, const int& scannum)
     }
 
     // no m/z intensity values
-    mzint = parsePeaksFromMzXML(scan);
+    peaksDecoded = parsePeaksFromMzXML(scan, mzint);
+    if (!peaksDecoded) {
+        cerr << "Failed to decompress the peaks of scan "
+             << scan.attribute("num").value() << " in " << fileName << endl;
+        return nullptr;
+    }
     if (mzint.empty()) {
-        return;
+        return nullptr;
     }
 
     Scan* _scan =
@@ -999,7 +1663,7 @@ void mzSample::parseMzXMLScan(const xml_node& scan, const int& scannum)
 
     populateFilterline(filterLine, _scan);
 
-    addScan(_scan);
+    return _scan;
 }
 
 void mzSample::summary()
@@ -1029,6 +1693,8 @@ void mzSample::calculateMzRtRange()
     unsigned int numOfScans = scans.size();
     for (unsigned int j = 0; j < numOfScans; j++) {
         Scan* currentScan = scans[j];
+        if (!currentScan->isDataLoaded())
+            continue;
         unsigned int mzSize = currentScan->mz.size();
         for (unsigned int i = 0; i < mzSize; i++) {
             float intensity = currentScan->intensity[i];
@@ -1045,6 +1711,17 @@ void mzSample::calculateMzRtRange()
             nobs++;
         }
     }
+
+    // scans whose arrays have not been decoded yet contribute the summary
+    // values recorded in their spectrum metadata
+    if (!_lazySourceFile.empty()) {
+        minMz = min(minMz, _lazyMinMz);
+        maxMz = max(maxMz, _lazyMaxMz);
+        maxIntensity = max(maxIntensity, _lazyMaxIntensity);
+        minIntensity = min(minIntensity, 0.0f);
+        totalIntensity += _lazyTotalIntensity;
+    }
+
     //sanity check
     if (minRt <= 0)
         minRt = 0;
@@ -1139,6 +1816,7 @@ EIC* mzSample::getEIC(float precursorMz,
         // if (collisionEnergy && abs(scan->collisionEnergy-collisionEnergy) >
         // 0.5) continue;
 
+        scan->loadData();
         float eicMz = 0;
         float eicIntensity = 0;
 
@@ -1255,6 +1933,7 @@ EIC* mzSample::getEIC(string srm, int eicType)
         vector<int> srmscans = srmScans[srm];
         for (unsigned int i = 0; i < srmscans.size(); i++) {
             Scan* scan = scans[srmscans[i]];
+            scan->loadData();
             float eicMz = 0;
             float eicIntensity = 0;
 
@@ -1354,7 +2033,7 @@ EIC* mzSample::getEIC(float mzmin,
     if (mzmax > this->maxMz && this->maxMz > mzmin)
         mzmax = this->maxMz;
 
-    EIC* e = new EIC();
+    EIC* e = EICPool::acquire();
     e->sampleName = sampleName;
     e->sample = this;
     e->mzmin = mzmin;
@@ -1391,6 +2070,193 @@ EIC* mzSample::getEIC(float mzmin,
     return (e);
 }
 
+vector<EIC*> mzSample::getEICs(const vector<mzSlice*>& slices,
+                              int mslevel,
+                              int eicType,
+                              string filterline)
+{
+    // search window of a slice, clamped to the sample like getEIC does, and
+    // the range of scans that can fall into it
+    struct SliceWindow {
+        float mzmin;
+        float mzmax;
+        float rtmin;
+        float rtmax;
+        size_t firstScan;
+        size_t lastScan;
+        EIC* eic;
+    };
+
+    vector<EIC*> eics;
+    eics.reserve(slices.size());
+    vector<SliceWindow> windows;
+    windows.reserve(slices.size());
+    vector<EIC*> extracted;
+    extracted.reserve(slices.size());
+
+    // windows refer to the scans of the MS level by their rank in this view
+    vector<unsigned int> scratch;
+    const vector<unsigned int>& levelScans = scansOfMsLevel(mslevel, scratch);
+    const unsigned int* levelBegin = levelScans.data();
+    const unsigned int* levelEnd = levelBegin + levelScans.size();
+    auto scanBeforeRt = [this](unsigned int pos, float rt) {
+        return scans[pos]->rt < rt;
+    };
+    auto rtBeforeScan = [this](float rt, unsigned int pos) {
+        return rt < scans[pos]->rt;
+    };
+
+    for (mzSlice* slice : slices) {
+        SliceWindow window;
+        window.mzmin = slice->mzmin;
+        window.mzmax = slice->mzmax;
+        window.rtmin = slice->rtmin;
+        window.rtmax = slice->rtmax;
+
+        if (window.rtmin < this->minRt)
+            window.rtmin = this->minRt;
+        if (window.rtmax > this->maxRt && this->maxRt > window.rtmin)
+            window.rtmax = this->maxRt;
+        if (window.mzmin < this->minMz)
+            window.mzmin = this->minMz;
+        if (window.mzmax > this->maxMz && this->maxMz > window.mzmin)
+            window.mzmax = this->maxMz;
+
+        EIC* e = EICPool::acquire();
+        e->sampleName = sampleName;
+        e->sample = this;
+        e->mzmin = window.mzmin;
+        e->mzmax = window.mzmax;
+        e->totalIntensity = 0;
+        e->maxIntensity = 0;
+        eics.push_back(e);
+
+        if (scans.empty())
+            continue;
+
+        if (window.mzmin < minMz && window.mzmax < maxMz) {
+            cerr << "getEICs(): mzmin and mzmax are out of range" << endl;
+            continue;
+        }
+
+        if (scans.back()->rt < float(window.rtmin - 0.1))
+            continue;
+
+        const unsigned int* first = lower_bound(levelBegin,
+                                                levelEnd,
+                                                window.rtmin,
+                                                scanBeforeRt);
+        const unsigned int* last = upper_bound(first,
+                                               levelEnd,
+                                               window.rtmax,
+                                               rtBeforeScan);
+        window.firstScan = first - levelBegin;
+        window.lastScan = last - levelBegin;
+        window.eic = e;
+        e->scannum.reserve(window.lastScan - window.firstScan);
+        e->rt.reserve(window.lastScan - window.firstScan);
+        e->intensity.reserve(window.lastScan - window.firstScan);
+        e->mz.reserve(window.lastScan - window.firstScan);
+        windows.push_back(window);
+        extracted.push_back(e);
+    }
+
+    // windows are kept in m/z order, and the scans they cover are entered
+    // in order of their first scan
+    stable_sort(windows.begin(),
+                windows.end(),
+                [](const SliceWindow& a, const SliceWindow& b) {
+                    return a.mzmin < b.mzmin;
+                });
+    vector<size_t> byFirstScan(windows.size());
+    for (size_t i = 0; i < windows.size(); i++)
+        byFirstScan[i] = i;
+    stable_sort(byFirstScan.begin(),
+                byFirstScan.end(),
+                [&windows](size_t a, size_t b) {
+                    return windows[a].firstScan < windows[b].firstScan;
+                });
+
+    const ScanColumns* columns = _scanColumns;
+    if (columns != nullptr && columns->scanCount() != scans.size())
+        columns = nullptr;
+
+    vector<size_t> active;
+    size_t entered = 0;
+    size_t scanIndex = 0;
+    while (entered < byFirstScan.size() || !active.empty()) {
+        if (active.empty())
+            scanIndex = windows[byFirstScan[entered]].firstScan;
+
+        size_t activeCount = active.size();
+        while (entered < byFirstScan.size()
+               && windows[byFirstScan[entered]].firstScan == scanIndex) {
+            active.push_back(byFirstScan[entered++]);
+        }
+        if (active.size() > activeCount) {
+            sort(active.begin() + activeCount, active.end());
+            inplace_merge(active.begin(),
+                          active.begin() + activeCount,
+                          active.end());
+        }
+        active.erase(remove_if(active.begin(),
+                               active.end(),
+                               [&windows, scanIndex](size_t w) {
+                                   return windows[w].lastScan <= scanIndex;
+                               }),
+                     active.end());
+        if (active.empty())
+            continue;
+
+        int scanNum = levelScans[scanIndex++];
+        Scan* scan = scans[scanNum];
+        if (!(filterline == "" || scan->filterLine == filterline))
+            continue;
+
+        const float *mzBegin, *mzEnd, *intensities;
+        float scanRt;
+        if (columns != nullptr) {
+            scanRt = columns->rt[scanNum];
+            mzBegin = columns->mz(scanNum);
+            mzEnd = mzBegin + columns->nobs(scanNum);
+            intensities = columns->intensity(scanNum);
+        } else {
+            scanRt = scan->rt;
+            scan->loadData();
+            mzBegin = scan->mz.data();
+            mzEnd = mzBegin + scan->nobs();
+            intensities = scan->intensity.data();
+        }
+
+        const float* mzItr = mzBegin;
+        for (size_t w : active) {
+            const SliceWindow& window = windows[w];
+            if (scanRt < window.rtmin || scanRt > window.rtmax)
+                continue;
+
+            float eicMz, eicIntensity;
+            mzItr = lower_bound(mzItr, mzEnd, window.mzmin);
+            EIC::reduceScanPeaks(mzItr,
+                                 mzEnd,
+                                 intensities + (mzItr - mzBegin),
+                                 window.mzmin,
+                                 window.mzmax,
+                                 eicType,
+                                 eicMz,
+                                 eicIntensity);
+            window.eic->addScanPoint(scanNum, scanRt, eicMz, eicIntensity);
+        }
+    }
+
+    float scale = getNormalizationConstant();
+    for (EIC* e : extracted) {
+        e->getRTMinMaxPerScan();
+        e->normalizeIntensityPerScan(scale);
+    }
+
+    return eics;
+}
+
 EIC* mzSample::getTIC(float rtmin, float rtmax, int mslevel)
 {
     // TODO naman unused function
@@ -1416,20 +2282,20 @@ EIC* mzSample::getTIC(float rtmin, float rtmax, int mslevel)
     if (scanCount == 0)
         return e;
 
-    for (int i = 0; i < scanCount; i++) {
-        if (scans[i]->mslevel == mslevel) {
-            Scan* scan = scans[i];
-            float y = scan->totalIntensity();
-            e->mz.push_back(0);
-            e->scannum.push_back(i);
-            e->rt.push_back(scan->rt);
-            e->intensity.push_back(y);
-            e->totalIntensity += y;
-            if (y > e->maxIntensity) {
-                e->maxIntensity = y;
-                e->rtAtMaxIntensity = scan->rt;
-                e->mzAtMaxIntensity = 0;
-            }
+    vector<unsigned int> scratch;
+    for (unsigned int i : scansOfMsLevel(mslevel, scratch)) {
+        Scan* scan = scans[i];
+        scan->loadData();
+        float y = scan->totalIntensity();
+        e->mz.push_back(0);
+        e->scannum.push_back(i);
+        e->rt.push_back(scan->rt);
+        e->intensity.push_back(y);
+        e->totalIntensity += y;
+        if (y > e->maxIntensity) {
+            e->maxIntensity = y;
+            e->rtAtMaxIntensity = scan->rt;
+            e->mzAtMaxIntensity = 0;
         }
     }
     if (e->rt.size() > 0) {
@@ -1463,28 +2329,28 @@ EIC* mzSample::getBIC(float rtmin, float rtmax, int mslevel)
     if (scanCount == 0)
         return e;
 
-    for (int i = 0; i < scanCount; i++) {
-        if (scans[i]->mslevel == mslevel) {
-            Scan* scan = scans[i];
-            float maxMz = 0;
-            float maxIntensity = 0;
-            for (unsigned int i = 0; i < scan->intensity.size(); i++) {
-                if (scan->intensity[i] > maxIntensity) {
-                    maxIntensity = scan->intensity[i];
-                    maxMz = scan->mz[i];
-                }
-            }
-            e->mz.push_back(maxMz);
-            e->scannum.push_back(i);
-            e->rt.push_back(scan->rt);
-            e->intensity.push_back(maxIntensity);
-            e->totalIntensity += maxIntensity;
-            if (maxIntensity > e->maxIntensity) {
-                e->maxIntensity = maxIntensity;
-                e->rtAtMaxIntensity = scan->rt;
-                e->mzAtMaxIntensity = maxMz;
+    vector<unsigned int> scratch;
+    for (unsigned int i : scansOfMsLevel(mslevel, scratch)) {
+        Scan* scan = scans[i];
+        scan->loadData();
+        float maxMz = 0;
+        float maxIntensity = 0;
+        for (unsigned int k = 0; k < scan->intensity.size(); k++) {
+            if (scan->intensity[k] > maxIntensity) {
+                maxIntensity = scan->intensity[k];
+                maxMz = scan->mz[k];
             }
         }
+        e->mz.push_back(maxMz);
+        e->scannum.push_back(i);
+        e->rt.push_back(scan->rt);
+        e->intensity.push_back(maxIntensity);
+        e->totalIntensity += maxIntensity;
+        if (maxIntensity > e->maxIntensity) {
+            e->maxIntensity = maxIntensity;
+            e->rtAtMaxIntensity = scan->rt;
+            e->mzAtMaxIntensity = maxMz;
+        }
     }
     if (e->rt.size() > 0) {
         e->rtmin = e->rt[0];
@@ -1508,10 +2374,10 @@ float mzSample::correlation(float mz1,
     EIC* e1 = mzSample::getEIC(
         mz1 - ppm1, mz1 + ppm1, rt1, rt2, mslevel, eicType, filterline);
     EIC* e2 = mzSample::getEIC(
-        mz2 - ppm2, mz2 + ppm1, rt1, rt2, mslevel, eicType, filterline);
+        mz2 - ppm2, mz2 + ppm2, rt1, rt2, mslevel, eicType, filterline);
     float correlation = mzUtils::correlation(e1->intensity, e2->intensity);
-    delete (e1);
-    delete (e2);
+    delete e1;
+    delete e2;
     return correlation;
 }
 
@@ -1758,6 +2624,7 @@ Scan* mzSample::getAverageScan(float rtmin,
             continue;
 
         Scan* scan = scans[s];
+        scan->loadData();
         scanCount++;
         for (unsigned int i = 0; i < scan->mz.size(); i++) {
             float bin = FLOATROUND(scan->mz[i], sd);
@@ -1809,15 +2676,29 @@ void mzSample::restorePreviousRetentionTimes()
 vector<Scan*> mzSample::getFragmentationEvents(mzSlice* slice)
 {
     vector<Scan*> matchedScans;
-    for (auto scan : scans) {
-        if (scan->mslevel != 2)
-            continue;  // ms2 + scans only
-        if (scan->rt < slice->rtmin)
-            continue;
-        if (scan->rt > slice->rtmax)
-            break;
+
+    // ms2 + scans only
+    vector<unsigned int> scratch;
+    const unsigned int *first, *last;
+    scansInRtRange(2, slice->rtmin, slice->rtmax, scratch, first, last);
+    for (; first != last; first++) {
+        Scan* scan = scans[*first];
+
+        // the precursor of a lazily loaded scan is only recalculated once it
+        // has been decoded, so scans it may still move into the slice are
+        // decoded before their precursor is compared
+        if (scan->dataState() == Scan::DataState::Pending) {
+            float shift = Scan::maxPrecursorShift(precursorPpm);
+            float margin = slice->mzmax * shift / 1e6;
+            if (scan->precursorMz < slice->mzmin - margin
+                || scan->precursorMz > slice->mzmax + margin)
+                continue;
+            scan->loadData();
+        }
+
         if (scan->precursorMz >= slice->mzmin
             && scan->precursorMz <= slice->mzmax) {
+            scan->loadData();
             matchedScans.push_back(scan);
         }
     }
@@ -1826,6 +2707,8 @@ vector<Scan*> mzSample::getFragmentationEvents(mzSlice* slice)
 
 vector<float> mzSample::getIntensityDistribution(int mslevel)
 {
+    loadAllScanData();
+
     vector<float> allintensities;
     for (unsigned int s = 0; s < this->scans.size(); s++) {
         Scan* scan = this->scans[s];
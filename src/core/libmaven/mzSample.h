@@ -4,6 +4,9 @@
 #include <chrono_io.h>
 #include <date.h>
 
+#include <atomic>
+#include <mutex>
+
 #include "assert.h"
 #include "mzUtils.h"
 #include "pugixml.hpp"
@@ -36,6 +39,8 @@ class Reaction;
 class MassCalculator;
 class MassCutoff;
 class ChargedSpecies;
+class XmlElementStream;
+class MzRtIndex;
 
 using namespace pugi;
 using namespace mzUtils;
@@ -172,6 +177,74 @@ class mzLink
     }
 };
 
+/**
+ * @brief Column-wise store of the peaks of every scan of a sample.
+ * @details Scans own their m/z and intensity arrays, so walking over a whole
+ * sample chases one pointer (and usually one cache miss) per scan and per
+ * array. Batch processing that streams over every data point reads these
+ * columns instead, where the peaks of consecutive scans are laid out back to
+ * back. Entry i of the per-scan columns belongs to mzSample::scans[i].
+ *
+ * The peaks are moved out of the scans rather than copied, so that a sample
+ * does not hold its data twice; a scan gets its arrays back when they are
+ * read through Scan::loadData, or when the columns are released. They are
+ * kept in blocks of whole scans so that releasing the columns can free them
+ * block by block as the scans are refilled.
+ *
+ * The retention times are a snapshot taken by mzSample::buildScanColumns and
+ * are not updated when scans change afterwards (e.g. when retention times
+ * are aligned); the columns are meant to live only for the duration of a
+ * batch job.
+ */
+struct ScanColumns
+{
+    /**
+     * @brief Number of peaks a block is sized for, unless a single scan has
+     * more.
+     */
+    static const size_t blockSize = 1 << 20;
+
+    vector<vector<float>> mzBlocks;
+    vector<vector<float>> intensityBlocks;
+    vector<unsigned int> blocks;  /**< block holding the peaks of each scan */
+    vector<size_t> offsets;       /**< first peak of each scan in its block */
+    vector<unsigned int> peakCounts;
+    vector<float> rt;
+    vector<int> mslevel;
+    vector<int> polarity;
+
+    /**
+     * @brief Number of scans covered by the columns.
+     */
+    size_t scanCount() const { return rt.size(); }
+
+    /**
+     * @brief Number of peaks of scan i.
+     */
+    size_t nobs(size_t i) const { return peakCounts[i]; }
+
+    /**
+     * @brief The m/z values of scan i, nobs(i) of them.
+     */
+    const float* mz(size_t i) const
+    {
+        return mzBlocks[blocks[i]].data() + offsets[i];
+    }
+
+    /**
+     * @brief The intensities of scan i, nobs(i) of them.
+     */
+    const float* intensity(size_t i) const
+    {
+        return intensityBlocks[blocks[i]].data() + offsets[i];
+    }
+
+    /**
+     * @brief Number of bytes held by the columns.
+     */
+    size_t memoryUsage() const;
+};
+
 /** 
 * @brief Parses input sample files and stores related metadata
 *
@@ -264,6 +337,19 @@ class mzSample
     */
     void parseMzMLChromatogramList(const xml_node&);
 
+    /**
+    * @brief Parse a single mzML chromatogram into SRM scans
+    * @param chromatogram xml_node object of pugixml library
+    * @param scannum Running scan number, advanced for every scan created
+    * @return False if the binary arrays could not be decoded
+    */
+    bool parseMzMLChromatogram(const xml_node& chromatogram, int& scannum);
+
+    /**
+    * @brief Sort scans by retention time and renumber them in that order
+    */
+    void renumberScansByRt();
+
 
     int getSampleNoChromatogram(const string &chromatogramId);
 
@@ -275,6 +361,151 @@ class mzSample
     */
     void parseMzMLSpectrumList(const xml_node&);
 
+    /**
+    * @brief Parse a single mzML spectrum and add it as a scan
+    * @param spectrum xml_node object of pugixml library
+    * @param scannum Running scan number, advanced for every scan created
+    */
+    void parseMzMLSpectrum(const xml_node& spectrum, int& scannum);
+
+    /**
+    * @brief Parse the markup of a single mzML spectrum and decode its binary
+    * arrays, without adding the result to the sample
+    * @details Does not modify the sample, so that spectra can be decoded on
+    * worker threads while the file is still being read.
+    * @param markup Complete markup of a spectrum element
+    * @param scan Set to the new scan, or null if the spectrum has no data
+    * @return False if the markup could not be parsed or the binary arrays
+    * could not be decoded
+    */
+    bool decodeMzMLSpectrum(const string& markup, Scan*& scan);
+
+    /**
+    * @brief Create a scan from the metadata of an mzML spectrum (ms level,
+    * polarity, rt, precursor and filter line), without its binary arrays
+    * @param spectrum xml_node object of pugixml library
+    * @param scannum Scan number of the new scan
+    * @return Newly allocated scan
+    */
+    Scan* parseMzMLSpectrumHeader(const xml_node& spectrum, int scannum);
+
+    /**
+    * @brief Decode the m/z and intensity arrays of an mzML spectrum into a scan
+    * @param binaryDataArrayList xml_node object of pugixml library
+    * @param scan Scan to fill
+    * @return False if an array could not be decompressed
+    */
+    bool parseMzMLBinaryDataArrays(const xml_node& binaryDataArrayList,
+                                   Scan* scan);
+
+    /**
+    * @brief Enable or disable lazy loading of indexed mzML files
+    * @details With lazy loading, only the offset index and the metadata of
+    * every spectrum are read when the sample is loaded. The m/z and
+    * intensity arrays of a scan are decoded the first time the scan is used
+    * (see Scan::loadData), which makes opening large projects for browsing
+    * near-instant. Files without a usable index are loaded in full.
+    * @param lazy True to enable lazy loading
+    */
+    void setLazyLoading(bool lazy) { _lazyLoading = lazy; }
+
+    /**
+    * @brief Enable or disable the binary sample cache
+    * @details With caching, a sample that has been parsed from its source
+    * file is also saved to "<filename>.emcache" (see SampleCache), and later
+    * loads read that file instead of parsing the source again. Caching takes
+    * precedence over lazy loading, since a cache can only be written once all
+    * scans have been decoded.
+    * @param caching True to read and write the cache
+    */
+    void setSampleCaching(bool caching) { _sampleCaching = caching; }
+
+    /**
+    * @brief Set the memory an m/z-rt index of the MS1 scans may take
+    * @details When a sample has been loaded (or all its lazily loaded scans
+    * decoded), its MS1 data points are indexed by m/z (see MzRtIndex) if
+    * the index fits within the limit, and EICs are then pulled from the
+    * index rather than by searching every scan.
+    * @param maxBytes Memory limit in bytes, 0 to disable the index
+    */
+    void setMzRtIndexLimit(size_t maxBytes) { _mzRtIndexLimit = maxBytes; }
+
+    /**
+    * @brief Index built for the current scans of the sample, or null if
+    * there is none.
+    */
+    const MzRtIndex* mzRtIndex() const;
+
+    /**
+    * @brief Decode the m/z and intensity arrays of a lazily loaded scan, or
+    * copy them back from the columns of the sample. Does nothing if the scan
+    * has already been loaded.
+    * @param scan Scan belonging to this sample
+    */
+    void loadScanData(Scan* scan);
+
+    /**
+    * @brief Decode (or copy back from the columns) the arrays of all scans
+    * that have not been loaded yet.
+    * @details Batch processing (e.g. peak detection) walks over every data
+    * point of a sample and should call this first, so that scans are decoded
+    * in file order rather than one at a time.
+    */
+    void loadAllScanData();
+
+    /**
+    * @brief Move the peaks of all scans into contiguous columns (see
+    * ScanColumns), decoding lazily loaded scans first.
+    * @details The scans are left InColumns, without arrays of their own,
+    * until they are loaded again or releaseScanColumns is called. Does
+    * nothing if the columns are already built and cover every scan.
+    */
+    void buildScanColumns();
+
+    /**
+    * @brief Hand the peaks held by the columns back to their scans and free
+    * the columns built by buildScanColumns.
+    */
+    void releaseScanColumns();
+
+    /**
+    * @brief Columns built by buildScanColumns, or null if there are none.
+    */
+    const ScanColumns* scanColumns() const { return _scanColumns; }
+
+    /**
+    * @brief Index the scans of every MS level for lookups by retention time.
+    * @details Called once a sample has been loaded. The index only stores
+    * the positions of the scans of each MS level and reads retention times
+    * from the scans, so it stays valid when they are aligned, as long as
+    * scans stay in retention time order. It no longer applies once scans are
+    * added or removed, in which case lookups walk over all scans.
+    */
+    void buildRtIndex();
+
+    /**
+    * @brief Positions (in scans) of the scans of an MS level, in scan order.
+    * @param scratch Filled with the positions and returned instead of the
+    * index, if the index does not cover the current scans
+    */
+    const vector<unsigned int>& scansOfMsLevel(
+        int mslevel,
+        vector<unsigned int>& scratch) const;
+
+    /**
+    * @brief Positions of the scans of an MS level with retention time within
+    * [rtmin, rtmax], found by binary search.
+    * @param scratch See scansOfMsLevel
+    * @param first Set to the first position in range
+    * @param last Set past the last position in range
+    */
+    void scansInRtRange(int mslevel,
+                        float rtmin,
+                        float rtmax,
+                        vector<unsigned int>& scratch,
+                        const unsigned int*& first,
+                        const unsigned int*& last) const;
+
     /**
     * @brief Print info about sample 
     * @details Print data of sample: 1. Number of observations 2. rt range
@@ -368,6 +599,21 @@ class mzSample
     */
     EIC *getEIC(float mzmin, float mzmax, float rtmin, float rtmax, int mslevel, int eicType, string filterline);
 
+    /**
+    * @brief Get the EICs of many m/z-rt slices in a single pass over the scans
+    * @details Equivalent to calling getEIC(mzmin, mzmax, rtmin, rtmax, ...)
+    * for every slice, but each scan is visited once for all slices whose
+    * retention time window covers it. Within a scan, slices are handled in
+    * order of m/z so that the peak lookups move forward through the scan.
+    * @param slices Slices to extract, only their m/z and rt bounds are used
+    * @param mslevel MS Level. MS Level is 1 for MS data and 2 for MS/MS data
+    * @param eicType Type of EIC (max or sum)
+    * @param filterline selected filterline
+    * @return One new EIC per slice, in the order of the slices
+    * @see EIC
+    */
+    vector<EIC*> getEICs(const vector<mzSlice*>& slices, int mslevel, int eicType, string filterline);
+
     /**
     * @brief Get EIC based on srmId
     * @param srmId Filterline
@@ -701,6 +947,8 @@ class mzSample
     vector<double> polynomialAlignmentTransformation; //parameters for polynomial transform
 
   private:
+    friend class SampleCache;
+
     int _id;
     unsigned int _numMS1Scans;
     unsigned int _numMS2Scans;
@@ -708,11 +956,28 @@ class mzSample
     void sampleNaming(const char *filename);
     void checkSampleBlank(const char *filename);
 
-    void setInstrumentSettigs(xml_document &doc, xml_node spectrumstore);
+    void setInstrumentSettigs(const xml_node& msInstrument);
 
-    void parseMzXMLData(const xml_node& spectrumstore);
+    /**
+     * @brief Parse a top level mzXML scan along with the scans nested in it.
+     * @details Does not modify the sample, so that top level scans can be
+     * parsed concurrently. The caller adds the returned scans in order.
+     * @param scan xml_node object of pugixml library
+     * @param parsed Scans read from the node, in document order. Null
+     * entries stand for scans without any peaks.
+     * @return False if the peaks of a scan could not be decoded
+     */
+    bool parseMzXMLData(const xml_node& scan, vector<Scan*>& parsed);
 
-    xml_node getmzXMLSpectrumData(xml_document &doc, const char *filename);
+    /**
+     * @brief Create a scan, along with its peaks, from an mzXML scan node
+     * without adding it to the sample.
+     * @param peaksDecoded Set to false if the peaks could not be decoded
+     * @return Newly allocated scan or null if the scan has no peaks.
+     */
+    Scan* readMzXMLScan(const xml_node& scan,
+                        int scannum,
+                        bool& peaksDecoded);
 
     float parseRTFromMzXML(xml_attribute &attr);
 
@@ -720,12 +985,76 @@ class mzSample
 
     static int getPolarityFromfilterLine(string filterLine);
 
-    vector<float> parsePeaksFromMzXML(const xml_node &scan);
+    /**
+     * @brief Decode the interleaved m/z and intensity values of an mzXML scan
+     * @return False if the peaks could not be decompressed
+     */
+    bool parsePeaksFromMzXML(const xml_node &scan, vector<float>& mzint);
 
     void populateMzAndIntensity(const vector<float>& mzint, Scan *_scan);
 
     void populateFilterline(const string& filterLine, Scan *_scan);
 
+    /**
+     * @brief Apply the global centroiding and intensity filters to the
+     * arrays of a scan.
+     */
+    void filterScanData(Scan *s);
+
+    /**
+     * @brief Read the spectrum offsets from the index of an indexedmzML file.
+     * @return Byte offsets of spectra, empty if the file has no index.
+     */
+    static vector<streamoff> readMzMLSpectrumOffsets(const char *filename);
+
+    /**
+     * @brief Create scans for an indexedmzML file from spectrum metadata
+     * only, leaving their arrays to be decoded on demand.
+     * @return False if the file cannot be loaded lazily, in which case
+     * nothing has been added to the sample.
+     */
+    bool parseIndexedMzML(const char *filename);
+
+    /**
+     * @brief Decode the arrays of a lazily loaded scan, marking it as Loaded
+     * or Failed. Does nothing for scans that are not Pending. Caller must
+     * hold _scanDataMutex.
+     */
+    void decodeLazyScan(Scan *scan);
+
+    /**
+     * @brief Copy the arrays of a scan back from the columns, marking it as
+     * Loaded. Does nothing for scans that are not InColumns. Caller must
+     * hold _scanDataMutex.
+     */
+    void restoreScanFromColumns(Scan *scan);
+
+    bool _lazyLoading;
+    bool _sampleCaching;
+    string _lazySourceFile;
+    XmlElementStream *_lazyStream;
+    mutex _scanDataMutex;
+    ScanColumns *_scanColumns;
+
+    size_t _mzRtIndexLimit;
+    atomic<MzRtIndex*> _mzRtIndex;
+
+    /**
+     * @brief Build the m/z-rt index of the MS1 scans, if enabled and within
+     * the memory limit. Scans must have been decoded.
+     */
+    void buildMzRtIndex();
+
+    // positions of the scans of each MS level, see buildRtIndex
+    map<int, vector<unsigned int>> _msLevelScans;
+    size_t _rtIndexedScans;
+
+    // m/z and intensity summaries of lazily loaded spectra
+    float _lazyMinMz;
+    float _lazyMaxMz;
+    float _lazyMaxIntensity;
+    float _lazyTotalIntensity;
+
     void loadAnySample(const char *filename);
 
     //TODO: This should be moved
@@ -7,6 +7,7 @@
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/zlib.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
+#include <mutex>
 
 /**
  * random collection of useful functions 
@@ -125,15 +126,30 @@ namespace mzUtils {
         return result;
     }
 
-    void smoothAverage(float *y, float* s, int smoothWindowLen, int ly) {
+    /**
+     * @brief Filter of a moving average over `smoothWindowLen` points, built
+     * once per window length and shared by all threads.
+     */
+    static const vector<float>& averageFilter(int smoothWindowLen) {
+        static map<int, vector<float>> filters;
+        static mutex filtersMutex;
+
+        lock_guard<mutex> lock(filtersMutex);
+        vector<float>& x = filters[smoothWindowLen];
+        if (x.empty()) {
+            x.resize(smoothWindowLen);
+            for(int i=0; i< smoothWindowLen; i++ ) x[i] = 1.0/smoothWindowLen;
+        }
+        return x;
+    }
+
+    void smoothAverage(const float *y, float* s, int smoothWindowLen, int ly) {
         if (smoothWindowLen == 0 ) return;
-        float* x = new float[smoothWindowLen];
-        for(int i=0; i< smoothWindowLen; i++ ) x[i] = 1.0/smoothWindowLen;
-        conv(smoothWindowLen,-smoothWindowLen/2,x,ly, 0,y,ly,0,s);
-        delete[] x;
+        const vector<float>& x = averageFilter(smoothWindowLen);
+        conv(smoothWindowLen,-smoothWindowLen/2,x.data(),ly, 0,y,ly,0,s);
     }
 
-    void conv (int lx, int ifx, float *x, int ly, int ify, float *y, int lz, int ifz, float *z) /*****************************************************************************
+    void conv (int lx, int ifx, const float *x, int ly, int ify, const float *y, int lz, int ifz, float *z) /*****************************************************************************
                                                                                                   Compute z = x convolved with y; i.e.,
 
                                                                                                   ifx+lx-1
@@ -173,17 +189,62 @@ namespace mzUtils {
                                                                                                  Author:  Dave Hale, Colorado School of Mines, 11/23/91
                                                                                                  *****************************************************************************/
     {
-        int ilx=ifx+lx-1,ily=ify+ly-1,ilz=ifz+lz-1,i,j,jlow,jhigh;
-        float sum;
+        int ilx=ifx+lx-1,ily=ify+ly-1,ilz=ifz+lz-1,i,j,ilow,ihigh;
 
         x -= ifx;  y -= ify;  z -= ifz;
-        for (i=ifz; i<=ilz; ++i) {
-            jlow = i-ily;  if (jlow<ifx) jlow = ifx;
-            jhigh = i-ify;  if (jhigh>ilx) jhigh = ilx;
-            for (j=jlow,sum=0.0; j<=jhigh; ++j)
-                sum += x[j]*y[i-j];
-            z[i] = sum;
+        for (i=ifz; i<=ilz; ++i)
+            z[i] = 0.0;
+
+        /* add one x sample at a time to every z it contributes to; the inner
+           loop vectorizes while every z still sums over j in order */
+        for (j=ifx; j<=ilx; ++j) {
+            ilow = j+ify;  if (ilow<ifz) ilow = ifz;
+            ihigh = j+ily;  if (ihigh>ilz) ihigh = ilz;
+            const float xj = x[j];
+            const float* yj = y-j;
+#pragma omp simd
+            for (i=ilow; i<=ihigh; ++i)
+                z[i] += xj*yj[i];
+        }
+    }
+
+    /**
+     * @brief Gaussian filter used by `gaussian1d_smoothing` for a cutoff
+     * `fcut`, built once per cutoff and shared by all threads.
+     */
+    static const vector<float>& gaussianFilter(float fcut) {
+        static map<float, vector<float>> filters;
+        static mutex filtersMutex;
+
+        lock_guard<mutex> lock(filtersMutex);
+        vector<float>& s = filters[fcut];
+        if (s.empty()) {
+            int is;
+            float r;
+            float sum=0.0;
+
+            /* set span of 3, at width of 1.5*exp(-PI*1.5**2)=1/1174 */
+            int n=(int) (3.0/fcut+0.5);
+            n=2*n/2+1;		/* make it odd for symmetry */
+            if (n<0) n=0;
+
+            /* mean is the index of the zero in the smoothing wavelet */
+            int mean=n/2;
+
+            /* s(n) is the smoothing gaussian */
+            s.resize(n);
+            for (is=1; is<=n; is++) {
+                r=is-mean-1;
+                r= -r*r*fcut*fcut*3.141;
+                s[is-1]=exp(r);
+            }
+
+            /* normalize to unit area, will preserve DC frequency at full
+               amplitude. Frequency at fcut will be half amplitude */
+            for (is=0; is<n; is++) sum +=s[is];
+            for (is=0; is<n; is++) s[is] /=sum;
         }
+        return s;
     }
 
     void gaussian1d_smoothing (int ns, int nsr, float *data)
@@ -203,13 +264,7 @@ data		1-D array[ns] of smoothed data
         int is;				/* loop counter */
         float sum=0.0;
         float fcut;
-        float r;
         float fcutr=1.0/nsr;
-        int n=0;
-        int mean=0;
-        float fcutl=0;
-        float s[1000];		/* smoothing filter array */
-        float *temp;			/* temporary array */
 
         /* save input fcut */
         fcut=fcutr;
@@ -220,35 +275,6 @@ data		1-D array[ns] of smoothed data
         /* if halfwidth more than 100 samples, truncate */
         if (nsr>100) fcut=1.0/100;
 
-        /* allocate space */
-        temp=new float[ns];
-
-
-        /* initialize smoothing function if not the same as the last one used */
-        if (fcut != fcutl) {
-            fcutl=fcut;
-
-            /* set span of 3, at width of 1.5*exp(-PI*1.5**2)=1/1174 */
-            n=(int) (3.0/fcut+0.5);
-            n=2*n/2+1;		/* make it odd for symmetry */
-
-            /* mean is the index of the zero in the smoothing wavelet */
-            mean=n/2;
-
-            /* s(n) is the smoothing gaussian */
-            for (is=1; is<=n; is++) {
-                r=is-mean-1;
-                r= -r*r*fcut*fcut*3.141;
-                s[is-1]=exp(r);
-            }
-
-            /* normalize to unit area, will preserve DC frequency at full
-               amplitude. Frequency at fcut will be half amplitude */
-            for (is=0; is<n; is++) sum +=s[is];
-            for (is=0; is<n; is++) s[is] /=sum;
-            //cerr << "new gaussian " << nsr << endl;
-        }
-
         /* convolve by gaussian into buffer */
         if (1.01/fcutr>(float)ns) {
 
@@ -260,15 +286,18 @@ data		1-D array[ns] of smoothed data
 
         } else {
 
+            /* smoothing filter, shared between calls with the same cutoff */
+            const vector<float>& s = gaussianFilter(fcut);
+            int n=s.size();
+            int mean=n/2;
+
             /* convolve with gaussian */
-            conv (n, -mean, s, ns, -mean, data, ns, -mean, temp);
+            vector<float> temp(ns);
+            conv (n, -mean, s.data(), ns, -mean, data, ns, -mean, temp.data());
 
             /* copy filtered data back to output array */
             for (is=0; is<ns; is++) data[is]=temp[is];
         }
-
-        /* free allocated space */
-        delete[] temp;
     }
 
     float median(vector <float> y) {
@@ -955,6 +984,37 @@ Series:  Prentice-Hall Series in Automatic Computation
         return outstring;
     }
 
+    bool decompressString(const char* data, size_t len, std::string& out)
+    {
+        out.clear();
+#ifdef ZLIB
+        z_stream strm;
+        strm.next_in = (Bytef*) data;
+        strm.avail_in = len;
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+        if (inflateInit(&strm) != Z_OK)
+            return false;
+
+        // peak lists usually compress to well under a third of their size
+        out.resize(std::max(out.capacity(), len * 4 + 64));
+        int status = Z_OK;
+        while (status == Z_OK) {
+            if (strm.total_out >= out.size())
+                out.resize(out.size() * 2);
+            strm.next_out = (Bytef*) &out[strm.total_out];
+            strm.avail_out = out.size() - strm.total_out;
+            status = inflate(&strm, Z_NO_FLUSH);
+        }
+        out.resize(strm.total_out);
+        inflateEnd(&strm);
+        return status == Z_STREAM_END;
+#else
+        return false;
+#endif
+    }
+
     bool gzipInflate( const std::string& compressedBytes, std::string& uncompressedBytes ) {
 #ifdef ZLIB
         if ( compressedBytes.size() == 0 ) {
@@ -169,7 +169,7 @@ namespace mzUtils {
      * @param  points        []
      * @param  n             []
      */
-    void smoothAverage(float* y, float* s, int points, int n);
+    void smoothAverage(const float* y, float* s, int points, int n);
 
     /**
      * [conv ]
@@ -184,7 +184,7 @@ namespace mzUtils {
      * @param  ifz  []
      * @param  z    []
      */
-    void conv(int lx, int ifx, float* x, int ly, int ify, float* y, int lz, int ifz,
+    void conv(int lx, int ifx, const float* x, int ly, int ify, const float* y, int lz, int ifz,
             float* z);  // convolutio
 
     /*statistical functions*/
@@ -430,6 +430,18 @@ namespace mzUtils {
      */
     std::string decompressString(const std::string& str);
 
+    /**
+     * @brief Inflate a zlib compressed buffer into `out`.
+     * @details Unlike the string returning overload, this calls into zlib
+     * directly and reuses whatever capacity `out` already has, so that a
+     * caller decoding many arrays can keep a single buffer around.
+     * @param data Pointer to the compressed bytes.
+     * @param len Number of compressed bytes.
+     * @param out Buffer that receives the uncompressed bytes.
+     * @return False if the data could not be inflated.
+     */
+    bool decompressString(const char* data, size_t len, std::string& out);
+
     /* rounding and ppm functions */
     /**
      * [ppmDist ]
@@ -0,0 +1,137 @@
+#include "mzrtindex.h"
+#include "EIC.h"
+#include "mzSample.h"
+#include "Scan.h"
+
+const float MzRtIndex::binWidth = 0.1f;
+
+size_t MzRtIndex::estimateMemory(const mzSample* sample, int mslevel)
+{
+    size_t points = 0;
+    for (Scan* scan : sample->scans) {
+        if (scan->mslevel == mslevel)
+            points += scan->nobs();
+    }
+    size_t bins = 1;
+    if (sample->maxMz > sample->minMz)
+        bins += static_cast<size_t>((sample->maxMz - sample->minMz) / binWidth);
+
+    return (bins + 1) * sizeof(uint32_t)
+           + points * (sizeof(uint32_t) + 2 * sizeof(float));
+}
+
+MzRtIndex::MzRtIndex(const mzSample* sample, int mslevel)
+{
+    _msLevel = mslevel;
+    _sampleScanCount = sample->scans.size();
+    _minMz = sample->minMz;
+
+    size_t bins = 1;
+    if (sample->maxMz > sample->minMz)
+        bins += static_cast<size_t>((sample->maxMz - sample->minMz) / binWidth);
+
+    vector<unsigned int> scratch;
+    const vector<unsigned int>& levelScans = sample->scansOfMsLevel(mslevel,
+                                                                    scratch);
+
+    // count the points of every bin, then fill the bins scan by scan so
+    // that postings are ordered by rank and, within a scan, by m/z
+    _binStart.assign(bins + 1, 0);
+    for (unsigned int pos : levelScans) {
+        for (float mz : sample->scans[pos]->mz)
+            _binStart[min(_bin(mz), bins - 1) + 1]++;
+    }
+    for (size_t b = 0; b < bins; b++)
+        _binStart[b + 1] += _binStart[b];
+
+    size_t points = _binStart[bins];
+    _rank.resize(points);
+    _mz.resize(points);
+    _intensity.resize(points);
+
+    vector<uint32_t> next(_binStart.begin(), _binStart.end() - 1);
+    for (size_t rank = 0; rank < levelScans.size(); rank++) {
+        Scan* scan = sample->scans[levelScans[rank]];
+        for (size_t i = 0; i < scan->nobs(); i++) {
+            uint32_t posting = next[min(_bin(scan->mz[i]), bins - 1)]++;
+            _rank[posting] = rank;
+            _mz[posting] = scan->mz[i];
+            _intensity[posting] = scan->intensity[i];
+        }
+    }
+}
+
+size_t MzRtIndex::memoryUsage() const
+{
+    return (_binStart.capacity() + _rank.capacity()) * sizeof(uint32_t)
+           + (_mz.capacity() + _intensity.capacity()) * sizeof(float);
+}
+
+size_t MzRtIndex::_bin(float mz) const
+{
+    if (mz <= _minMz)
+        return 0;
+    return static_cast<size_t>((mz - _minMz) / binWidth);
+}
+
+void MzRtIndex::reduceScans(float mzmin,
+                            float mzmax,
+                            size_t firstRank,
+                            size_t lastRank,
+                            int eicType,
+                            vector<float>& eicMz,
+                            vector<float>& eicIntensity) const
+{
+    size_t scanCount = lastRank > firstRank ? lastRank - firstRank : 0;
+    eicMz.assign(scanCount, 0.0f);
+    eicIntensity.assign(scanCount, 0.0f);
+    if (scanCount == 0)
+        return;
+
+    size_t bins = _binStart.size() - 1;
+    size_t firstBin = min(_bin(mzmin), bins - 1);
+    size_t lastBin = min(_bin(mzmax), bins - 1);
+    bool sum = (EIC::EicType)eicType == EIC::SUM;
+    vector<float> weights;
+    if (sum)
+        weights.assign(scanCount, 0.0f);
+
+    // bins are visited in m/z order, so the points of every scan are
+    // reduced in m/z order as well
+    for (size_t b = firstBin; b <= lastBin; b++) {
+        const uint32_t* rankBegin = _rank.data() + _binStart[b];
+        const uint32_t* rankEnd = _rank.data() + _binStart[b + 1];
+        const uint32_t* first = lower_bound(rankBegin, rankEnd, firstRank);
+        const uint32_t* last = lower_bound(first, rankEnd, lastRank);
+
+        for (const uint32_t* itr = first; itr != last; itr++) {
+            size_t posting = itr - _rank.data();
+            float mz = _mz[posting];
+            if (mz < mzmin || mz > mzmax)
+                continue;
+
+            size_t i = *itr - firstRank;
+            float intensity = _intensity[posting];
+            if (sum) {
+                eicIntensity[i] += intensity;
+                eicMz[i] += mz * intensity;
+                weights[i] += intensity;
+            } else if (intensity > eicIntensity[i]) {
+                eicIntensity[i] = intensity;
+                eicMz[i] = mz;
+            }
+        }
+    }
+
+    // like EIC::reduceScanPeaks, leave the m/z of a scan without points in
+    // range undefined (0 / 0)
+    if (sum) {
+        for (size_t i = 0; i < scanCount; i++) {
+            if (weights[i] > 0.0f) {
+                eicMz[i] /= weights[i];
+            } else {
+                eicMz[i] = numeric_limits<float>::quiet_NaN();
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef MZRTINDEX_H
+#define MZRTINDEX_H
+
+#include <stdint.h>
+
+#include "standardincludes.h"
+
+class mzSample;
+
+using namespace std;
+
+/**
+ * @class MzRtIndex
+ * @ingroup libmaven
+ * @brief Index of the data points of the scans of one MS level of a sample,
+ * binned by m/z.
+ * @details Every bin holds the points that fall into it as postings of
+ * (scan rank, m/z, intensity), ordered by scan and then by m/z. A scan's
+ * rank is its position among the scans of the MS level in retention time
+ * order (see mzSample::scansOfMsLevel), so a query for an m/z-rt box only
+ * reads the postings of the bins covering the m/z range, within the rank
+ * range of the rt window, instead of searching every scan.
+ *
+ * Postings take 12 bytes per point, i.e. one and a half times the memory of
+ * the points themselves. The index is therefore optional and bounded, see
+ * mzSample::setMzRtIndexLimit.
+ */
+class MzRtIndex
+{
+    public:
+    /**
+     * @brief Width of the m/z bins.
+     */
+    static const float binWidth;
+
+    /**
+     * @brief Memory an index over the scans of an MS level of a sample would
+     * take, in bytes.
+     */
+    static size_t estimateMemory(const mzSample* sample, int mslevel);
+
+    /**
+     * @brief Index all points of the scans of an MS level of a loaded
+     * sample.
+     */
+    MzRtIndex(const mzSample* sample, int mslevel);
+
+    int msLevel() const { return _msLevel; }
+
+    /**
+     * @brief Number of scans of the sample (of any MS level) when indexed.
+     */
+    size_t sampleScanCount() const { return _sampleScanCount; }
+
+    size_t pointCount() const { return _mz.size(); }
+
+    /**
+     * @brief Memory taken by the index, in bytes.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Reduce the points within [mzmin, mzmax] of every scan ranked
+     * [firstRank, lastRank) to one EIC point, the same way
+     * EIC::reduceScanPeaks does for a single scan.
+     * @param eicMz Resized to one m/z per scan
+     * @param eicIntensity Resized to one intensity per scan
+     */
+    void reduceScans(float mzmin,
+                     float mzmax,
+                     size_t firstRank,
+                     size_t lastRank,
+                     int eicType,
+                     vector<float>& eicMz,
+                     vector<float>& eicIntensity) const;
+
+    private:
+    int _msLevel;
+    size_t _sampleScanCount;
+    float _minMz;
+
+    // postings of bin b are [_binStart[b], _binStart[b + 1])
+    vector<uint32_t> _binStart;
+    vector<uint32_t> _rank;
+    vector<float> _mz;
+    vector<float> _intensity;
+
+    size_t _bin(float mz) const;
+};
+
+#endif // MZRTINDEX_H
@@ -0,0 +1,90 @@
+#include "progressreporter.h"
+
+const unsigned int ProgressReporter::defaultInterval = 100;
+
+ProgressReporter::ProgressReporter(Callback callback,
+                                   const string& text,
+                                   size_t total,
+                                   unsigned int interval)
+    : _callback(callback),
+      _completed(0),
+      _total(total),
+      _interval(interval),
+      _stopped(false),
+      _reported(false),
+      _reportedCompleted(0),
+      _reportedTotal(0)
+{
+    setText(text);
+    if (_callback)
+        _sampler = thread(&ProgressReporter::_sample, this);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop();
+}
+
+void ProgressReporter::setText(const string& text)
+{
+    setText([text]() { return text; });
+}
+
+void ProgressReporter::setText(function<string()> text)
+{
+    lock_guard<mutex> lock(_mutex);
+    _text = text;
+    // a new text is worth reporting even if the counters have not moved
+    _reported = false;
+}
+
+void ProgressReporter::stop()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_stopped)
+            return;
+        _stopped = true;
+    }
+    _wake.notify_all();
+
+    if (_sampler.joinable())
+        _sampler.join();
+    if (_callback)
+        _report();
+}
+
+void ProgressReporter::_sample()
+{
+    unique_lock<mutex> lock(_mutex);
+    while (!_stopped) {
+        if (_wake.wait_for(lock, _interval, [this] { return _stopped; }))
+            break;
+        lock.unlock();
+        _report();
+        lock.lock();
+    }
+}
+
+void ProgressReporter::_report()
+{
+    size_t completed = _completed.load(memory_order_relaxed);
+    size_t total = _total.load(memory_order_relaxed);
+
+    function<string()> text;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_reported
+            && completed == _reportedCompleted
+            && total == _reportedTotal)
+            return;
+        _reported = true;
+        text = _text;
+    }
+    _reportedCompleted = completed;
+    _reportedTotal = total;
+
+    _callback(text(),
+              static_cast<unsigned int>(completed),
+              static_cast<int>(total));
+}
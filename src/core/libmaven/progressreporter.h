@@ -0,0 +1,127 @@
+#ifndef PROGRESSREPORTER_H
+#define PROGRESSREPORTER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+/**
+ * @class ProgressReporter
+ * @ingroup libmaven
+ * @brief Throttled progress reporting for long running loops.
+ * @details Loops only bump an atomic counter, which is cheap and safe from
+ * any number of threads. A sampler thread reads the counter at a fixed
+ * interval and hands it to a callback (usually one of the boost signals
+ * connected to a progress bar) whenever it has changed. The final state is
+ * always reported once the reporter is stopped or destroyed.
+ *
+ * No sampler is started for an empty callback, so that a reporter can be
+ * created unconditionally and progress simply dropped when it is not shown.
+ */
+class ProgressReporter
+{
+    public:
+    typedef function<void(const string&, unsigned int, int)> Callback;
+
+    /**
+     * @brief Default time between two reports, in milliseconds.
+     */
+    static const unsigned int defaultInterval;
+
+    /**
+     * @brief Start reporting progress.
+     * @param callback Receives text, completed and total steps.
+     * @param text Progress text.
+     * @param total Total number of steps.
+     * @param interval Time between two reports, in milliseconds.
+     */
+    ProgressReporter(Callback callback,
+                     const string& text,
+                     size_t total,
+                     unsigned int interval = defaultInterval);
+
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    /**
+     * @brief Mark a number of steps as completed.
+     */
+    void advance(size_t steps = 1)
+    {
+        _completed.fetch_add(steps, memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the number of completed steps.
+     */
+    void setCompleted(size_t completed)
+    {
+        _completed.store(completed, memory_order_relaxed);
+    }
+
+    size_t completed() const
+    {
+        return _completed.load(memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the total number of steps.
+     */
+    void setTotal(size_t total)
+    {
+        _total.store(total, memory_order_relaxed);
+    }
+
+    /**
+     * @brief Replace the progress text. Takes a lock, so this is meant for
+     * changes of phase and not for every iteration of a loop.
+     */
+    void setText(const string& text);
+
+    /**
+     * @brief Have the progress text built at the time of every report,
+     * e.g. from other counters of the loop.
+     */
+    void setText(function<string()> text);
+
+    /**
+     * @brief Stop the sampler and report the final state if it has not been
+     * reported yet. Called by the destructor; further calls do nothing.
+     */
+    void stop();
+
+    private:
+    Callback _callback;
+    function<string()> _text;
+    atomic<size_t> _completed;
+    atomic<size_t> _total;
+    chrono::milliseconds _interval;
+
+    mutex _mutex;
+    condition_variable _wake;
+    bool _stopped;
+    thread _sampler;
+
+    bool _reported;
+    size_t _reportedCompleted;
+    size_t _reportedTotal;
+
+    void _sample();
+
+    /**
+     * @brief Hand the current progress to the callback, unless it is the
+     * same as the last one reported. Only ever called by one thread at a
+     * time: the sampler, or `stop` once the sampler has finished.
+     */
+    void _report();
+};
+
+#endif // PROGRESSREPORTER_H
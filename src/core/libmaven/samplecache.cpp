@@ -0,0 +1,379 @@
+#include "samplecache.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <boost/crc.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "mzSample.h"
+#include "Scan.h"
+
+const uint32_t SampleCache::version = 1;
+
+namespace {
+    const char cacheMagic[8] = {'E', 'M', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+    // written as a native integer, so that a cache created on a machine of
+    // different endianness is recognised and ignored
+    const uint32_t byteOrderMark = 0x01020304;
+
+    /*
+     * Layout of a cache file:
+     *  - CacheHeader
+     *  - CachedScan for every scan
+     *  - string table: instrument info (key, value pairs) followed by the
+     *    scan type and filter line of every scan, each as a uint32_t length
+     *    and the characters
+     *  - m/z values of all scans, contiguous, starting at mzOffset
+     *  - intensities of all scans, contiguous, starting at intensityOffset
+     */
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+
+        uint64_t sourceSize;
+        int64_t sourceModified;
+        uint32_t sourceChecksum;
+
+        int32_t filterMinIntensity;
+        int32_t filterCentroidScans;
+        int32_t filterIntensityQuantile;
+        int32_t filterMslevel;
+        int32_t filterPolarity;
+
+        int32_t sampleNumber;
+        uint64_t injectionTime;
+        uint64_t instrumentInfoCount;
+
+        uint64_t scanCount;
+        uint64_t peakCount;
+        uint64_t stringsOffset;
+        uint64_t mzOffset;
+        uint64_t intensityOffset;
+        uint64_t fileSize;
+    };
+
+    struct CachedScan {
+        uint64_t peakOffset;
+        uint32_t peakCount;
+        int32_t mslevel;
+        int32_t centroided;
+        int32_t polarity;
+        int32_t precursorCharge;
+        int32_t precursorScanNum;
+        float rt;
+        float originalRt;
+        float precursorMz;
+        float precursorIntensity;
+        float isolationWindow;
+        float productMz;
+        float collisionEnergy;
+        uint32_t padding;
+    };
+
+    void writeString(ofstream& out, const string& str)
+    {
+        uint32_t length = str.size();
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(str.data(), length);
+    }
+
+    bool readString(const char*& pos, const char* end, string& str)
+    {
+        uint32_t length;
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(length)))
+            return false;
+        memcpy(&length, pos, sizeof(length));
+        pos += sizeof(length);
+        if (end - pos < static_cast<ptrdiff_t>(length))
+            return false;
+        str.assign(pos, length);
+        pos += length;
+        return true;
+    }
+}
+
+void SampleCache::_filters(int32_t filters[5])
+{
+    filters[0] = mzSample::filter_minIntensity;
+    filters[1] = mzSample::filter_centroidScans;
+    filters[2] = mzSample::filter_intensityQuantile;
+    filters[3] = mzSample::filter_mslevel;
+    filters[4] = mzSample::filter_polarity;
+}
+
+string SampleCache::cachePath(const string& sourceFile)
+{
+    return sourceFile + ".emcache";
+}
+
+bool SampleCache::_checksum(const string& sourceFile, uint32_t& checksum)
+{
+    ifstream in(sourceFile.c_str(), ios::in | ios::binary);
+    if (!in.is_open())
+        return false;
+
+    boost::crc_32_type crc;
+    vector<char> buffer(1 << 20);
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        crc.process_bytes(buffer.data(), in.gcount());
+    }
+    checksum = crc.checksum();
+    return true;
+}
+
+bool SampleCache::_sourceInfo(const string& sourceFile, SourceInfo& info)
+{
+    struct stat st;
+    if (stat(sourceFile.c_str(), &st) != 0)
+        return false;
+    info.size = st.st_size;
+    info.modified = st.st_mtime;
+    return _checksum(sourceFile, info.checksum);
+}
+
+bool SampleCache::read(mzSample* sample, const string& sourceFile)
+{
+    boost::iostreams::mapped_file_source cacheMap;
+    try {
+        cacheMap.open(cachePath(sourceFile));
+    } catch (...) {
+        return false;
+    }
+    if (!cacheMap.is_open() || cacheMap.size() < sizeof(CacheHeader))
+        return false;
+
+    const char* begin = cacheMap.data();
+
+    CacheHeader header;
+    memcpy(&header, begin, sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0
+        || header.version != version || header.byteOrder != byteOrderMark
+        || header.fileSize != cacheMap.size())
+        return false;
+
+    int32_t filters[5];
+    _filters(filters);
+    if (header.filterMinIntensity != filters[0]
+        || header.filterCentroidScans != filters[1]
+        || header.filterIntensityQuantile != filters[2]
+        || header.filterMslevel != filters[3]
+        || header.filterPolarity != filters[4])
+        return false;
+
+    // cheap checks first, the checksum needs a pass over the source file
+    struct stat st;
+    if (stat(sourceFile.c_str(), &st) != 0
+        || static_cast<uint64_t>(st.st_size) != header.sourceSize
+        || static_cast<int64_t>(st.st_mtime) != header.sourceModified)
+        return false;
+    uint32_t checksum = 0;
+    if (!_checksum(sourceFile, checksum) || checksum != header.sourceChecksum)
+        return false;
+
+    uint64_t scanTableSize = header.scanCount * sizeof(CachedScan);
+    uint64_t arraySize = header.peakCount * sizeof(float);
+    if (header.stringsOffset != sizeof(CacheHeader) + scanTableSize
+        || header.mzOffset < header.stringsOffset
+        || header.intensityOffset != header.mzOffset + arraySize
+        || header.intensityOffset + arraySize != header.fileSize)
+        return false;
+
+    const CachedScan* scanTable =
+        reinterpret_cast<const CachedScan*>(begin + sizeof(CacheHeader));
+    const float* mzArray =
+        reinterpret_cast<const float*>(begin + header.mzOffset);
+    const float* intensityArray =
+        reinterpret_cast<const float*>(begin + header.intensityOffset);
+    const char* strings = begin + header.stringsOffset;
+    const char* stringsEnd = begin + header.mzOffset;
+
+    map<string, string> instrumentInfo;
+    for (uint64_t i = 0; i < header.instrumentInfoCount; i++) {
+        string key, value;
+        if (!readString(strings, stringsEnd, key)
+            || !readString(strings, stringsEnd, value))
+            return false;
+        instrumentInfo[key] = value;
+    }
+
+    vector<Scan*> scans;
+    scans.reserve(header.scanCount);
+    bool valid = true;
+    for (uint64_t i = 0; i < header.scanCount && valid; i++) {
+        CachedScan cached;
+        memcpy(&cached, scanTable + i, sizeof(cached));
+        if (cached.peakOffset + cached.peakCount > header.peakCount) {
+            valid = false;
+            break;
+        }
+
+        Scan* scan = new Scan(sample,
+                              i,
+                              cached.mslevel,
+                              cached.rt,
+                              cached.precursorMz,
+                              cached.polarity);
+        scans.push_back(scan);
+        scan->centroided = cached.centroided;
+        scan->originalRt = cached.originalRt;
+        scan->precursorIntensity = cached.precursorIntensity;
+        scan->precursorCharge = cached.precursorCharge;
+        scan->precursorScanNum = cached.precursorScanNum;
+        scan->isolationWindow = cached.isolationWindow;
+        scan->productMz = cached.productMz;
+        scan->collisionEnergy = cached.collisionEnergy;
+        valid = readString(strings, stringsEnd, scan->scanType)
+                && readString(strings, stringsEnd, scan->filterLine);
+
+        scan->mz.assign(mzArray + cached.peakOffset,
+                        mzArray + cached.peakOffset + cached.peakCount);
+        scan->intensity.assign(
+            intensityArray + cached.peakOffset,
+            intensityArray + cached.peakOffset + cached.peakCount);
+    }
+
+    if (!valid) {
+        for (Scan* scan : scans)
+            delete scan;
+        return false;
+    }
+
+    // scans were filtered and had their precursors recalculated before they
+    // were cached, so they are taken over as they are instead of through
+    // addScan
+    for (Scan* scan : scans) {
+        if (scan->mslevel == 1)
+            ++sample->_numMS1Scans;
+        if (scan->mslevel == 2)
+            ++sample->_numMS2Scans;
+        sample->scans.push_back(scan);
+    }
+    sample->sampleNumber = header.sampleNumber;
+    sample->injectionTime = header.injectionTime;
+    sample->instrumentInfo = instrumentInfo;
+    return true;
+}
+
+bool SampleCache::write(mzSample* sample, const string& sourceFile)
+{
+    // lazily loaded samples do not have all their data at hand
+    if (sample->scans.empty() || !sample->_lazySourceFile.empty())
+        return false;
+
+    SourceInfo source;
+    if (!_sourceInfo(sourceFile, source))
+        return false;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.byteOrder = byteOrderMark;
+    header.sourceSize = source.size;
+    header.sourceModified = source.modified;
+    header.sourceChecksum = source.checksum;
+    int32_t filters[5];
+    _filters(filters);
+    header.filterMinIntensity = filters[0];
+    header.filterCentroidScans = filters[1];
+    header.filterIntensityQuantile = filters[2];
+    header.filterMslevel = filters[3];
+    header.filterPolarity = filters[4];
+    header.sampleNumber = sample->sampleNumber;
+    header.injectionTime = sample->injectionTime;
+    header.instrumentInfoCount = sample->instrumentInfo.size();
+    header.scanCount = sample->scans.size();
+
+    vector<CachedScan> scanTable(sample->scans.size());
+    uint64_t stringsSize = 0;
+    for (const auto& info : sample->instrumentInfo)
+        stringsSize += 2 * sizeof(uint32_t) + info.first.size()
+                       + info.second.size();
+    for (size_t i = 0; i < sample->scans.size(); i++) {
+        Scan* scan = sample->scans[i];
+        CachedScan& cached = scanTable[i];
+        memset(&cached, 0, sizeof(cached));
+        cached.peakOffset = header.peakCount;
+        cached.peakCount = scan->mz.size();
+        cached.mslevel = scan->mslevel;
+        cached.centroided = scan->centroided;
+        cached.polarity = scan->polarity;
+        cached.precursorCharge = scan->precursorCharge;
+        cached.precursorScanNum = scan->precursorScanNum;
+        cached.rt = scan->rt;
+        cached.originalRt = scan->originalRt;
+        cached.precursorMz = scan->precursorMz;
+        cached.precursorIntensity = scan->precursorIntensity;
+        cached.isolationWindow = scan->isolationWindow;
+        cached.productMz = scan->productMz;
+        cached.collisionEnergy = scan->collisionEnergy;
+        header.peakCount += cached.peakCount;
+        stringsSize += 2 * sizeof(uint32_t) + scan->scanType.size()
+                       + scan->filterLine.size();
+
+        // the arrays are stored with a single count
+        if (scan->intensity.size() != scan->mz.size())
+            return false;
+    }
+
+    // keep the float arrays aligned
+    header.stringsOffset =
+        sizeof(CacheHeader) + scanTable.size() * sizeof(CachedScan);
+    header.mzOffset = (header.stringsOffset + stringsSize + 7) / 8 * 8;
+    header.intensityOffset = header.mzOffset + header.peakCount * sizeof(float);
+    header.fileSize =
+        header.intensityOffset + header.peakCount * sizeof(float);
+
+    string cacheFile = cachePath(sourceFile);
+    string tempFile = cacheFile + ".tmp";
+    {
+        ofstream out(tempFile.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(scanTable.data()),
+                  scanTable.size() * sizeof(CachedScan));
+        for (const auto& info : sample->instrumentInfo) {
+            writeString(out, info.first);
+            writeString(out, info.second);
+        }
+        for (Scan* scan : sample->scans) {
+            writeString(out, scan->scanType);
+            writeString(out, scan->filterLine);
+        }
+        string padding(header.mzOffset - header.stringsOffset - stringsSize,
+                       '\0');
+        out.write(padding.data(), padding.size());
+        for (Scan* scan : sample->scans)
+            out.write(reinterpret_cast<const char*>(scan->mz.data()),
+                      scan->mz.size() * sizeof(float));
+        for (Scan* scan : sample->scans)
+            out.write(reinterpret_cast<const char*>(scan->intensity.data()),
+                      scan->intensity.size() * sizeof(float));
+
+        if (!out.good()) {
+            out.close();
+            remove(tempFile.c_str());
+            return false;
+        }
+    }
+
+    // rename() does not replace an existing file everywhere
+    remove(cacheFile.c_str());
+    if (rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+        remove(tempFile.c_str());
+        cerr << "Could not write sample cache " << cacheFile << endl;
+        return false;
+    }
+    return true;
+}
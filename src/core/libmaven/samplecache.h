@@ -0,0 +1,81 @@
+#ifndef SAMPLECACHE_H
+#define SAMPLECACHE_H
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+class mzSample;
+
+/**
+ * @class SampleCache
+ * @ingroup libmaven
+ * @brief Binary sidecar ("<sample file>.emcache") holding the parsed scans
+ * of a sample, so that re-opening the same file skips XML parsing and base64
+ * decoding altogether.
+ * @details The cache is written once a sample has been parsed from its
+ * source file. It stores a fixed size header for every scan and all m/z and
+ * intensity values as two contiguous arrays. Reading memory-maps the file and
+ * copies those arrays straight into the scans.
+ *
+ * A cache is only used if its format version matches, if the size,
+ * modification time and CRC-32 checksum of the source file are unchanged
+ * and if it was written with the same global scan filters (see
+ * mzSample::setFilter_*). Otherwise the source is parsed again and the cache
+ * rewritten.
+ */
+class SampleCache
+{
+    public:
+    /**
+     * @brief Format version, to be increased whenever the layout of the
+     * file changes.
+     */
+    static const uint32_t version;
+
+    /**
+     * @brief Path of the cache belonging to a sample file.
+     */
+    static string cachePath(const string& sourceFile);
+
+    /**
+     * @brief Load the scans of a sample from its cache.
+     * @param sample Empty sample to fill.
+     * @param sourceFile Path of the sample file the cache was written for.
+     * @return False if there is no valid cache for the file, in which case
+     * the sample is left untouched.
+     */
+    static bool read(mzSample* sample, const string& sourceFile);
+
+    /**
+     * @brief Write the cache for a sample that has been parsed in full.
+     * @details The file is written under a temporary name and then renamed,
+     * so that a concurrent reader never sees a partial cache. Failure to
+     * write (e.g. a read-only directory) is not an error; the sample is
+     * simply parsed again next time.
+     * @param sample Sample whose scans are stored.
+     * @param sourceFile Path of the file the sample was parsed from.
+     * @return True if the cache was written.
+     */
+    static bool write(mzSample* sample, const string& sourceFile);
+
+    private:
+    struct SourceInfo {
+        uint64_t size;
+        int64_t modified;
+        uint32_t checksum;
+    };
+
+    static bool _sourceInfo(const string& sourceFile, SourceInfo& info);
+    static bool _checksum(const string& sourceFile, uint32_t& checksum);
+
+    /**
+     * @brief Global scan filters of mzSample that shape the cached data, in
+     * the order minIntensity, centroidScans, intensityQuantile, mslevel and
+     * polarity.
+     */
+    static void _filters(int32_t filters[5]);
+};
+
+#endif // SAMPLECACHE_H
@@ -0,0 +1,282 @@
+#include "xmlstream.h"
+
+#include <cctype>
+#include <cstring>
+
+XmlElementStream::XmlElementStream(const string& filename,
+                                   const set<string>& elements,
+                                   const set<string>& startTags,
+                                   size_t chunkSize)
+    : _in(filename.c_str(), ios::in | ios::binary),
+      _elements(elements),
+      _startTags(startTags),
+      _chunkSize(chunkSize),
+      _pos(0),
+      _bufOffset(0),
+      _rootClosed(false),
+      _truncated(false)
+{
+}
+
+bool XmlElementStream::_cutShort()
+{
+    _truncated = true;
+    return false;
+}
+
+void XmlElementStream::_compact()
+{
+    // drop what has already been consumed, once it is worth the move
+    if (_pos >= _chunkSize) {
+        _buf.erase(0, _pos);
+        _bufOffset += _pos;
+        _pos = 0;
+    }
+}
+
+bool XmlElementStream::_readChunk()
+{
+    if (!_in.good())
+        return false;
+
+    size_t oldSize = _buf.size();
+    _buf.resize(oldSize + _chunkSize);
+    _in.read(&_buf[oldSize], _chunkSize);
+    size_t bytesRead = static_cast<size_t>(_in.gcount());
+    _buf.resize(oldSize + bytesRead);
+    return bytesRead > 0;
+}
+
+bool XmlElementStream::_ensure(size_t size)
+{
+    while (_buf.size() < size) {
+        if (!_readChunk())
+            return false;
+    }
+    return true;
+}
+
+size_t XmlElementStream::_find(char c, size_t from)
+{
+    while (true) {
+        size_t pos = _buf.find(c, from);
+        if (pos != string::npos)
+            return pos;
+        from = _buf.size();
+        if (!_readChunk())
+            return string::npos;
+    }
+}
+
+size_t XmlElementStream::_find(const char* str, size_t from)
+{
+    size_t len = strlen(str);
+    while (true) {
+        size_t pos = _buf.find(str, from);
+        if (pos != string::npos)
+            return pos;
+        // the pattern may straddle the chunk boundary
+        from = _buf.size() >= len ? _buf.size() - len + 1 : 0;
+        if (!_readChunk())
+            return string::npos;
+    }
+}
+
+size_t XmlElementStream::_startTagEnd(size_t tagStart)
+{
+    // attribute values are allowed to contain '>', so honour quoting
+    char quote = 0;
+    for (size_t i = tagStart + 1;; ++i) {
+        if (!_ensure(i + 1))
+            return string::npos;
+        char c = _buf[i];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            return i;
+        }
+    }
+}
+
+bool XmlElementStream::_isTag(size_t pos, const string& name)
+{
+    if (!_ensure(pos + name.size() + 1))
+        return false;
+    if (_buf.compare(pos, name.size(), name) != 0)
+        return false;
+    char next = _buf[pos + name.size()];
+    return next == '>' || next == '/' || isspace(static_cast<unsigned char>(next));
+}
+
+size_t XmlElementStream::_elementEnd(const string& name, size_t tagEnd)
+{
+    // empty element, e.g. <scan num="1"/>
+    if (_buf[tagEnd - 1] == '/')
+        return tagEnd + 1;
+
+    int depth = 1;
+    size_t pos = tagEnd + 1;
+    while (depth > 0) {
+        size_t lt = _find('<', pos);
+        if (lt == string::npos || !_ensure(lt + 2))
+            return string::npos;
+
+        if (_buf[lt + 1] == '/' && _isTag(lt + 2, name)) {
+            size_t gt = _find('>', lt);
+            if (gt == string::npos)
+                return string::npos;
+            pos = gt + 1;
+            --depth;
+        } else if (_isTag(lt + 1, name)) {
+            size_t gt = _startTagEnd(lt);
+            if (gt == string::npos)
+                return string::npos;
+            if (_buf[gt - 1] != '/')
+                ++depth;
+            pos = gt + 1;
+        } else {
+            pos = lt + 1;
+        }
+    }
+    return pos;
+}
+
+bool XmlElementStream::next(string& name, string& markup)
+{
+    // only running out of data between elements is a regular end of file
+    _truncated = false;
+    while (true) {
+        _compact();
+
+        size_t lt = _find('<', _pos);
+        if (lt == string::npos)
+            return _root.empty() || _rootClosed ? false : _cutShort();
+        if (!_ensure(lt + 2))
+            return _cutShort();
+
+        char c = _buf[lt + 1];
+        if (c == '/' && !_root.empty() && _isTag(lt + 2, _root))
+            _rootClosed = true;
+        if (c == '!' || c == '?' || c == '/') {
+            size_t end = string::npos;
+            if (_ensure(lt + 4) && _buf.compare(lt, 4, "<!--") == 0) {
+                end = _find("-->", lt + 4);
+                if (end != string::npos)
+                    end += 2;
+            } else if (_ensure(lt + 9)
+                       && _buf.compare(lt, 9, "<![CDATA[") == 0) {
+                end = _find("]]>", lt + 9);
+                if (end != string::npos)
+                    end += 2;
+            } else {
+                end = _find('>', lt);
+            }
+            if (end == string::npos)
+                return _cutShort();
+            _pos = end + 1;
+            continue;
+        }
+
+        size_t gt = _startTagEnd(lt);
+        if (gt == string::npos)
+            return _cutShort();
+
+        size_t nameEnd = lt + 1;
+        while (nameEnd < gt && _buf[nameEnd] != '/'
+               && !isspace(static_cast<unsigned char>(_buf[nameEnd])))
+            ++nameEnd;
+        string tag = _buf.substr(lt + 1, nameEnd - lt - 1);
+        if (_root.empty()) {
+            _root = tag;
+            _rootClosed = _buf[gt - 1] == '/';
+        }
+
+        if (_elements.count(tag)) {
+            size_t end = _elementEnd(tag, gt);
+            if (end == string::npos)
+                return _cutShort();
+            name = tag;
+            markup.assign(_buf, lt, end - lt);
+            _pos = end;
+            return true;
+        }
+
+        if (_startTags.count(tag)) {
+            name = tag;
+            if (_buf[gt - 1] == '/') {
+                markup.assign(_buf, lt, gt - lt + 1);
+            } else {
+                markup.assign(_buf, lt, gt - lt);
+                markup += "/>";
+            }
+            _pos = gt + 1;
+            return true;
+        }
+
+        _pos = gt + 1;
+    }
+}
+
+bool XmlElementStream::nextHead(const string& stopTag,
+                                string& name,
+                                string& markup)
+{
+    _compact();
+
+    size_t lt = _find('<', _pos);
+    if (lt == string::npos)
+        return false;
+
+    size_t gt = _startTagEnd(lt);
+    if (gt == string::npos)
+        return false;
+
+    size_t nameEnd = lt + 1;
+    while (nameEnd < gt && _buf[nameEnd] != '/'
+           && !isspace(static_cast<unsigned char>(_buf[nameEnd])))
+        ++nameEnd;
+    name = _buf.substr(lt + 1, nameEnd - lt - 1);
+    if (_buf[gt - 1] == '/') {
+        _pos = gt + 1;
+        return false;
+    }
+
+    size_t pos = gt + 1;
+    while (true) {
+        size_t child = _find('<', pos);
+        if (child == string::npos || !_ensure(child + 2))
+            return false;
+
+        if (_isTag(child + 1, stopTag)) {
+            markup.assign(_buf, lt, child - lt);
+            markup += "</" + name + ">";
+            _pos = child;
+            return true;
+        }
+        if (_buf[child + 1] == '/' && _isTag(child + 2, name)) {
+            _pos = child;
+            return false;
+        }
+        pos = child + 1;
+    }
+}
+
+bool XmlElementStream::seek(streamoff offset)
+{
+    if (offset >= _bufOffset
+        && offset <= _bufOffset + static_cast<streamoff>(_buf.size())) {
+        _pos = static_cast<size_t>(offset - _bufOffset);
+        return true;
+    }
+
+    _buf.clear();
+    _pos = 0;
+    _bufOffset = offset;
+    _truncated = false;
+    _in.clear();
+    _in.seekg(offset);
+    return _in.good();
+}
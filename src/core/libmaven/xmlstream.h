@@ -0,0 +1,113 @@
+#ifndef XMLSTREAM_H
+#define XMLSTREAM_H
+
+#include <fstream>
+#include <set>
+#include <string>
+
+using namespace std;
+
+/**
+ * @class XmlElementStream
+ * @ingroup libmaven
+ * @brief Forward-only reader that pulls selected elements out of a large XML
+ * file without building a DOM for the whole document.
+ * @details The file is read in fixed size chunks and scanned for start tags
+ * of interest. Every matching element is handed back as a self-contained
+ * markup string, which can then be parsed on its own (e.g. with pugixml's
+ * `load_buffer`). Peak memory is therefore bounded by the chunk size plus
+ * the size of the largest single element, instead of the size of the file.
+ *
+ * Two kinds of tags can be requested:
+ *  - "element" tags are returned along with all of their content, including
+ *    nested elements of the same name (mzXML nests MS2 scans in MS1 scans).
+ *  - "start" tags are returned as an empty element with only the attributes
+ *    of the start tag, which is useful for large container elements whose
+ *    attributes are needed but whose content is streamed separately.
+ */
+class XmlElementStream
+{
+    public:
+    /**
+     * @brief Open a file for streaming.
+     * @param filename Path of the XML file.
+     * @param elements Names of elements that should be returned whole.
+     * @param startTags Names of elements for which only attributes are
+     * needed.
+     * @param chunkSize Number of bytes read from disk at a time.
+     */
+    XmlElementStream(const string& filename,
+                     const set<string>& elements,
+                     const set<string>& startTags = set<string>(),
+                     size_t chunkSize = 1 << 20);
+
+    /**
+     * @brief Whether the underlying file could be opened.
+     */
+    bool isOpen() const { return _in.is_open(); }
+
+    /**
+     * @brief Advance to the next requested element in document order.
+     * @param name Set to the tag name of the element found.
+     * @param markup Set to the complete markup of the element.
+     * @return False once the end of file is reached (or the file ends in the
+     * middle of an element, see truncated), true otherwise.
+     */
+    bool next(string& name, string& markup);
+
+    /**
+     * @brief Whether the last call to `next` stopped because the file ended
+     * inside a tag, comment or requested element, or before the end tag of
+     * the document's root element.
+     */
+    bool truncated() const { return _truncated; }
+
+    /**
+     * @brief Read only the leading part of the next element, up to (but not
+     * including) its first child named `stopTag`.
+     * @details The head is closed with a matching end tag, so that it can be
+     * parsed as a complete element. This allows metadata that precedes bulky
+     * content (like the binary arrays of an mzML spectrum) to be read without
+     * pulling the bulky part off the disk.
+     * @param stopTag Name of the child element at which reading stops.
+     * @param name Set to the tag name of the element found.
+     * @param markup Set to the markup of the element's head.
+     * @return True if `stopTag` was found before the end of the element.
+     */
+    bool nextHead(const string& stopTag, string& name, string& markup);
+
+    /**
+     * @brief Reposition the reader at an absolute byte offset in the file,
+     * e.g. one taken from an indexedmzML offset index.
+     * @details Offsets that fall within the data already buffered are served
+     * without touching the disk, so visiting offsets in increasing order
+     * reads the file sequentially.
+     * @return False if the file could not be positioned.
+     */
+    bool seek(streamoff offset);
+
+    private:
+    ifstream _in;
+    set<string> _elements;
+    set<string> _startTags;
+    size_t _chunkSize;
+
+    string _buf;
+    size_t _pos;
+    streamoff _bufOffset;
+    string _root;
+    bool _rootClosed;
+    bool _truncated;
+
+    bool _cutShort();
+    void _compact();
+    bool _readChunk();
+    bool _ensure(size_t size);
+    size_t _find(char c, size_t from);
+    size_t _find(const char* str, size_t from);
+    size_t _startTagEnd(size_t tagStart);
+    size_t _elementEnd(const string& name, size_t tagEnd);
+    bool _isTag(size_t pos, const string& name);
+};
+
+#endif // XMLSTREAM_H
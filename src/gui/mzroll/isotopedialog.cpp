@@ -15,6 +15,8 @@ IsotopeDialogSettings::IsotopeDialogSettings(IsotopeDialog* dialog):id(dialog)
     settings.insert("abundanceThreshold", QVariant::fromValue(id->doubleSpinBoxAbThresh));
     settings.insert("maxNaturalAbundanceError", QVariant::fromValue(id->maxNaturalAbundanceErr));
     settings.insert("correctC13IsotopeAbundance", QVariant::fromValue(id->isotopeC13Correction));
+    settings.insert("windowedIsotopeEic", QVariant::fromValue(id->windowedIsotopeEic));
+    settings.insert("isotopeEicMarginScans", QVariant::fromValue(id->isotopeEicMarginScans));
 }
 
 void IsotopeDialogSettings::updateIsotopeDialogSettings(string key, string value)
@@ -2553,6 +2553,16 @@ void MainWindow::readSettings() {
         settings->setValue("embeded_http_server_address", "127.0.0.1");
     }
 
+    // keep a binary copy of parsed samples next to the sample files
+    if (!settings->contains("cacheSamples")) {
+        settings->setValue("cacheSamples", false);
+    }
+
+    // memory in MB each sample may use for an m/z-rt index, 0 disables it
+    if (!settings->contains("mzRtIndexMemory")) {
+        settings->setValue("mzRtIndexMemory", 0);
+    }
+
 
 	settings->setValue("uploadMultiprocessing", 2);
 
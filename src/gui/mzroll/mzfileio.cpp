@@ -98,6 +98,19 @@ mzSample* mzFileIO::loadSample(const QString& filename){
         mzFileIO::ThermoRawFileImport(filename);
     } else {
         sample = new mzSample();
+        // scan arrays of indexed mzML files are decoded on first use, peak
+        // detection decodes everything before it starts
+        sample->setLazyLoading(true);
+        if (_mainwindow
+            && _mainwindow->getSettings()->value("cacheSamples").toBool())
+            sample->setSampleCaching(true);
+        if (_mainwindow) {
+            int indexMemory = _mainwindow->getSettings()
+                                  ->value("mzRtIndexMemory")
+                                  .toInt();
+            sample->setMzRtIndexLimit(size_t(max(indexMemory, 0)) * 1024
+                                      * 1024);
+        }
         sample->loadSample( filename.toLatin1().data() );
         if ( sample->scans.size() == 0 ) { delete(sample); sample=NULL; }
     }
@@ -50,6 +50,7 @@ HEADERS += \
     testMassCalculator.h \
     testCSVReports.h \
     testMzSlice.h \
+    testMassSlicer.h \
     testLoadDB.h \
     testPeakDetection.h \
     testIsotopeDetection.h \
@@ -77,6 +78,7 @@ SOURCES += \
     testPeakDetection.cpp \
     testIsotopeDetection.cpp \
     testMzSlice.cpp \
+    testMassSlicer.cpp \
     testLoadDB.cpp \
     testScan.cpp \
     testEIC.cpp \
@@ -6,6 +6,7 @@
 #include "testPeakDetection.h"
 #include "testIsotopeDetection.h"
 #include "testMzSlice.h"
+#include "testMassSlicer.h"
 #include "testLoadDB.h"
 #include "testScan.h"
 #include "testEIC.cpp"
@@ -72,6 +73,12 @@ int main(int argc, char** argv) {
     result|=readLog("testMzSlice.xml");
     mzUtils::stopTimer(timer, "testMzSlice");
 
+    timer = mzUtils::startTimer();
+    if (freopen("testMassSlicer.xml", "w", stdout))
+        result |= QTest::qExec(new TestMassSlicer, argc, argv);
+    result|=readLog("testMassSlicer.xml");
+    mzUtils::stopTimer(timer, "testMassSlicer");
+
     timer = mzUtils::startTimer();
     if (freopen("testScan.xml", "w", stdout))
         result |= QTest::qExec(new TestScan, argc, argv);
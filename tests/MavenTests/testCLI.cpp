@@ -6,6 +6,7 @@
 #include "csvreports.h"
 #include "masscutofftype.h"
 #include "mavenparameters.h"
+#include "mzUtils.h"
 #include "PeakDetector.h"
 #include "peakdetectorcli.h"
 #include "utilities.h"
@@ -206,3 +207,77 @@ void TestCLI::testWriteReport() {
 	peakdetectorCLI->mavenParameters->allgroups.clear();
 
 }
+
+void TestCLI::testStreamMassSlices() {
+
+    PeakDetectorCLI* peakdetectorCLI = new PeakDetectorCLI(_log, _analytics);
+
+    peakdetectorCLI->processXML((char*)xmlPath);
+
+    if (!peakdetectorCLI->status) {
+        cerr << peakdetectorCLI->textStatus;
+        return;
+    }
+
+    MavenParameters* mavenParameters = peakdetectorCLI->mavenParameters;
+    peakdetectorCLI->loadClassificationModel(peakdetectorCLI->clsfModelFilename);
+    peakdetectorCLI->peakDetector->setMavenParameters(mavenParameters);
+    peakdetectorCLI->loadSamples(peakdetectorCLI->filenames);
+    mavenParameters->setAverageScanTime();
+    mavenParameters->setIonizationMode(MavenParameters::AutoDetect);
+    mavenParameters->processAllSlices = true;
+    mavenParameters->matchRtFlag = false;
+    peakdetectorCLI->saveJsonEIC = true;
+
+    // without streaming, groups are kept in the order streaming writes them
+    peakdetectorCLI->peakDetector->processMassSlices();
+    vector<PeakGroup> found = mavenParameters->allgroups;
+    QVERIFY(found.size() > 0);
+
+    // a group is written unless a group written before it is a duplicate at
+    // least as intense
+    MassCutoff* massCutoff = mavenParameters->massCutoffMerge;
+    vector<PeakGroup> written;
+    for (auto& group : found) {
+        bool duplicate = false;
+        for (auto& other : written) {
+            float masscutoffdist = mzUtils::massCutoffDist(other.meanMz,
+                                                           group.meanMz,
+                                                           massCutoff);
+            float rtoverlap = mzUtils::checkOverlap(other.minRt,
+                                                    other.maxRt,
+                                                    group.minRt,
+                                                    group.maxRt);
+            if (masscutoffdist < massCutoff->getMassCutoff()
+                && rtoverlap > 0.8
+                && group.maxIntensity <= other.maxIntensity) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate)
+            written.push_back(group);
+    }
+
+    string expectedName = mavenParameters->outputdir + "expectedstream";
+    mavenParameters->allgroups = written;
+    peakdetectorCLI->saveJson(expectedName);
+    peakdetectorCLI->saveCSV(expectedName, false);
+
+    peakdetectorCLI->streamMassSlices("teststream");
+    QVERIFY(mavenParameters->allgroups.empty());
+
+    string streamedName = mavenParameters->outputdir + "teststream";
+    for (string extension : {".csv", ".json"}) {
+        QFile expectedFile(QString::fromStdString(expectedName + extension));
+        QFile streamedFile(QString::fromStdString(streamedName + extension));
+        QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+        QVERIFY(streamedFile.open(QIODevice::ReadOnly));
+        QVERIFY(expectedFile.readAll() == streamedFile.readAll());
+    }
+
+    delete_all(mavenParameters->samples);
+    mavenParameters->samples.clear();
+    mavenParameters->allgroups.clear();
+
+}
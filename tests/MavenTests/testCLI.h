@@ -38,6 +38,7 @@ class TestCLI : public QObject {
         void testCreateXMLFile();
         void testReduceGroups();
         void testWriteReport();
+        void testStreamMassSlices();
 
 };
 
@@ -1,14 +1,291 @@
 #include "testEIC.h"
 #include "datastructures/mzSlice.h"
 #include "EIC.h"
+#include "eicpool.h"
 #include "masscutofftype.h"
 #include "mavenparameters.h"
 #include "mzMassCalculator.h"
 #include "mzSample.h"
+#include "mzrtindex.h"
 #include "PeakGroup.h"
 #include "PeakDetector.h"
+#include "SavGolSmoother.h"
+#include "Scan.h"
 #include "utilities.h"
 
+namespace {
+    // Reference smoothers summing the window of every point one at a time,
+    // as the library did before its filters were applied one coefficient at
+    // a time over all points.
+    void referenceConv(int lx, int ifx, const float* x,
+                       int ly, int ify, const float* y,
+                       int lz, int ifz, float* z)
+    {
+        int ilx = ifx + lx - 1, ily = ify + ly - 1, ilz = ifz + lz - 1;
+        x -= ifx;  y -= ify;  z -= ifz;
+        for (int i = ifz; i <= ilz; ++i) {
+            int jlow = i - ily;  if (jlow < ifx) jlow = ifx;
+            int jhigh = i - ify;  if (jhigh > ilx) jhigh = ilx;
+            float sum = 0.0;
+            for (int j = jlow; j <= jhigh; ++j)
+                sum += x[j] * y[i - j];
+            z[i] = sum;
+        }
+    }
+
+    vector<float> referenceSavGol(const vector<float>& y, int window)
+    {
+        const vector<float>& coefficients =
+            mzUtils::SavGolSmoother::Coefficients(window, window, 4);
+        int size = y.size();
+        vector<float> smoothed(size);
+        for (int i = 0; i < size; i++) {
+            int start = i - window;
+            int stop = i + window + 1;
+            if (start < 0 || stop >= size) {
+                smoothed[i] = y[i];
+                continue;
+            }
+            float sum = 0;
+            for (int j = start; j < stop; j++)
+                sum = sum + y[j] * coefficients[j - start];
+            smoothed[i] = sum < 0 ? 0 : sum;
+        }
+        return smoothed;
+    }
+
+    vector<float> referenceAverage(const vector<float>& y, int window)
+    {
+        int size = y.size();
+        vector<float> x(window);
+        for (int i = 0; i < window; i++)
+            x[i] = 1.0 / window;
+        vector<float> smoothed(size);
+        referenceConv(window, -window / 2, x.data(),
+                      size, 0, y.data(),
+                      size, 0, smoothed.data());
+        return smoothed;
+    }
+
+    vector<float> referenceGaussian(vector<float> y, int nsr)
+    {
+        int ns = y.size();
+        float fcutr = 1.0 / nsr;
+        float fcut = fcutr;
+        if (nsr == 0 || ns <= 1)
+            return y;
+        if (nsr > 100)
+            fcut = 1.0 / 100;
+
+        if (1.01 / fcutr > (float)ns) {
+            float sum = 0.0;
+            for (int i = 0; i < ns; i++) sum += y[i];
+            sum /= ns;
+            for (int i = 0; i < ns; i++) y[i] = sum;
+            return y;
+        }
+
+        int n = (int)(3.0 / fcut + 0.5);
+        n = 2 * n / 2 + 1;
+        int mean = n / 2;
+        vector<float> s(n);
+        float sum = 0.0;
+        for (int i = 1; i <= n; i++) {
+            float r = i - mean - 1;
+            r = -r * r * fcut * fcut * 3.141;
+            s[i - 1] = exp(r);
+        }
+        for (int i = 0; i < n; i++) sum += s[i];
+        for (int i = 0; i < n; i++) s[i] /= sum;
+
+        vector<float> smoothed(ns);
+        referenceConv(n, -mean, s.data(), ns, -mean, y.data(),
+                      ns, -mean, smoothed.data());
+        return smoothed;
+    }
+
+    bool sameValues(const float* a, const vector<float>& b)
+    {
+        for (size_t i = 0; i < b.size(); i++) {
+            float tolerance = 1e-5f * max(1.0f, fabs(b[i]));
+            if (!(fabs(a[i] - b[i]) <= tolerance))
+                return false;
+        }
+        return true;
+    }
+
+    // Reference AsLS baseline, solving (W + λ·DᵀD)·z = W·y with D assembled
+    // as a dense second difference matrix and by Gaussian elimination. An
+    // iteration whose system is singular keeps the previous baseline.
+    vector<float> referenceAsLSBaseline(const vector<float>& y,
+                                        double lambda,
+                                        double p)
+    {
+        int n = y.size();
+        vector<vector<double>> D(max(0, n - 2), vector<double>(n, 0.0));
+        for (int r = 0; r + 2 < n; r++) {
+            D[r][r] = 1.0;
+            D[r][r + 1] = -2.0;
+            D[r][r + 2] = 1.0;
+        }
+
+        vector<double> w(n, 1.0);
+        vector<double> z(y.begin(), y.end());
+        for (int iteration = 0; iteration < 10; iteration++) {
+            // augmented matrix [W + λ·DᵀD | W·y]
+            vector<vector<double>> A(n, vector<double>(n + 1, 0.0));
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    for (size_t r = 0; r < D.size(); r++)
+                        A[i][j] += lambda * D[r][i] * D[r][j];
+                }
+                A[i][i] += w[i];
+                A[i][n] = w[i] * y[i];
+            }
+
+            bool singular = false;
+            for (int c = 0; c < n && !singular; c++) {
+                int pivot = c;
+                for (int r = c + 1; r < n; r++) {
+                    if (fabs(A[r][c]) > fabs(A[pivot][c]))
+                        pivot = r;
+                }
+                swap(A[c], A[pivot]);
+                singular = A[c][c] == 0.0;
+                for (int r = c + 1; r < n && !singular; r++) {
+                    double factor = A[r][c] / A[c][c];
+                    for (int k = c; k <= n; k++)
+                        A[r][k] -= factor * A[c][k];
+                }
+            }
+            if (singular)
+                break;
+
+            for (int i = n - 1; i >= 0; i--) {
+                double sum = A[i][n];
+                for (int k = i + 1; k < n; k++)
+                    sum -= A[i][k] * z[k];
+                z[i] = sum / A[i][i];
+            }
+            for (int i = 0; i < n; i++) {
+                double residual = y[i] - z[i];
+                w[i] = residual > 0.0 ? p : (residual < 0.0 ? 1.0 - p : 0.0);
+            }
+        }
+
+        vector<float> baseline;
+        for (auto value : z)
+            baseline.push_back(max(0.0f, static_cast<float>(value)));
+        return baseline;
+    }
+
+    // EIC of a new sample with its peaks found, one scan every 0.01 minutes
+    // from the given rt
+    EIC* syntheticEic(const vector<float>& intensity,
+                      float rtStart,
+                      int smoothingWindow)
+    {
+        mzSample* sample = new mzSample();
+        EIC* e = new EIC();
+        e->sample = sample;
+        for (unsigned int i = 0; i < intensity.size(); i++) {
+            Scan* scan = new Scan(sample, i, 1, rtStart + i * 0.01f, 0.0f, 1);
+            if (intensity[i] > 0.0f) {
+                scan->mz.push_back(100.0f);
+                scan->intensity.push_back(intensity[i]);
+            }
+            sample->addScan(scan);
+
+            e->rt.push_back(scan->rt);
+            e->scannum.push_back(i);
+            e->mz.push_back(intensity[i] > 0.0f ? 100.0f : 0.0f);
+            e->intensity.push_back(intensity[i]);
+            e->totalIntensity += intensity[i];
+            if (intensity[i] > e->maxIntensity)
+                e->maxIntensity = intensity[i];
+        }
+        sample->calculateMzRtRange();
+        e->rtmin = e->rt.front();
+        e->rtmax = e->rt.back();
+        e->setBaselineSmoothingWindow(5);
+        e->setBaselineDropTopX(80);
+        e->setFilterSignalBaselineDiff(0);
+        e->getPeakPositions(smoothingWindow);
+        return e;
+    }
+
+    // Groups of peaks as groupPeaks forms them, before each group is
+    // summarized, with every sample peak matched by walking over all merged
+    // peaks as it did before bounding the merged peaks it visits. The merged
+    // peak every sample peak is grouped with, or -1, is kept in groupNums.
+    vector<PeakGroup> referenceGroups(vector<EIC*>& eics,
+                                      int smoothingWindow,
+                                      float maxRtDiff,
+                                      double distXWeight,
+                                      double distYWeight,
+                                      double overlapWeight,
+                                      bool useOverlap,
+                                      vector<vector<int>>& groupNums)
+    {
+        EIC* m = EIC::eicMerge(eics);
+        m->setFilterSignalBaselineDiff(0);
+        m->getPeakPositions(smoothingWindow);
+        sort(m->peaks.begin(), m->peaks.end(), Peak::compRt);
+
+        vector<PeakGroup> groups(m->peaks.size());
+        groupNums.assign(eics.size(), vector<int>());
+        for (unsigned int i = 0; i < eics.size(); i++) {
+            for (auto& b : eics[i]->peaks) {
+                int groupNum = -1;
+                float groupOverlap = FLT_MIN;
+                for (unsigned int k = 0; k < m->peaks.size(); k++) {
+                    Peak& a = m->peaks[k];
+                    float overlap = mzUtils::checkOverlap(a.rtmin,
+                                                          a.rtmax,
+                                                          b.rtmin,
+                                                          b.rtmax);
+                    float distx = abs(b.rt - a.rt);
+                    float disty = abs(b.peakIntensity - a.peakIntensity);
+                    float score;
+                    if (useOverlap) {
+                        if (overlap == 0 and a.rtmax < b.rtmin)
+                            continue;
+                        if (overlap == 0 and a.rtmin > b.rtmax)
+                            break;
+                        if (distx > maxRtDiff && overlap < 0.2)
+                            continue;
+                        score = 1.0 / (distXWeight * distx + 0.01)
+                                / (distYWeight * disty + 0.01)
+                                * (overlapWeight * overlap);
+                    } else {
+                        if (distx > maxRtDiff)
+                            continue;
+                        score = 1.0 / (distXWeight * distx + 0.01)
+                                / (distYWeight * disty + 0.01);
+                    }
+                    if (score > groupOverlap) {
+                        groupNum = k;
+                        groupOverlap = score;
+                    }
+                }
+                groupNums[i].push_back(groupNum);
+                if (groupNum != -1)
+                    groups[groupNum].addPeak(b);
+            }
+        }
+        EICPool::release(m);
+
+        vector<PeakGroup> reduced;
+        for (auto& group : groups) {
+            if (group.peaks.empty())
+                continue;
+            group.reduce();
+            reduced.push_back(group);
+        }
+        return reduced;
+    }
+}
+
 TestEIC::TestEIC() {}
 
 void TestEIC::initTestCase() {
@@ -62,6 +339,159 @@ void TestEIC::testgetEICms2() {
     QVERIFY(e3->maxIntensity == 49400);
 }
 
+void TestEIC::testgetEICFromScanColumns() {
+    mzSample* mzsample = maventests::samples.ms1TestSamples[0];
+
+    EIC fromScans;
+    fromScans.makeEICSlice(mzsample, 402.9929, 402.9969, 12, 16, 1, 0, "");
+
+    vector<vector<float>> mzs, intensities;
+    for (auto scan : mzsample->scans) {
+        mzs.push_back(scan->mz);
+        intensities.push_back(scan->intensity);
+    }
+
+    mzsample->buildScanColumns();
+    const ScanColumns* columns = mzsample->scanColumns();
+    QVERIFY(columns != nullptr);
+    QVERIFY(columns->scanCount() == mzsample->scans.size());
+
+    // the peaks are moved into the columns, not copied
+    for (size_t i = 0; i < mzsample->scans.size(); i++) {
+        Scan* scan = mzsample->scans[i];
+        QVERIFY(scan->dataState() == Scan::DataState::InColumns);
+        QVERIFY(scan->mz.capacity() == 0);
+        QVERIFY(scan->intensity.capacity() == 0);
+        QVERIFY(columns->nobs(i) == mzs[i].size());
+    }
+
+    EIC fromColumns;
+    fromColumns.makeEICSlice(mzsample, 402.9929, 402.9969, 12, 16, 1, 0, "");
+
+    // a scan read while the columns exist gets its own arrays back
+    Scan* readScan = mzsample->scans[mzsample->scans.size() / 2];
+    QVERIFY(readScan->nobs() == mzs[readScan->scannum].size());
+    QVERIFY(readScan->isDataLoaded());
+    QVERIFY(readScan->intensity == intensities[readScan->scannum]);
+
+    mzsample->releaseScanColumns();
+    QVERIFY(mzsample->scanColumns() == nullptr);
+    for (size_t i = 0; i < mzsample->scans.size(); i++) {
+        Scan* scan = mzsample->scans[i];
+        QVERIFY(scan->isDataLoaded());
+        QVERIFY(scan->mz == mzs[i]);
+        QVERIFY(scan->intensity == intensities[i]);
+    }
+
+    QVERIFY(fromScans.size() > 0);
+    QVERIFY(fromColumns.scannum == fromScans.scannum);
+    QVERIFY(fromColumns.rt == fromScans.rt);
+    QVERIFY(fromColumns.mz == fromScans.mz);
+    QVERIFY(fromColumns.intensity == fromScans.intensity);
+    QVERIFY(fromColumns.maxIntensity == fromScans.maxIntensity);
+}
+
+void TestEIC::testgetEICs() {
+    mzSample* mzsample = maventests::samples.ms1TestSamples[0];
+
+    // overlapping and disjoint windows, in no particular order
+    vector<mzSlice*> slices;
+    slices.push_back(new mzSlice(402.9929f, 402.9969f, 12.0f, 16.0f));
+    slices.push_back(new mzSlice(180.0f, 181.0f, 0.0f, 2.0f));
+    slices.push_back(new mzSlice(402.9900f, 403.0000f, 10.0f, 14.0f));
+    slices.push_back(new mzSlice(150.0f, 450.0f, 5.0f, 5.5f));
+    slices.push_back(new mzSlice(402.9929f, 402.9969f, 12.0f, 16.0f));
+
+    for (int eicType = 0; eicType < 2; eicType++) {
+        vector<EIC*> batch = mzsample->getEICs(slices, 1, eicType, "");
+        QVERIFY(batch.size() == slices.size());
+
+        for (unsigned int i = 0; i < slices.size(); i++) {
+            EIC* single = mzsample->getEIC(slices[i]->mzmin,
+                                           slices[i]->mzmax,
+                                           slices[i]->rtmin,
+                                           slices[i]->rtmax,
+                                           1,
+                                           eicType,
+                                           "");
+            QVERIFY(batch[i]->scannum == single->scannum);
+            QVERIFY(batch[i]->rt == single->rt);
+            QVERIFY(batch[i]->intensity == single->intensity);
+            QVERIFY(batch[i]->maxIntensity == single->maxIntensity);
+            QVERIFY(batch[i]->rtmin == single->rtmin);
+            QVERIFY(batch[i]->rtmax == single->rtmax);
+            delete single;
+        }
+        delete_all(batch);
+    }
+    delete_all(slices);
+}
+
+void TestEIC::testgetEICFromMzRtIndex() {
+    mzSample* mzsample = maventests::samples.ms1TestSamples[0];
+    QVERIFY(mzsample->mzRtIndex() == nullptr);
+
+    mzSample indexed;
+    indexed.setMzRtIndexLimit(size_t(256) * 1024 * 1024);
+    indexed.loadSample("bin/methods/testsample_2.mzxml");
+    const MzRtIndex* index = indexed.mzRtIndex();
+    QVERIFY(index != nullptr);
+    QVERIFY(index->msLevel() == 1);
+    QVERIFY(index->memoryUsage() <= MzRtIndex::estimateMemory(&indexed, 1));
+
+    size_t points = 0;
+    for (Scan* scan : indexed.scans) {
+        if (scan->mslevel == 1)
+            points += scan->nobs();
+    }
+    QVERIFY(index->pointCount() == points);
+
+    // windows within a bin, across bins and beyond the m/z range
+    vector<mzSlice> slices;
+    slices.push_back(mzSlice(402.9929f, 402.9969f, 12.0f, 16.0f));
+    slices.push_back(mzSlice(180.0f, 181.0f, 0.0f, 2.0f));
+    slices.push_back(mzSlice(150.0f, 450.0f, 5.0f, 5.5f));
+    slices.push_back(mzSlice(0.0f, 2000.0f, 10.0f, 10.5f));
+
+    for (int eicType = 0; eicType < 2; eicType++) {
+        for (mzSlice& slice : slices) {
+            EIC fromScans;
+            fromScans.makeEICSlice(mzsample,
+                                   slice.mzmin,
+                                   slice.mzmax,
+                                   slice.rtmin,
+                                   slice.rtmax,
+                                   1,
+                                   eicType,
+                                   "");
+            EIC fromIndex;
+            fromIndex.makeEICSlice(&indexed,
+                                   slice.mzmin,
+                                   slice.mzmax,
+                                   slice.rtmin,
+                                   slice.rtmax,
+                                   1,
+                                   eicType,
+                                   "");
+            QVERIFY(fromScans.size() > 0);
+            QVERIFY(fromIndex.scannum == fromScans.scannum);
+            QVERIFY(fromIndex.rt == fromScans.rt);
+            QVERIFY(fromIndex.intensity == fromScans.intensity);
+            QVERIFY(fromIndex.maxIntensity == fromScans.maxIntensity);
+            for (unsigned int i = 0; i < fromScans.size(); i++) {
+                QVERIFY(fromIndex.mz[i] == fromScans.mz[i]
+                        || (isnan(fromIndex.mz[i]) && isnan(fromScans.mz[i])));
+            }
+        }
+    }
+
+    // an index that does not fit the limit is not built
+    mzSample limited;
+    limited.setMzRtIndexLimit(1);
+    limited.loadSample("bin/methods/testsample_2.mzxml");
+    QVERIFY(limited.mzRtIndex() == nullptr);
+}
+
 void TestEIC::testcomputeSpline()
 {
     EIC* e = maventests::samples.ms1TestSamples[0]->getEIC(402.9929f,
@@ -80,6 +510,61 @@ void TestEIC::testcomputeSpline()
     QVERIFY(true);
 }
 
+void TestEIC::testsmoothersMatchPerPointSums()
+{
+    unsigned int seed = 17;
+    for (int size : {1, 2, 3, 4, 7, 10, 16, 33, 101}) {
+        vector<float> intensity(size);
+        for (int i = 0; i < size; i++) {
+            seed = seed * 1103515245 + 12345;
+            intensity[i] = (seed >> 8) % 5 == 0 ? 0 : (seed >> 8) % 100000;
+        }
+
+        // windows up to well past the length of the EIC, called directly as
+        // the spline clamps them to a third of it
+        for (int window = 1; window <= size + 5; window++) {
+            vector<float> smoothed(size);
+            mzUtils::SavGolSmoother savgol(window, window, 4);
+            savgol.Smooth(intensity.data(), smoothed.data(), size);
+            QVERIFY(sameValues(smoothed.data(),
+                               referenceSavGol(intensity, window)));
+            for (int i = 0; i < min(window, size); i++)
+                QVERIFY(smoothed[i] == intensity[i]);
+            for (int i = max(0, size - window - 1); i < size; i++)
+                QVERIFY(smoothed[i] == intensity[i]);
+
+            mzUtils::smoothAverage(intensity.data(), smoothed.data(), window,
+                                   size);
+            QVERIFY(sameValues(smoothed.data(),
+                               referenceAverage(intensity, window)));
+
+            smoothed = intensity;
+            mzUtils::gaussian1d_smoothing(size, window, smoothed.data());
+            QVERIFY(sameValues(smoothed.data(),
+                               referenceGaussian(intensity, window)));
+        }
+
+        // splines of an EIC of the same intensities
+        EIC e;
+        e.intensity = intensity;
+        for (int window = 1; window <= size; window += 2) {
+            int clamped = min(window, size / 3);
+            for (auto type : {EIC::SAVGOL, EIC::GAUSSIAN, EIC::AVG}) {
+                e.setSmootherType(type);
+                e.computeSpline(window);
+                vector<float> expected = intensity;
+                if (clamped > 1 && type == EIC::SAVGOL)
+                    expected = referenceSavGol(intensity, clamped);
+                if (clamped > 1 && type == EIC::GAUSSIAN)
+                    expected = referenceGaussian(intensity, clamped);
+                if (clamped > 1 && type == EIC::AVG)
+                    expected = referenceAverage(intensity, clamped);
+                QVERIFY(sameValues(e.spline, expected));
+            }
+        }
+    }
+}
+
 void TestEIC::testgetPeakPositions()
 {
     EIC* e = maventests::samples.ms1TestSamples[0]->getEIC(402.9929f,
@@ -154,6 +639,51 @@ void TestEIC::testcomputeBaselineAsLSSmoothing()
     delete e;
 }
 
+void TestEIC::testcomputeBaselineAsLSMatchesDenseSolve()
+{
+    vector<vector<float>> intensities = {{5.0f},
+                                         {5.0f, 7.0f},
+                                         {5.0f, 7.0f, 4.0f},
+                                         {1.0f, 9.0f, 3.0f, 2.0f},
+                                         vector<float>(40, 0.0f),
+                                         vector<float>(40, 100.0f)};
+
+    // peaks over a noisy baseline, short enough not to be resampled
+    vector<float> peaks;
+    for (int i = 0; i < 60; i++) {
+        peaks.push_back(1000.0f + 300.0f * sin(i * 1.7f)
+                        + 5e4f * exp(-(i - 20) * (i - 20) / 8.0f)
+                        + 2e4f * exp(-(i - 45) * (i - 45) / 3.0f));
+    }
+    intensities.push_back(peaks);
+
+    for (auto& intensity : intensities) {
+        for (int smoothness = 0; smoothness <= 4; smoothness++) {
+            for (int asymmetry : {8, 50}) {
+                EIC e;
+                e.intensity = intensity;
+                e.setBaselineMode(EIC::BaselineMode::AsLSSmoothing);
+                e.setAsLSSmoothness(smoothness);
+                e.setAsLSAsymmetry(asymmetry);
+                e.computeBaseline();
+
+                vector<float> expected = referenceAsLSBaseline(
+                    intensity,
+                    pow(10.0, smoothness),
+                    asymmetry / 100.0);
+                QVERIFY(sameValues(e.baseline, expected));
+
+                // without second differences the baseline fits the signal
+                if (intensity.size() < 3) {
+                    QVERIFY(equal(intensity.begin(),
+                                  intensity.end(),
+                                  e.baseline));
+                }
+            }
+        }
+    }
+}
+
 void TestEIC::testcomputeBaselineZeroIntensity()
 {
     // obtain a zero intensity EIC (all entries in intensity vector are zero)
@@ -405,3 +935,156 @@ void TestEIC:: testeicMerge() {
     QVERIFY(17.039 < m->rtmax < 17.040);
 }
 
+void TestEIC::testEICPool() {
+    size_t maxPooled = EICPool::maxPooled();
+    EICPool::clear();
+    EICPool::resetStats();
+
+    EIC* eic = EICPool::acquire();
+    eic->intensity = vector<float>(10, 1.0f);
+    eic->computeSpline(5);
+    EICPool::release(eic);
+    QVERIFY(EICPool::pooled() == 1);
+
+    // a released EIC comes back reset, keeping its spline buffer
+    EIC* reused = EICPool::acquire();
+    QVERIFY(reused == eic);
+    QVERIFY(reused->intensity.empty());
+    QVERIFY(reused->spline == NULL);
+    reused->intensity = vector<float>(10, 1.0f);
+    reused->computeSpline(5);
+
+    EICPool::Stats stats = EICPool::stats();
+    QVERIFY(stats.acquired == 2);
+    QVERIFY(stats.reused == 1);
+    QVERIFY(stats.released == 1);
+    QVERIFY(stats.discarded == 0);
+    QVERIFY(stats.bufferAllocations == 1);
+
+    // a full pool deletes the EICs it is given
+    EICPool::setMaxPooled(1);
+    vector<EIC*> eics = {reused, EICPool::acquire()};
+    EICPool::release(eics);
+    QVERIFY(eics.empty());
+    QVERIFY(EICPool::pooled() == 1);
+    stats = EICPool::stats();
+    QVERIFY(stats.acquired == 3);
+    QVERIFY(stats.reused == 1);
+    QVERIFY(stats.released == 3);
+    QVERIFY(stats.discarded == 1);
+    EICPool::setMaxPooled(maxPooled);
+
+    // pools of worker threads are freed by whichever thread clears them
+    #pragma omp parallel num_threads(4)
+    EICPool::release(EICPool::acquire());
+    QVERIFY(EICPool::pooled() >= 1);
+    EICPool::clear();
+    QVERIFY(EICPool::pooled() == 0);
+
+    EICPool::resetStats();
+    #pragma omp parallel num_threads(4)
+    EICPool::release(EICPool::acquire());
+    QVERIFY(EICPool::stats().reused == 0);
+    EICPool::clear();
+}
+
+void TestEIC::testgroupPeaksMatchesLinearWalk()
+{
+    // flat tops, peaks at the edges of the EIC, single point peaks and
+    // neighbouring peaks of uneven width
+    vector<float> flatTops(200, 0.0f);
+    for (int i = 20; i < 200; i += 45) {
+        for (int j = -8; j <= 8; j++)
+            flatTops[i + j] = 1000.0f - 100.0f * max(0, abs(j) - 4);
+    }
+    vector<float> edgePeaks(200, 0.0f);
+    for (int j = 0; j < 12; j++) {
+        edgePeaks[j] = 2000.0f - 150.0f * j;
+        edgePeaks[199 - j] = 1500.0f - 120.0f * j;
+    }
+    edgePeaks[100] = 800.0f;
+    vector<float> singlePoints(200, 0.0f);
+    for (int i = 5; i < 200; i += 17)
+        singlePoints[i] = 500.0f + 10.0f * i;
+    vector<float> uneven(200, 10.0f);
+    for (int j = -30; j <= 30; j++)
+        uneven[70 + j] += 3000.0f * exp(-j * j / 200.0f);
+    for (int j = -3; j <= 3; j++)
+        uneven[110 + j] += 1200.0f * exp(-j * j / 2.0f);
+    uneven[111] = uneven[112];
+
+    vector<vector<float>> intensities = {flatTops,
+                                         edgePeaks,
+                                         singlePoints,
+                                         uneven};
+    vector<float> rtStarts = {1.0f, 1.03f, 0.98f, 1.11f};
+    int smoothingWindow = 2;
+
+    mzSlice* slice = new mzSlice(99.9f, 100.1f, 0.0f, 5.0f);
+    vector<EIC*> eics;
+    for (unsigned int i = 0; i < intensities.size(); i++) {
+        eics.push_back(syntheticEic(intensities[i],
+                                    rtStarts[i],
+                                    smoothingWindow));
+        QVERIFY(eics[i]->peaks.size() > 0);
+    }
+
+    for (bool useOverlap : {false, true}) {
+        for (float maxRtDiff : {0.0f, 0.02f, 0.2f, 1.0f, 10.0f}) {
+            vector<vector<int>> groupNums;
+            vector<PeakGroup> expected = referenceGroups(eics,
+                                                         smoothingWindow,
+                                                         maxRtDiff,
+                                                         1.0,
+                                                         5.0,
+                                                         2.0,
+                                                         useOverlap,
+                                                         groupNums);
+            vector<PeakGroup> peakgroups = EIC::groupPeaks(eics,
+                                                           slice,
+                                                           smoothingWindow,
+                                                           maxRtDiff,
+                                                           0.0,
+                                                           1.0,
+                                                           5.0,
+                                                           2.0,
+                                                           useOverlap,
+                                                           0.0,
+                                                           20.0f,
+                                                           "Dot Product");
+
+            // every sample peak is grouped with the same merged peak, so
+            // the groups hold the same peaks with the same bounds
+            for (unsigned int i = 0; i < eics.size(); i++) {
+                for (unsigned int j = 0; j < eics[i]->peaks.size(); j++)
+                    QVERIFY(eics[i]->peaks[j].groupNum == groupNums[i][j]);
+            }
+            QVERIFY(peakgroups.size() == expected.size());
+            for (unsigned int i = 0;
+                 i < peakgroups.size() && i < expected.size();
+                 i++) {
+                QVERIFY(peakgroups[i].peaks.size()
+                        == expected[i].peaks.size());
+                for (unsigned int j = 0;
+                     j < peakgroups[i].peaks.size()
+                     && j < expected[i].peaks.size();
+                     j++) {
+                    Peak& peak = peakgroups[i].peaks[j];
+                    Peak& expectedPeak = expected[i].peaks[j];
+                    QVERIFY(peak.getSample() == expectedPeak.getSample());
+                    QVERIFY(peak.pos == expectedPeak.pos);
+                    QVERIFY(peak.minpos == expectedPeak.minpos);
+                    QVERIFY(peak.maxpos == expectedPeak.maxpos);
+                    QVERIFY(peak.splineminpos == expectedPeak.splineminpos);
+                    QVERIFY(peak.splinemaxpos == expectedPeak.splinemaxpos);
+                }
+            }
+        }
+    }
+
+    for (auto eic : eics) {
+        delete eic->sample;
+        delete eic;
+    }
+    delete slice;
+}
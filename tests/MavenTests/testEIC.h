@@ -25,16 +25,23 @@ class TestEIC : public QObject {
         // this is automatically detected thanks to Qt's meta-information about QObjects
         void testgetEIC();
         void testgetEICms2();
+        void testgetEICFromScanColumns();
+        void testgetEICs();
+        void testgetEICFromMzRtIndex();
         void testcomputeSpline();
+        void testsmoothersMatchPerPointSums();
         void testgetPeakPositions();
         void testcomputeBaselineThreshold();
         void testcomputeBaselineAsLSSmoothing();
+        void testcomputeBaselineAsLSMatchesDenseSolve();
         void testcomputeBaselineZeroIntensity();
         void testcomputeBaselineEmptyEIC();
         void testfindPeakBounds();
         void testGetPeakDetails();
         void testgroupPeaks();
+        void testgroupPeaksMatchesLinearWalk();
         void testeicMerge();
+        void testEICPool();
 };
 
 #endif // TESTEIC_H
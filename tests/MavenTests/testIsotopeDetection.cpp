@@ -2,14 +2,158 @@
 #include "Compound.h"
 #include "constants.h"
 #include "classifierNeuralNet.h"
+#include "EIC.h"
 #include "isotopeDetection.h"
 #include "masscutofftype.h"
 #include "mavenparameters.h"
 #include "mzSample.h"
 #include "PeakDetector.h"
+#include "peakFiltering.h"
 #include "PeakGroup.h"
+#include "Scan.h"
 #include "utilities.h"
 
+namespace {
+    // Nearest peak of every isotope of a parent in one sample, searched one
+    // isotope after another with a parent EIC pulled for every isotope that
+    // is checked for correlation, as getIsotopes did before sharing the
+    // parent EIC of a sample between its isotopes.
+    map<string, Peak> uncachedIsotopePeaks(IsotopeDetection& isotopeDetection,
+                                           MavenParameters* mavenparameters,
+                                           PeakGroup* parentgroup,
+                                           vector<Isotope>& masslist,
+                                           mzSample* sample)
+    {
+        map<string, Peak> peaks;
+        Peak* parentPeak = parentgroup->getPeak(sample);
+        if (parentPeak == NULL)
+            return peaks;
+
+        MassCutoff* massCutoff = mavenparameters->compoundMassCutoffWindow;
+        for (auto& x : masslist) {
+            float mzmin = x.mass - massCutoff->massCutoffValue(x.mass);
+            float mzmax = x.mass + massCutoff->massCutoffValue(x.mass);
+            pair<float, float> isotope =
+                isotopeDetection.getIntensity(parentPeak->getScan(),
+                                              mzmin,
+                                              mzmax);
+            float rt = isotope.second;
+            if (isotope.first == 0 || rt == 0)
+                continue;
+            if (isotopeDetection.filterIsotope(x,
+                                               isotope.first,
+                                               parentPeak->peakIntensity,
+                                               sample,
+                                               parentgroup))
+                continue;
+
+            EIC* eic = sample->getEIC(mzmin,
+                                      mzmax,
+                                      sample->minRt,
+                                      sample->maxRt,
+                                      1,
+                                      mavenparameters->eicType,
+                                      mavenparameters->filterline);
+            eic->setSmootherType(static_cast<EIC::SmootherType>(
+                mavenparameters->eic_smoothingAlgorithm));
+            eic->setBaselineSmoothingWindow(
+                mavenparameters->baseline_smoothingWindow);
+            eic->setBaselineDropTopX(mavenparameters->baseline_dropTopX);
+            eic->setFilterSignalBaselineDiff(
+                mavenparameters->isotopicMinSignalBaselineDifference);
+            eic->getPeakPositions(mavenparameters->eic_smoothingWindow);
+            vector<Peak> allPeaks = eic->peaks;
+            delete eic;
+
+            if (mavenparameters->clsf->hasModel()) {
+                for (Peak& peak : allPeaks)
+                    peak.quality = mavenparameters->clsf->scorePeak(peak);
+            }
+            PeakFiltering peakFiltering(mavenparameters, true);
+            peakFiltering.filter(allPeaks);
+
+            float maxRtDiff = mavenparameters->maxIsotopeScanDiff
+                              * mavenparameters->avgScanTime;
+            Peak* nearestPeak = NULL;
+            float d = FLT_MAX;
+            for (auto& peak : allPeaks) {
+                float dist = abs(peak.rt - rt);
+                if (dist <= maxRtDiff && dist < d) {
+                    d = dist;
+                    nearestPeak = &peak;
+                }
+            }
+            if (nearestPeak)
+                peaks[x.name] = *nearestPeak;
+        }
+        return peaks;
+    }
+
+    // same isotopes, in the same order, with the same peaks in every sample
+    bool sameChildren(PeakGroup& a, PeakGroup& b)
+    {
+        if (a.children.size() != b.children.size())
+            return false;
+
+        for (unsigned int i = 0; i < a.children.size(); i++) {
+            PeakGroup& x = a.children[i];
+            PeakGroup& y = b.children[i];
+            if (x.tagString != y.tagString || x.meanMz != y.meanMz
+                || x.peaks.size() != y.peaks.size())
+                return false;
+
+            for (unsigned int j = 0; j < x.peaks.size(); j++) {
+                Peak& p = x.peaks[j];
+                Peak& q = y.peaks[j];
+                if (p.getSample() != q.getSample() || p.scan != q.scan
+                    || p.peakIntensity != q.peakIntensity
+                    || p.peakAreaCorrected != q.peakAreaCorrected)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // isotopes of one parent group, its samples searched with the given
+    // number of threads
+    void pullIsotopesWithThreads(int threads,
+                                 MavenParameters* mavenparameters,
+                                 PeakGroup& parent)
+    {
+        int maxThreads = omp_get_max_threads();
+        omp_set_num_threads(threads);
+
+        IsotopeDetection isotopeDetection(
+            mavenparameters,
+            IsotopeDetection::PeakDetection,
+            mavenparameters->C13Labeled_BPE,
+            mavenparameters->N15Labeled_BPE,
+            mavenparameters->S34Labeled_BPE,
+            mavenparameters->D2Labeled_BPE
+        );
+        isotopeDetection.pullIsotopes(&parent);
+
+        omp_set_num_threads(maxThreads);
+    }
+
+    // isotopes of all parent groups, the groups searched with the given
+    // number of threads
+    vector<PeakGroup> isotopesWithThreads(int threads,
+                                          PeakDetector& peakDetector,
+                                          MavenParameters* mavenparameters,
+                                          vector<PeakGroup>& parents)
+    {
+        int maxThreads = omp_get_max_threads();
+        omp_set_num_threads(threads);
+
+        mavenparameters->allgroups = parents;
+        peakDetector.pullAllIsotopes();
+
+        omp_set_num_threads(maxThreads);
+        return mavenparameters->allgroups;
+    }
+}
+
 TestIsotopeDetection::TestIsotopeDetection() {
     loadCompoundDB = "bin/methods/KNOWNS.csv";
     files << "bin/methods/testsample_2.mzxml" << "bin/methods/testsample_3.mzxml";
@@ -109,6 +253,78 @@ void TestIsotopeDetection::testgetIsotopes() {
     QVERIFY((isotopes["C13-label-2"].getPeak(samplesToLoad[1])->quality - 0.2) < 0.05);
 }
 
+void TestIsotopeDetection::testWindowedIsotopeEic() {
+    vector<mzSample*> samplesToLoad;
+
+    for (int i = 0; i < files.size(); ++i) {
+        mzSample* mzsample = new mzSample();
+        mzsample->loadSample(files.at(i).toLatin1().data());
+        samplesToLoad.push_back(mzsample);
+    }
+
+    MavenParameters* mavenparameters = new MavenParameters();
+    mavenparameters->compoundMassCutoffWindow->setMassCutoffAndType(10,"ppm");
+    ClassifierNeuralNet* clsf = new ClassifierNeuralNet();
+    clsf->loadModel("bin/default.model");
+    mavenparameters->clsf = clsf;
+    mavenparameters->ionizationMode = -1;
+    mavenparameters->matchRtFlag = false;
+    mavenparameters->samples = samplesToLoad;
+    mavenparameters->eic_smoothingWindow = 10;
+    mavenparameters->eic_smoothingAlgorithm = 1;
+    mavenparameters->baseline_smoothingWindow = 5;
+    mavenparameters->baseline_dropTopX = 80;
+
+    PeakDetector peakDetector;
+    peakDetector.setMavenParameters(mavenparameters);
+    const char* loadCompoundDB = "bin/methods/qe3_v11_2016_04_29.csv";
+
+    maventests::database.loadCompoundCSVFile(loadCompoundDB);
+    vector<Compound*> compounds = maventests::database.getCompoundsSubset("qe3_v11_2016_04_29");
+    vector<mzSlice*> slices = peakDetector.processCompounds(compounds, "compounds");
+    peakDetector.processSlices(slices, "compounds");
+    PeakGroup* parentgroup = &mavenparameters->allgroups[0];
+
+    vector<Isotope> masslist = MassCalculator::computeIsotopes(
+        parentgroup->getCompound()->formula(),
+        mavenparameters->getCharge(parentgroup->getCompound()),
+        true,
+        false,
+        false,
+        true
+    );
+
+    IsotopeDetection isotopeDetection(
+        mavenparameters,
+        IsotopeDetection::PeakDetection,
+        true,
+        false,
+        false,
+        true
+    );
+
+    mavenparameters->windowedIsotopeEicFlag = false;
+    map<string, PeakGroup> fullRun = isotopeDetection.getIsotopes(parentgroup, masslist);
+    mavenparameters->windowedIsotopeEicFlag = true;
+    map<string, PeakGroup> windowed = isotopeDetection.getIsotopes(parentgroup, masslist);
+
+    //EICs around the parent find the same nearest peaks as full-run EICs
+    QVERIFY(windowed.size() == fullRun.size());
+    for (auto& isotope : fullRun) {
+        QVERIFY(windowed.count(isotope.first) == 1);
+        PeakGroup& group = windowed[isotope.first];
+        QVERIFY(group.peaks.size() == isotope.second.peaks.size());
+        for (auto sample : samplesToLoad) {
+            Peak* expected = isotope.second.getPeak(sample);
+            Peak* peak = group.getPeak(sample);
+            QVERIFY((expected == NULL) == (peak == NULL));
+            if (!expected) continue;
+            QVERIFY(peak->scan == expected->scan);
+            QVERIFY(peak->peakIntensity == expected->peakIntensity);
+        }
+    }
+}
+
 void TestIsotopeDetection::testpullIsotopes() {
     maventests::database.loadCompoundCSVFile(loadCompoundDB);
     vector<Compound*> compounds = maventests::database.getCompoundsSubset("KNOWNS");
@@ -244,3 +460,162 @@ void TestIsotopeDetection::testpullIsotopes() {
     QVERIFY(D2_BPE == 0);
     QVERIFY(C13_BPE > 0);
 }
+
+void TestIsotopeDetection::testCachedParentEic() {
+    vector<mzSample*> samplesToLoad;
+
+    for (int i = 0; i < files.size(); ++i) {
+        mzSample* mzsample = new mzSample();
+        mzsample->loadSample(files.at(i).toLatin1().data());
+        samplesToLoad.push_back(mzsample);
+    }
+
+    MavenParameters* mavenparameters = new MavenParameters();
+    mavenparameters->compoundMassCutoffWindow->setMassCutoffAndType(10,"ppm");
+    ClassifierNeuralNet* clsf = new ClassifierNeuralNet();
+    clsf->loadModel("bin/default.model");
+    mavenparameters->clsf = clsf;
+    mavenparameters->ionizationMode = -1;
+    mavenparameters->matchRtFlag = false;
+    mavenparameters->samples = samplesToLoad;
+    mavenparameters->eic_smoothingWindow = 10;
+    mavenparameters->eic_smoothingAlgorithm = 1;
+    mavenparameters->baseline_smoothingWindow = 5;
+    mavenparameters->baseline_dropTopX = 80;
+    mavenparameters->minIsotopicCorrelation = 0.5;
+
+    PeakDetector peakDetector;
+    peakDetector.setMavenParameters(mavenparameters);
+    const char* loadCompoundDB = "bin/methods/qe3_v11_2016_04_29.csv";
+
+    maventests::database.loadCompoundCSVFile(loadCompoundDB);
+    vector<Compound*> compounds = maventests::database.getCompoundsSubset("qe3_v11_2016_04_29");
+    vector<mzSlice*> slices = peakDetector.processCompounds(compounds, "compounds");
+    peakDetector.processSlices(slices, "compounds");
+
+    // natural abundance is checked for C13 only, so that the correlation of
+    // the other isotopes is computed against the parent EIC
+    IsotopeDetection isotopeDetection(
+        mavenparameters,
+        IsotopeDetection::PeakDetection,
+        false,
+        true,
+        true,
+        true
+    );
+
+    unsigned int groupCount = min(static_cast<size_t>(10),
+                                  mavenparameters->allgroups.size());
+    QVERIFY(groupCount > 0);
+    for (unsigned int i = 0; i < groupCount; i++) {
+        PeakGroup* parentgroup = &mavenparameters->allgroups[i];
+        vector<Isotope> masslist = MassCalculator::computeIsotopes(
+            parentgroup->getCompound()->formula(),
+            mavenparameters->getCharge(parentgroup->getCompound()),
+            false,
+            true,
+            true,
+            true
+        );
+        map<string, PeakGroup> isotopes = isotopeDetection.getIsotopes(parentgroup, masslist);
+
+        for (auto sample : samplesToLoad) {
+            map<string, Peak> expected = uncachedIsotopePeaks(isotopeDetection,
+                                                              mavenparameters,
+                                                              parentgroup,
+                                                              masslist,
+                                                              sample);
+            for (auto& x : masslist) {
+                Peak* peak = NULL;
+                if (isotopes.count(x.name))
+                    peak = isotopes[x.name].getPeak(sample);
+                QVERIFY((peak != NULL) == (expected.count(x.name) == 1));
+                if (!peak) continue;
+                QVERIFY(peak->scan == expected[x.name].scan);
+                QVERIFY(peak->peakIntensity == expected[x.name].peakIntensity);
+            }
+        }
+    }
+
+    // a group without compound is not correlated against any parent
+    PeakGroup orphan = mavenparameters->allgroups[0];
+    orphan.setCompound(NULL);
+    Isotope isotope("D2-label-1", orphan.meanMz + 1.00628f, 0, 0, 0, 1);
+    QVERIFY(!isotopeDetection.filterIsotope(isotope,
+                                            1000.0f,
+                                            10000.0f,
+                                            samplesToLoad[0],
+                                            &orphan));
+}
+
+void TestIsotopeDetection::testIsotopesAcrossThreads() {
+    maventests::database.loadCompoundCSVFile(loadCompoundDB);
+    vector<Compound*> compounds = maventests::database.getCompoundsSubset("KNOWNS");
+    vector<mzSample*> samplesToLoad;
+
+    for (int i = 0; i < files.size(); ++i) {
+        mzSample* mzsample = new mzSample();
+        mzsample->loadSample(files.at(i).toLatin1().data());
+        samplesToLoad.push_back(mzsample);
+    }
+
+    MavenParameters* mavenparameters = new MavenParameters();
+    mavenparameters->compoundMassCutoffWindow->setMassCutoffAndType(10,"ppm");
+    ClassifierNeuralNet* clsf = new ClassifierNeuralNet();
+    clsf->loadModel("bin/default.model");
+    mavenparameters->clsf = clsf;
+    mavenparameters->ionizationMode = +1;
+    mavenparameters->matchRtFlag = true;
+    mavenparameters->compoundRTWindow = 2;
+    mavenparameters->samples = samplesToLoad;
+    mavenparameters->eic_smoothingWindow = 10;
+    mavenparameters->eic_smoothingAlgorithm = 1;
+    mavenparameters->baseline_smoothingWindow = 5;
+    mavenparameters->baseline_dropTopX = 80;
+    mavenparameters->showProgressFlag = false;
+    mavenparameters->pullIsotopesFlag = true;
+    mavenparameters->C13Labeled_BPE = true;
+    mavenparameters->N15Labeled_BPE = true;
+    mavenparameters->S34Labeled_BPE = true;
+    mavenparameters->D2Labeled_BPE = true;
+    mavenparameters->minIsotopicCorrelation = 0.2;
+
+    PeakDetector peakDetector;
+    peakDetector.setMavenParameters(mavenparameters);
+    vector<mzSlice*> slices = peakDetector.processCompounds(compounds, "compounds");
+    peakDetector.processSlices(slices, "compounds");
+    vector<PeakGroup> parents = mavenparameters->allgroups;
+    QVERIFY(parents.size() > 0);
+
+    int threads = max(4, omp_get_num_procs());
+
+    // the samples of a parent group searched in parallel
+    unsigned int childCount = 0;
+    for (unsigned int i = 0; i < parents.size() && i < 10; i++) {
+        PeakGroup serialParent = parents[i];
+        PeakGroup parallelParent = parents[i];
+        pullIsotopesWithThreads(1, mavenparameters, serialParent);
+        pullIsotopesWithThreads(threads, mavenparameters, parallelParent);
+        childCount += serialParent.childCount();
+        QVERIFY(sameChildren(serialParent, parallelParent));
+    }
+    QVERIFY(childCount > 0);
+
+    // parent groups searched in parallel
+    vector<PeakGroup> serial = isotopesWithThreads(1,
+                                                   peakDetector,
+                                                   mavenparameters,
+                                                   parents);
+    vector<PeakGroup> parallel = isotopesWithThreads(threads,
+                                                     peakDetector,
+                                                     mavenparameters,
+                                                     parents);
+    QVERIFY(serial.size() == parallel.size());
+
+    childCount = 0;
+    for (unsigned int i = 0; i < serial.size() && i < parallel.size(); i++) {
+        childCount += serial[i].childCount();
+        QVERIFY(sameChildren(serial[i], parallel[i]));
+    }
+    QVERIFY(childCount > 0);
+}
@@ -28,6 +28,9 @@ class TestIsotopeDetection : public QObject {
         // this is automatically detected thanks to Qt's meta-information about QObjects
         void testpullIsotopes();
         void testgetIsotopes();
+        void testWindowedIsotopeEic();
+        void testCachedParentEic();
+        void testIsotopesAcrossThreads();
 };
 
 #endif // TESTISOTOPEDETECTION_H
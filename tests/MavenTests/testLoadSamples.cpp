@@ -1,9 +1,163 @@
 #include "testLoadSamples.h"
+#include "datastructures/mzSlice.h"
 #include "mavenparameters.h"
 #include "mzSample.h"
+#include "samplecache.h"
 #include "Scan.h"
 #include "utilities.h"
 
+#include <algorithm>
+#include <functional>
+#include <numeric>
+
+namespace {
+    // base64 of the little endian values, optionally zlib compressed
+    QByteArray encodeArray(const vector<double>& values,
+                           bool doublePrecision,
+                           bool compress)
+    {
+        QByteArray bytes;
+        for (double value : values) {
+            if (doublePrecision) {
+                bytes.append(reinterpret_cast<const char*>(&value),
+                             sizeof(double));
+            } else {
+                float v = static_cast<float>(value);
+                bytes.append(reinterpret_cast<const char*>(&v), sizeof(float));
+            }
+        }
+        // qCompress puts the uncompressed size in front of the zlib stream
+        if (compress)
+            bytes = qCompress(bytes).mid(4);
+        return bytes.toBase64();
+    }
+
+    // mzML file with MS1 spectra, each followed by MS2 spectra, large enough
+    // to be read in several chunks and decoded in several batches
+    QByteArray spectraMzML(int spectrumCount, int peakCount)
+    {
+        QByteArray xml;
+        xml += "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<mzML>\n";
+        xml += "<run id=\"run\" startTimeStamp=\"2017-08-01T01:41:52Z\">\n";
+        xml += "<spectrumList count=\"" + QByteArray::number(spectrumCount)
+               + "\">\n";
+        for (int i = 0; i < spectrumCount; i++) {
+            int mslevel = i % 4 == 0 ? 1 : 2;
+            vector<double> mzs;
+            vector<double> intensities;
+            for (int k = 0; k < peakCount; k++) {
+                mzs.push_back(100.0 + k * 3.7 + i * 0.001);
+                intensities.push_back(1000.0 + (i * 31 + k * 17) % 5000);
+            }
+            bool doublePrecision = i % 2 == 0;
+            bool compress = i % 3 != 0;
+
+            xml += "<spectrum index=\"" + QByteArray::number(i)
+                   + "\" id=\"scan=" + QByteArray::number(i + 1) + "\">\n";
+            xml += "<cvParam name=\"ms level\" value=\""
+                   + QByteArray::number(mslevel) + "\"/>\n";
+            xml += "<cvParam name=\"positive scan\" value=\"\"/>\n";
+
+            // spectrum summaries, which let indexed files be loaded lazily
+            double basePeak = *max_element(intensities.begin(),
+                                           intensities.end());
+            double totalIntensity = accumulate(intensities.begin(),
+                                               intensities.end(),
+                                               0.0);
+            xml += "<cvParam name=\"lowest observed m/z\" value=\""
+                   + QByteArray::number(mzs.front(), 'f', 4) + "\"/>\n";
+            xml += "<cvParam name=\"highest observed m/z\" value=\""
+                   + QByteArray::number(mzs.back(), 'f', 4) + "\"/>\n";
+            xml += "<cvParam name=\"base peak intensity\" value=\""
+                   + QByteArray::number(basePeak) + "\"/>\n";
+            xml += "<cvParam name=\"total ion current\" value=\""
+                   + QByteArray::number(totalIntensity) + "\"/>\n";
+            xml += "<scanList count=\"1\"><scan>"
+                   "<cvParam name=\"scan start time\" value=\""
+                   + QByteArray::number(i * 0.01) + "\" unitName=\"minute\"/>"
+                   "</scan></scanList>\n";
+            if (mslevel == 2) {
+                xml += "<precursorList count=\"1\"><precursor>"
+                       "<isolationWindow><cvParam name=\"isolation window "
+                       "target m/z\" value=\""
+                       + QByteArray::number(mzs[i % peakCount] + 0.0004, 'f', 4)
+                       + "\"/></isolationWindow></precursor></precursorList>\n";
+            }
+            xml += "<binaryDataArrayList count=\"2\">\n";
+            for (bool isMz : {true, false}) {
+                xml += "<binaryDataArray>";
+                xml += doublePrecision ? "<cvParam name=\"64-bit float\"/>"
+                                       : "<cvParam name=\"32-bit float\"/>";
+                xml += compress ? "<cvParam name=\"zlib compression\"/>"
+                                : "<cvParam name=\"no compression\"/>";
+                xml += isMz ? "<cvParam name=\"m/z array\"/>"
+                            : "<cvParam name=\"intensity array\"/>";
+                xml += "<binary>"
+                       + encodeArray(isMz ? mzs : intensities,
+                                     doublePrecision,
+                                     compress)
+                       + "</binary></binaryDataArray>\n";
+            }
+            xml += "</binaryDataArrayList>\n</spectrum>\n";
+        }
+        xml += "</spectrumList>\n</run>\n</mzML>\n";
+        return xml;
+    }
+
+    // the file of spectraMzML wrapped as an indexedmzML file, with the byte
+    // offset of every spectrum in its index
+    QByteArray indexedSpectraMzML(int spectrumCount, int peakCount)
+    {
+        QByteArray mzml = spectraMzML(spectrumCount, peakCount);
+        int declarationEnd = mzml.indexOf('\n') + 1;
+        QByteArray xml = mzml.left(declarationEnd);
+        xml += "<indexedmzML>\n";
+        xml += mzml.mid(declarationEnd);
+
+        QByteArray index = "<indexList count=\"1\">\n"
+                           "<index name=\"spectrum\">\n";
+        int from = 0;
+        for (int i = 0; i < spectrumCount; i++) {
+            int offset = xml.indexOf("<spectrum ", from);
+            index += "<offset idRef=\"scan=" + QByteArray::number(i + 1)
+                     + "\">" + QByteArray::number(offset) + "</offset>\n";
+            from = offset + 1;
+        }
+        index += "</index>\n</indexList>\n";
+
+        int indexListOffset = xml.size();
+        xml += index;
+        xml += "<indexListOffset>" + QByteArray::number(indexListOffset)
+               + "</indexListOffset>\n</indexedmzML>\n";
+        return xml;
+    }
+
+    bool writeFile(const QString& path, const QByteArray& data)
+    {
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly)
+               && file.write(data) == data.size();
+    }
+
+    bool sameScans(mzSample& a, mzSample& b)
+    {
+        if (a.scanCount() != b.scanCount())
+            return false;
+        for (unsigned int i = 0; i < a.scanCount(); i++) {
+            Scan* x = a.scans[i];
+            Scan* y = b.scans[i];
+            if (x->scannum != y->scannum || x->rt != y->rt
+                || x->mslevel != y->mslevel || x->polarity != y->polarity
+                || x->precursorMz != y->precursorMz
+                || x->filterLine != y->filterLine || x->mz != y->mz
+                || x->intensity != y->intensity) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
 TestLoadSamples::TestLoadSamples() {
     loadFile = "bin/methods/testsample_1.mzxml";
     blankSample = "bin/methods/blank_1.mzxml";
@@ -194,3 +348,303 @@ void TestLoadSamples::testParseMzMLInjectionTimeStamp() {
     }
 
 }
+
+void TestLoadSamples::testStreamedMzMLParsing() {
+    const char* mzmlFile = "bin/methods/ms2test1.mzML";
+
+    // streamed parse, one element at a time
+    mzSample streamed;
+    streamed.parseMzML(mzmlFile);
+
+    // reference parse over a DOM of the whole document
+    pugi::xml_document doc;
+    doc.load_file(mzmlFile, pugi::parse_minimal);
+    xml_node chromatogramList =
+        doc.first_child().first_element_by_path("mzML/run/chromatogramList");
+    mzSample reference;
+    reference.parseMzMLChromatogramList(chromatogramList);
+
+    QVERIFY(streamed.scanCount() > 0);
+    QVERIFY(streamed.scanCount() == reference.scanCount());
+    QVERIFY(streamed.injectionTime == 1501551712);
+
+    for (unsigned int i = 0; i < streamed.scanCount(); i++) {
+        Scan* a = streamed.scans[i];
+        Scan* b = reference.scans[i];
+        QVERIFY(a->scannum == b->scannum);
+        QVERIFY(a->rt == b->rt);
+        QVERIFY(a->precursorMz == b->precursorMz);
+        QVERIFY(a->filterLine == b->filterLine);
+        QVERIFY(a->mz == b->mz);
+        QVERIFY(a->intensity == b->intensity);
+    }
+}
+
+void TestLoadSamples::testStreamedMzMLSpectra() {
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QString path = tempDir.path() + "/spectra.mzML";
+    int spectrumCount = 600;
+    int peakCount = 300;
+    QVERIFY(writeFile(path, spectraMzML(spectrumCount, peakCount)));
+    string mzmlFile = path.toStdString();
+
+    // streamed parse, spectra decoded by worker tasks
+    mzSample streamed;
+    streamed.parseMzML(mzmlFile.c_str());
+
+    // reference parse over a DOM of the whole document
+    pugi::xml_document doc;
+    QVERIFY(doc.load_file(mzmlFile.c_str(), pugi::parse_minimal));
+    xml_node spectrumList =
+        doc.first_element_by_path("mzML/run/spectrumList");
+    mzSample reference;
+    reference.parseMzMLSpectrumList(spectrumList);
+
+    QVERIFY(streamed.scanCount() == static_cast<unsigned int>(spectrumCount));
+    QVERIFY(sameScans(streamed, reference));
+
+    // and against the values that were written
+    for (unsigned int i = 0; i < streamed.scanCount(); i++) {
+        Scan* scan = streamed.scans[i];
+        QVERIFY(scan->mslevel == (i % 4 == 0 ? 1 : 2));
+        QVERIFY(TestUtils::floatCompare(scan->rt, i * 0.01));
+        QVERIFY(scan->nobs() == static_cast<unsigned int>(peakCount));
+        QVERIFY(scan->mz[7] == static_cast<float>(100.0 + 7 * 3.7 + i * 0.001));
+        QVERIFY(scan->intensity[7] == 1000.0f + (i * 31 + 7 * 17) % 5000);
+        if (scan->mslevel == 2) {
+            // snapped to the m/z of the preceding full scan
+            Scan* fullScan = streamed.scans[i - i % 4];
+            QVERIFY(scan->precursorMz == fullScan->mz[i % peakCount]);
+        }
+    }
+}
+
+void TestLoadSamples::testStreamedMzXMLParsing() {
+    // streamed parse, top level scans decoded by worker tasks
+    mzSample streamed;
+    streamed.parseMzXML(loadFile);
+
+    // reference parse over a DOM of the whole document, nested scans
+    // following their parent
+    pugi::xml_document doc;
+    QVERIFY(doc.load_file(loadFile, pugi::parse_minimal));
+    mzSample reference;
+    int scannum = 0;
+    std::function<void(xml_node)> addScans = [&](xml_node parent) {
+        for (xml_node scan = parent.child("scan"); scan;
+             scan = scan.next_sibling("scan")) {
+            reference.parseMzXMLScan(scan, scannum++);
+            addScans(scan);
+        }
+    };
+    addScans(doc.first_element_by_path("mzXML/msRun"));
+
+    QVERIFY(streamed.scanCount() == 1603);
+    QVERIFY(sameScans(streamed, reference));
+}
+
+void TestLoadSamples::testTruncatedFiles() {
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+
+    QByteArray mzml = spectraMzML(40, 50);
+    QFile mzxmlFile(loadFile);
+    QVERIFY(mzxmlFile.open(QIODevice::ReadOnly));
+    QByteArray mzxml = mzxmlFile.readAll();
+
+    // cut inside a spectrum and between two spectra
+    int betweenSpectra = mzml.indexOf("</spectrum>", mzml.size() / 2)
+                         + strlen("</spectrum>\n");
+    vector<pair<QString, QByteArray>> truncatedFiles = {
+        {"inside.mzML", mzml.left(mzml.size() / 2)},
+        {"between.mzML", mzml.left(betweenSpectra)},
+        {"inside.mzXML", mzxml.left(mzxml.size() / 2)}
+    };
+
+    for (const auto& truncated : truncatedFiles) {
+        QString path = tempDir.path() + "/" + truncated.first;
+        QVERIFY(writeFile(path, truncated.second));
+        string filename = path.toStdString();
+
+        bool failed = false;
+        try {
+            mzSample parsed;
+            if (path.endsWith(".mzML"))
+                parsed.parseMzML(filename.c_str());
+            else
+                parsed.parseMzXML(filename.c_str());
+        } catch (std::exception&) {
+            failed = true;
+        }
+        QVERIFY(failed);
+
+        // and is not loaded as a partial sample
+        mzSample loaded;
+        loaded.loadSample(filename.c_str());
+        QVERIFY(loaded.scanCount() == 0);
+    }
+
+    // the complete file loads
+    QString path = tempDir.path() + "/complete.mzML";
+    QVERIFY(writeFile(path, mzml));
+    mzSample complete;
+    complete.loadSample(path.toStdString().c_str());
+    QVERIFY(complete.scanCount() == 40);
+}
+
+void TestLoadSamples::testLazyLoading() {
+    const char* mzmlFile = "bin/methods/ms2test1.mzML";
+
+    mzSample eager;
+    eager.loadSample(mzmlFile);
+
+    // a file without a spectrum index is loaded in full even in lazy mode
+    mzSample lazy;
+    lazy.setLazyLoading(true);
+    lazy.loadSample(mzmlFile);
+
+    QVERIFY(lazy.scanCount() == eager.scanCount());
+    QVERIFY(TestUtils::floatCompare(lazy.minMz, eager.minMz));
+    QVERIFY(TestUtils::floatCompare(lazy.maxMz, eager.maxMz));
+
+    lazy.loadAllScanData();
+    for (unsigned int i = 0; i < lazy.scanCount(); i++) {
+        QVERIFY(lazy.scans[i]->isDataLoaded());
+        QVERIFY(!lazy.scans[i]->dataLoadFailed());
+        QVERIFY(lazy.scans[i]->intensity == eager.scans[i]->intensity);
+    }
+
+    // an indexed file only has its spectrum metadata read up front
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QString indexedFile = tempDir.path() + "/indexed.mzML";
+    const int spectrumCount = 200;
+    QByteArray indexedXml = indexedSpectraMzML(spectrumCount, 50);
+    QVERIFY(writeFile(indexedFile, indexedXml));
+    string indexedPath = indexedFile.toStdString();
+
+    mzSample indexedEager;
+    indexedEager.loadSample(indexedPath.c_str());
+    mzSample indexedLazy;
+    indexedLazy.setLazyLoading(true);
+    indexedLazy.loadSample(indexedPath.c_str());
+
+    QVERIFY(indexedEager.scanCount() == spectrumCount);
+    QVERIFY(indexedLazy.scanCount() == spectrumCount);
+    QVERIFY(TestUtils::floatCompare(indexedLazy.minMz, indexedEager.minMz));
+    QVERIFY(TestUtils::floatCompare(indexedLazy.maxMz, indexedEager.maxMz));
+    for (int i = 0; i < spectrumCount; i++) {
+        Scan* scan = indexedLazy.scans[i];
+        QVERIFY(scan->dataState() == Scan::DataState::Pending);
+        QVERIFY(scan->dataOffset
+                == indexedXml.indexOf("<spectrum index=\""
+                                      + QByteArray::number(i) + "\""));
+    }
+
+    // MS2 scans are matched on their recalculated precursor m/z, although
+    // it is only known once the scans have been decoded
+    for (auto scan : indexedEager.scans) {
+        if (scan->mslevel != 2)
+            continue;
+        mzSlice slice(scan->precursorMz - 0.0001f,
+                      scan->precursorMz + 0.0001f,
+                      0,
+                      1e4);
+        vector<Scan*> eagerEvents = indexedEager.getFragmentationEvents(&slice);
+        vector<Scan*> lazyEvents = indexedLazy.getFragmentationEvents(&slice);
+        QVERIFY(!eagerEvents.empty());
+        QVERIFY(lazyEvents.size() == eagerEvents.size());
+        for (size_t j = 0; j < lazyEvents.size(); j++)
+            QVERIFY(lazyEvents[j]->scannum == eagerEvents[j]->scannum);
+    }
+
+    // decoding MS2 scans before the full scans their precursor is taken from
+    for (int i = spectrumCount - 1; i >= 0; i--)
+        indexedLazy.scans[i]->nobs();
+    for (int i = 0; i < spectrumCount; i++) {
+        QVERIFY(indexedLazy.scans[i]->isDataLoaded());
+        QVERIFY(indexedLazy.scans[i]->mz == indexedEager.scans[i]->mz);
+        QVERIFY(indexedLazy.scans[i]->intensity
+                == indexedEager.scans[i]->intensity);
+        QVERIFY(indexedLazy.scans[i]->precursorMz
+                == indexedEager.scans[i]->precursorMz);
+    }
+    QVERIFY(sameScans(indexedLazy, indexedEager));
+}
+
+void TestLoadSamples::testSampleCache() {
+    // work on a copy, the cache is written next to the sample
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QString copy = tempDir.path() + "/ms2test1.mzML";
+    QVERIFY(QFile::copy("bin/methods/ms2test1.mzML", copy));
+    string mzmlFile = copy.toStdString();
+    string cacheFile = SampleCache::cachePath(mzmlFile);
+
+    mzSample parsed;
+    parsed.setSampleCaching(true);
+    parsed.loadSample(mzmlFile.c_str());
+    QVERIFY(QFile::exists(QString::fromStdString(cacheFile)));
+
+    mzSample cached;
+    QVERIFY(SampleCache::read(&cached, mzmlFile));
+    QVERIFY(cached.scanCount() == parsed.scanCount());
+    QVERIFY(cached.injectionTime == parsed.injectionTime);
+    for (unsigned int i = 0; i < cached.scanCount(); i++) {
+        QVERIFY(cached.scans[i]->mslevel == parsed.scans[i]->mslevel);
+        QVERIFY(cached.scans[i]->rt == parsed.scans[i]->rt);
+        QVERIFY(cached.scans[i]->precursorMz == parsed.scans[i]->precursorMz);
+        QVERIFY(cached.scans[i]->filterLine == parsed.scans[i]->filterLine);
+        QVERIFY(cached.scans[i]->mz == parsed.scans[i]->mz);
+        QVERIFY(cached.scans[i]->intensity == parsed.scans[i]->intensity);
+    }
+
+    // loading through the cache gives the same sample
+    mzSample reloaded;
+    reloaded.setSampleCaching(true);
+    reloaded.loadSample(mzmlFile.c_str());
+    QVERIFY(reloaded.scanCount() == parsed.scanCount());
+    QVERIFY(reloaded.srmScans.size() == parsed.srmScans.size());
+    QVERIFY(TestUtils::floatCompare(reloaded.minMz, parsed.minMz));
+    QVERIFY(TestUtils::floatCompare(reloaded.maxRt, parsed.maxRt));
+
+    // any change to the source invalidates the cache
+    QFile source(copy);
+    QVERIFY(source.open(QIODevice::Append));
+    source.write("\n");
+    source.close();
+    mzSample stale;
+    QVERIFY(!SampleCache::read(&stale, mzmlFile));
+    QVERIFY(stale.scanCount() == 0);
+}
+
+void TestLoadSamples::testRtIndex() {
+    mzSample* sample = maventests::samples.ms1TestSamples[0];
+    float rtmin = 12.0f;
+    float rtmax = 16.0f;
+
+    vector<unsigned int> expected;
+    for (unsigned int i = 0; i < sample->scans.size(); i++) {
+        Scan* scan = sample->scans[i];
+        if (scan->mslevel == 1 && scan->rt >= rtmin && scan->rt <= rtmax)
+            expected.push_back(i);
+    }
+    QVERIFY(!expected.empty());
+
+    vector<unsigned int> scratch;
+    const unsigned int *first, *last;
+    sample->scansInRtRange(1, rtmin, rtmax, scratch, first, last);
+    QVERIFY(scratch.empty());
+    QVERIFY(vector<unsigned int>(first, last) == expected);
+
+    // a sample that was not loaded from a file is looked up without index
+    mzSample manual;
+    for (unsigned int i : expected) {
+        Scan* scan = sample->scans[i];
+        manual.addScan(new Scan(&manual, i, 1, scan->rt, 0, 1));
+    }
+    manual.scansInRtRange(1, rtmin, rtmax, scratch, first, last);
+    QVERIFY(last - first == static_cast<long>(expected.size()));
+    QVERIFY(manual.scansOfMsLevel(2, scratch).empty());
+}
@@ -36,6 +36,13 @@ class TestLoadSamples : public QObject {
 #endif
         void testBlankSample();
         void testParseMzMLInjectionTimeStamp();
+        void testStreamedMzMLParsing();
+        void testStreamedMzMLSpectra();
+        void testStreamedMzXMLParsing();
+        void testTruncatedFiles();
+        void testLazyLoading();
+        void testSampleCache();
+        void testRtIndex();
 };
 
 #endif // TESTLOADSAMPLES_H
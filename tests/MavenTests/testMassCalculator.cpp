@@ -1,4 +1,5 @@
 #include "testMassCalculator.h"
+#include "Compound.h"
 #include "databases.h"
 #include "mzMassCalculator.h"
 #include "mzSample.h"
@@ -135,6 +136,60 @@ void TestMassCalculator::testComputeIsotopes() {
 
 }
 
+void TestMassCalculator::testIsotopeCache() {
+    string formula = "C12H18N4O4PS";
+    MassCalculator::clearIsotopeCache();
+
+    vector<Isotope> isotopes = MassCalculator::computeIsotopes(
+        formula, +1, true, true, false, false);
+    vector<Isotope> cached = MassCalculator::computeIsotopes(
+        formula, +1, true, true, false, false);
+
+    //second call is served from the cache with the same isotopes
+    MassCalculator::IsotopeCacheStats stats = MassCalculator::isotopeCacheStats();
+    QVERIFY(stats.misses == 1);
+    QVERIFY(stats.hits == 1);
+    QVERIFY(stats.entries == 1);
+    QVERIFY(cached.size() == isotopes.size());
+    for (unsigned int i = 0; i < isotopes.size(); i++) {
+        QVERIFY(cached[i].name == isotopes[i].name);
+        QVERIFY(cached[i].mass == isotopes[i].mass);
+        QVERIFY(cached[i].abundance == isotopes[i].abundance);
+    }
+
+    //charge and labels are part of the key
+    MassCalculator::computeIsotopes(formula, -1, true, true, false, false);
+    MassCalculator::computeIsotopes(formula, +1, true, false, false, false);
+    stats = MassCalculator::isotopeCacheStats();
+    QVERIFY(stats.misses == 3);
+    QVERIFY(stats.entries == 3);
+
+    MassCalculator::clearIsotopeCache();
+    stats = MassCalculator::isotopeCacheStats();
+    QVERIFY(stats.hits == 0 && stats.misses == 0 && stats.entries == 0);
+}
+
+void TestMassCalculator::testParseFormula() {
+    string XanthosineChe = "C10H12N4O6";
+    const ParsedFormula* parsed = MassCalculator::parseFormula(XanthosineChe);
+
+    //same formula is parsed once
+    QVERIFY(MassCalculator::parseFormula(XanthosineChe) == parsed);
+    //element counts
+    QVERIFY(parsed->elements.size() == 4);
+    QVERIFY(parsed->count("C") == 10);
+    QVERIFY(parsed->count("N") == 4);
+    QVERIFY(parsed->count("S") == 0);
+    //mass agrees with the string based entry points
+    QVERIFY(parsed->neutralMass == MassCalculator::computeNeutralMass(XanthosineChe));
+    QVERIFY(TestUtils::floatCompare(parsed->neutralMass, 284.075684));
+
+    //compounds share the parse of their formula
+    Compound compound("xanthosine", "xanthosine", XanthosineChe, 0);
+    QVERIFY(compound.parsedFormula() == parsed);
+    QVERIFY(compound.adjustedMass(-1) == (float) MassCalculator::computeMass(XanthosineChe, -1));
+}
+
 void TestMassCalculator::testenumerateMasses() {
     //TODO: have to add a test case for ennumurate mass
     // MassCalculator masCal;
@@ -0,0 +1,408 @@
+#include "testMassSlicer.h"
+#include "datastructures/mzSlice.h"
+#include "EIC.h"
+#include "masscutofftype.h"
+#include "mavenparameters.h"
+#include "mzMassSlicer.h"
+#include "mzSample.h"
+#include "PeakDetector.h"
+#include "Scan.h"
+#include "utilities.h"
+
+TestMassSlicer::TestMassSlicer() {
+
+}
+
+void TestMassSlicer::initTestCase() {
+    // This function is being executed at the beginning of each test suite
+    // That is - before other tests from this class run
+}
+
+void TestMassSlicer::cleanupTestCase() {
+    // Similarly to initTestCase(), this function is executed at the end of test suite
+}
+
+void TestMassSlicer::init() {
+    // This function is executed before each test
+}
+
+void TestMassSlicer::cleanup() {
+    // This function is executed after each test
+}
+
+namespace {
+    // Mass slicing as algorithmB did it before slices were reduced and
+    // merged in linear passes: a slice for every data point, a quadratic
+    // sweep reducing slices whose centres lie in each other, and a merge of
+    // related neighbours erasing every merged slice from the vector.
+    pair<bool, bool> referenceCompareSlices(vector<mzSample*>& samples,
+                                            mzSlice* slice,
+                                            mzSlice* comparisonSlice,
+                                            MassCutoff* massCutoff,
+                                            float rtTolerance)
+    {
+        float mzCenter = (slice->mz + comparisonSlice->mz) / 2.0f;
+        float massTolerance = 10.0f * massCutoff->massCutoffValue(mzCenter);
+        if (!(abs(mzCenter - slice->mz) <= massTolerance
+              && abs(mzCenter - comparisonSlice->mz) <= massTolerance)) {
+            return make_pair(false, false);
+        }
+
+        float rtMin = slice->rtmin;
+        float rtMax = slice->rtmax;
+        float comparisonRtMin = comparisonSlice->rtmin;
+        float comparisonRtMax = comparisonSlice->rtmax;
+        float commonLowerRt = 0.0f;
+        float commonUpperRt = 0.0f;
+        if (rtMin <= comparisonRtMin && rtMax >= comparisonRtMax) {
+            commonLowerRt = comparisonRtMin;
+            commonUpperRt = comparisonRtMax;
+        } else if (rtMin >= comparisonRtMin && rtMax <= comparisonRtMax) {
+            commonLowerRt = rtMin;
+            commonUpperRt = rtMax;
+        } else if (rtMin >= comparisonRtMin && rtMin <= comparisonRtMax) {
+            commonLowerRt = rtMin;
+            commonUpperRt = min(rtMax, comparisonRtMax);
+        } else if (rtMax >= comparisonRtMin && rtMax <= comparisonRtMax) {
+            commonLowerRt = max(rtMin, comparisonRtMin);
+            commonUpperRt = rtMax;
+        }
+        if (commonLowerRt == 0.0f && commonUpperRt == 0.0f)
+            return make_pair(false, true);
+
+        float highest[2] = {0.0f, 0.0f};
+        float rtAtHighest[2] = {0.0f, 0.0f};
+        float mzAtHighest[2] = {0.0f, 0.0f};
+        mzSlice* compared[2] = {slice, comparisonSlice};
+        for (auto sample : samples) {
+            for (int c = 0; c < 2; c++) {
+                EIC* eic = sample->getEIC(compared[c]->mzmin,
+                                          compared[c]->mzmax,
+                                          compared[c]->rtmin,
+                                          compared[c]->rtmax,
+                                          1,
+                                          1,
+                                          "");
+                if (highest[c] < eic->maxIntensity) {
+                    highest[c] = eic->maxIntensity;
+                    rtAtHighest[c] = eic->rtAtMaxIntensity;
+                    mzAtHighest[c] = eic->mzAtMaxIntensity;
+                }
+                delete eic;
+            }
+        }
+        if (highest[0] == 0.0f && highest[1] == 0.0f)
+            return make_pair(false, true);
+
+        float rtDelta = abs(rtAtHighest[0] - rtAtHighest[1]);
+        float mzCenterForIntensity = (mzAtHighest[0] + mzAtHighest[1]) / 2.0f;
+        float tolerance = massCutoff->massCutoffValue(mzCenterForIntensity);
+        return make_pair(rtDelta <= rtTolerance
+                             && abs(mzCenterForIntensity - mzAtHighest[0])
+                                    <= tolerance
+                             && abs(mzAtHighest[1] - mzCenterForIntensity)
+                                    <= tolerance,
+                         true);
+    }
+
+    // keeps the m/z window of a grown slice within the mass cutoff
+    void limitSliceWindow(mzSlice* slice, MassCutoff* massCutoff)
+    {
+        slice->mz = (slice->mzmin + slice->mzmax) / 2.0f;
+        slice->rt = (slice->rtmin + slice->rtmax) / 2.0f;
+        float cutoff = massCutoff->massCutoffValue(slice->mz);
+        if (slice->mzmin < slice->mz - cutoff)
+            slice->mzmin = slice->mz - cutoff;
+        if (slice->mzmax > slice->mz + cutoff)
+            slice->mzmax = slice->mz + cutoff;
+        slice->mz = (slice->mzmin + slice->mzmax) / 2.0f;
+    }
+
+    void growSlice(mzSlice* slice, const mzSlice* other)
+    {
+        slice->ionCount = max(slice->ionCount, other->ionCount);
+        slice->rtmax = max(slice->rtmax, other->rtmax);
+        slice->rtmin = min(slice->rtmin, other->rtmin);
+        slice->mzmax = max(slice->mzmax, other->mzmax);
+        slice->mzmin = min(slice->mzmin, other->mzmin);
+    }
+
+    vector<mzSlice*> referenceAlgorithmB(MavenParameters* mavenParameters,
+                                         float minMz,
+                                         float maxMz,
+                                         float minRt,
+                                         float maxRt)
+    {
+        vector<mzSample*>& samples = mavenParameters->samples;
+        MassCutoff* massCutoff = mavenParameters->massCutoffMerge;
+        float rtWindow = 0.0f;
+        for (auto sample : samples) {
+            rtWindow += sample->getAverageFullScanTime()
+                        * mavenParameters->rtStepSize;
+        }
+        rtWindow /= static_cast<float>(samples.size());
+
+        vector<mzSlice*> slices;
+        for (auto sample : samples) {
+            for (auto scan : sample->scans) {
+                if (scan->mslevel != 1
+                    || !isBetweenInclusive(scan->rt, minRt, maxRt))
+                    continue;
+                for (unsigned int k = 0; k < scan->nobs(); k++) {
+                    float mz = scan->mz[k];
+                    float intensity = scan->intensity[k];
+                    if (!isBetweenInclusive(mz, minMz, maxMz)
+                        || !isBetweenInclusive(intensity,
+                                                        FLT_MIN,
+                                                        FLT_MAX))
+                        continue;
+                    float cutoff = massCutoff->massCutoffValue(mz);
+                    mzSlice* slice = new mzSlice(mz - cutoff,
+                                                 mz + cutoff,
+                                                 scan->rt - rtWindow,
+                                                 scan->rt + rtWindow);
+                    slice->ionCount = intensity;
+                    slice->rt = scan->rt;
+                    slice->mz = mz;
+                    slices.push_back(slice);
+                }
+            }
+        }
+
+        stable_sort(slices.begin(), slices.end(), [](mzSlice* a, mzSlice* b) {
+            if (a->mz == b->mz)
+                return a->rt < b->rt;
+            return a->mz < b->mz;
+        });
+        for (auto first = slices.begin(); first != slices.end(); ++first) {
+            mzSlice* firstSlice = *first;
+            if (firstSlice->ionCount == -1.0f)
+                continue;
+            for (auto second = next(first); second != slices.end(); ++second) {
+                mzSlice* secondSlice = *second;
+                if (firstSlice->mzmax < secondSlice->mzmin)
+                    break;
+                if (secondSlice->ionCount == -1.0f)
+                    continue;
+                if ((firstSlice->mz > secondSlice->mzmin
+                     && firstSlice->mz < secondSlice->mzmax
+                     && firstSlice->rt > secondSlice->rtmin
+                     && firstSlice->rt < secondSlice->rtmax)
+                    || (secondSlice->mz > firstSlice->mzmin
+                        && secondSlice->mz < firstSlice->mzmax
+                        && secondSlice->rt > firstSlice->rtmin
+                        && secondSlice->rt < firstSlice->rtmax)) {
+                    growSlice(firstSlice, secondSlice);
+                    limitSliceWindow(firstSlice, massCutoff);
+                    secondSlice->ionCount = -1.0f;
+                }
+            }
+        }
+        for (auto& slice : slices) {
+            if (slice->ionCount == -1.0f) {
+                delete slice;
+                slice = nullptr;
+            }
+        }
+        slices.erase(remove(slices.begin(), slices.end(), nullptr),
+                     slices.end());
+
+        sort(slices.begin(), slices.end(), mzSlice::compMz);
+        for (auto it = slices.begin(); it != slices.end(); ++it) {
+            mzSlice* slice = *it;
+            vector<mzSlice*> slicesToMerge;
+            for (auto ahead = next(it); ahead != slices.end(); ++ahead) {
+                auto comparison = referenceCompareSlices(samples,
+                                                         slice,
+                                                         *ahead,
+                                                         massCutoff,
+                                                         rtWindow);
+                if (comparison.first)
+                    slicesToMerge.push_back(*ahead);
+                if (!comparison.second)
+                    break;
+            }
+            if (it != slices.begin()) {
+                for (auto behind = prev(it);
+                     behind != slices.begin();
+                     --behind) {
+                    auto comparison = referenceCompareSlices(samples,
+                                                             slice,
+                                                             *behind,
+                                                             massCutoff,
+                                                             rtWindow);
+                    if (comparison.first)
+                        slicesToMerge.push_back(*behind);
+                    if (!comparison.second)
+                        break;
+                }
+            }
+            if (!slicesToMerge.empty()) {
+                for (auto merged : slicesToMerge)
+                    growSlice(slice, merged);
+                limitSliceWindow(slice, massCutoff);
+            }
+            for (auto merged : slicesToMerge) {
+                slices.erase(find(slices.begin(), slices.end(), merged));
+                delete merged;
+            }
+            it = find(slices.begin(), slices.end(), slice);
+        }
+
+        for (auto slice : slices) {
+            vector<EIC*> eics = PeakDetector::pullEICs(slice,
+                                                       samples,
+                                                       mavenParameters);
+            float highestIntensity = 0.0f;
+            float mzAtHighestIntensity = 0.0f;
+            for (auto eic : eics) {
+                if (eic->maxIntensity > highestIntensity) {
+                    highestIntensity = eic->maxIntensity;
+                    mzAtHighestIntensity = eic->mzAtMaxIntensity;
+                }
+            }
+            float cutoff = massCutoff->massCutoffValue(mzAtHighestIntensity);
+            slice->mzmin = mzAtHighestIntensity - cutoff;
+            slice->mzmax = mzAtHighestIntensity + cutoff;
+            slice->mz = (slice->mzmin + slice->mzmax) / 2.0f;
+            delete_all(eics);
+        }
+        return slices;
+    }
+
+    bool sameSlices(const vector<mzSlice*>& slices,
+                    const vector<mzSlice*>& expected)
+    {
+        if (slices.size() != expected.size())
+            return false;
+        for (size_t i = 0; i < slices.size(); i++) {
+            if (slices[i]->mzmin != expected[i]->mzmin
+                || slices[i]->mzmax != expected[i]->mzmax
+                || slices[i]->rtmin != expected[i]->rtmin
+                || slices[i]->rtmax != expected[i]->rtmax
+                || slices[i]->mz != expected[i]->mz
+                || slices[i]->rt != expected[i]->rt
+                || slices[i]->ionCount != expected[i]->ionCount)
+                return false;
+        }
+        return true;
+    }
+}
+
+/**
+ * Two samples of 120 MS1 scans with gaussian features, some of which lie
+ * within the mass cutoff of each other, so that slicing has to reduce and
+ * merge them.
+ */
+static vector<mzSample*> syntheticSamples()
+{
+    // m/z, rt at apex, apex intensity
+    const float features[][3] = {{150.0500f, 1.5f, 1.0e5f},
+                                 {150.0530f, 1.6f, 5.0e4f},
+                                 {300.1000f, 3.0f, 2.0e5f},
+                                 {300.1000f, 4.5f, 8.0e4f},
+                                 {300.1090f, 3.1f, 6.0e4f},
+                                 {450.2000f, 2.0f, 1.0e5f},
+                                 {612.3456f, 5.0f, 3.0e4f}};
+    const int featureCount = sizeof(features) / sizeof(features[0]);
+
+    vector<mzSample*> samples;
+    for (int s = 0; s < 2; s++) {
+        mzSample* sample = new mzSample();
+        for (int k = 0; k < 120; k++) {
+            float rt = 0.05f * k;
+            Scan* scan = new Scan(sample, k, 1, rt, 0.0f, 1);
+            for (int f = 0; f < featureCount; f++) {
+                float drt = (rt - features[f][1]) / 0.1f;
+                float intensity = features[f][2] * (1.0f - 0.2f * s)
+                                  * exp(-0.5f * drt * drt);
+                if (intensity < 100.0f)
+                    continue;
+                float jitter = 0.0002f * ((k + f) % 5 - 2);
+                scan->mz.push_back(features[f][0] + 0.0005f * s + jitter);
+                scan->intensity.push_back(intensity);
+            }
+            sample->addScan(scan);
+        }
+        sample->calculateMzRtRange();
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+void TestMassSlicer::testAlgorithmBSliceSet() {
+    MavenParameters mavenparameters;
+    mavenparameters.samples = syntheticSamples();
+    mavenparameters.showProgressFlag = false;
+
+    MassSlices massSlices;
+    massSlices.setSamples(mavenparameters.samples);
+    massSlices.setMavenParameters(&mavenparameters);
+    massSlices.algorithmB(mavenparameters.massCutoffMerge,
+                          mavenparameters.rtStepSize);
+
+    // slices found by the original, quadratic reduction and merging
+    const float expected[][5] = {
+        {150.0479f, 150.0539f, 0.650f, 2.450f, 100000.0f},
+        {300.0940f, 300.1060f, 2.150f, 3.950f, 200000.0f},
+        {300.0942f, 300.1062f, 3.650f, 5.350f, 80000.0f},
+        {450.1906f, 450.2086f, 1.150f, 2.850f, 100000.0f},
+        {612.3331f, 612.3577f, 4.200f, 5.800f, 30000.0f}};
+    const unsigned int expectedCount = sizeof(expected) / sizeof(expected[0]);
+
+    vector<mzSlice*> slices = massSlices.slices;
+    sort(slices.begin(), slices.end(), [](mzSlice* a, mzSlice* b) {
+        if (a->mz == b->mz)
+            return a->rt < b->rt;
+        return a->mz < b->mz;
+    });
+    QVERIFY(slices.size() == expectedCount);
+    for (unsigned int i = 0; i < expectedCount; i++) {
+        QVERIFY(abs(slices[i]->mzmin - expected[i][0]) < 1e-3f);
+        QVERIFY(abs(slices[i]->mzmax - expected[i][1]) < 1e-3f);
+        QVERIFY(abs(slices[i]->rtmin - expected[i][2]) < 1e-2f);
+        QVERIFY(abs(slices[i]->rtmax - expected[i][3]) < 1e-2f);
+        QVERIFY(abs(slices[i]->ionCount - expected[i][4]) < 1.0f);
+    }
+
+    delete_all(mavenparameters.samples);
+}
+
+void TestMassSlicer::testAlgorithmBMatchesReference() {
+    vector<mzSample*> synthetic = syntheticSamples();
+    vector<vector<mzSample*>> sampleSets = {synthetic,
+                                            maventests::samples.ms1TestSamples};
+
+    for (auto& samples : sampleSets) {
+        MavenParameters mavenparameters;
+        mavenparameters.samples = samples;
+        mavenparameters.showProgressFlag = false;
+
+        // a range of the bundled samples keeps the reference fast enough
+        float minMz = 100.0f;
+        float maxMz = 700.0f;
+        float minRt = 0.0f;
+        float maxRt = 8.0f;
+
+        MassSlices massSlices;
+        massSlices.setSamples(samples);
+        massSlices.setMavenParameters(&mavenparameters);
+        massSlices.setMinMz(minMz);
+        massSlices.setMaxMz(maxMz);
+        massSlices.setMinRt(minRt);
+        massSlices.setMaxRt(maxRt);
+        massSlices.algorithmB(mavenparameters.massCutoffMerge,
+                              mavenparameters.rtStepSize);
+
+        vector<mzSlice*> expected = referenceAlgorithmB(&mavenparameters,
+                                                        minMz,
+                                                        maxMz,
+                                                        minRt,
+                                                        maxRt);
+        QVERIFY(!expected.empty());
+        QVERIFY(sameSlices(massSlices.slices, expected));
+        delete_all(expected);
+    }
+
+    delete_all(synthetic);
+}
@@ -10,6 +10,54 @@
 #include "isotopeDetection.h"
 #include "classifierNeuralNet.h"
 
+namespace {
+
+// same groups, in the same order, with the same peaks
+bool sameGroups(vector<PeakGroup>& a, vector<PeakGroup>& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        PeakGroup& x = a[i];
+        PeakGroup& y = b[i];
+        if (x.getCompound() != y.getCompound() || x.meanMz != y.meanMz
+            || x.meanRt != y.meanRt || x.maxIntensity != y.maxIntensity
+            || x.groupRank != y.groupRank || x.peaks.size() != y.peaks.size())
+            return false;
+
+        for (size_t j = 0; j < x.peaks.size(); j++) {
+            Peak& p = x.peaks[j];
+            Peak& q = y.peaks[j];
+            if (p.getSample() != q.getSample() || p.pos != q.pos
+                || p.minpos != q.minpos || p.maxpos != q.maxpos
+                || p.peakIntensity != q.peakIntensity
+                || p.peakAreaCorrected != q.peakAreaCorrected)
+                return false;
+        }
+    }
+    return true;
+}
+
+vector<PeakGroup> detectWithThreads(int threads,
+                                    vector<Compound*>& compounds,
+                                    MavenParameters* mavenparameters)
+{
+    int maxThreads = omp_get_max_threads();
+    omp_set_num_threads(threads);
+
+    PeakDetector peakDetector;
+    peakDetector.setMavenParameters(mavenparameters);
+    vector<mzSlice*> slices =
+        peakDetector.processCompounds(compounds, "compounds");
+    peakDetector.processSlices(slices, "compounds");
+
+    omp_set_num_threads(maxThreads);
+    return mavenparameters->allgroups;
+}
+
+}
+
 TestPeakDetection::TestPeakDetection() {
     loadCompoundDB = "bin/methods/qe3_v11_2016_04_29.csv";
     loadCompoundDB1 = "bin/methods/KNOWNS.csv";
@@ -97,3 +145,39 @@ void TestPeakDetection::testprocessSlices() {
     QVERIFY(allgroups.size() > 0);
 
 }
+
+void TestPeakDetection::testProcessSlicesAcrossThreads() {
+    maventests::database.loadCompoundCSVFile(loadCompoundDB);
+    vector<Compound*> compounds =
+        maventests::database.getCompoundsSubset("qe3_v11_2016_04_29");
+
+    vector<mzSample*> samplesToLoad;
+    MavenParameters* mavenparameters = new MavenParameters();
+    TestUtils::loadSamplesAndParameters(samplesToLoad, mavenparameters);
+    mavenparameters->showProgressFlag = false;
+
+    int threads = max(4, omp_get_num_procs());
+
+    vector<PeakGroup> serial = detectWithThreads(1,
+                                                 compounds,
+                                                 mavenparameters);
+    vector<PeakGroup> parallel;
+    QVERIFY(serial.size() > 1);
+    parallel = detectWithThreads(threads, compounds, mavenparameters);
+    QVERIFY(sameGroups(serial, parallel));
+
+    // only the best group of every slice is kept
+    mavenparameters->eicMaxGroups = 1;
+    serial = detectWithThreads(1, compounds, mavenparameters);
+    QVERIFY(serial.size() > 1);
+    parallel = detectWithThreads(threads, compounds, mavenparameters);
+    QVERIFY(sameGroups(serial, parallel));
+
+    // detection stops at the same slice once the group limit is exceeded
+    mavenparameters->limitGroupCount = serial.size() / 2;
+    serial = detectWithThreads(1, compounds, mavenparameters);
+    QVERIFY(serial.size() <= static_cast<size_t>(
+                                 mavenparameters->limitGroupCount + 1));
+    parallel = detectWithThreads(threads, compounds, mavenparameters);
+    QVERIFY(sameGroups(serial, parallel));
+}
@@ -30,6 +30,7 @@ class TestPeakDetection : public QObject {
         void testProcessCompound();
         void testPullEICs();
         void testprocessSlices();
+        void testProcessSlicesAcrossThreads();
 };
 
 #endif // TESTPEAKDETECTION_H
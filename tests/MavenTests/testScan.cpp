@@ -311,3 +311,10 @@ void TestScan::testgetTopPeaks() {
     QVERIFY(TestUtils::floatCompare(selected[0].second,(float) 2.06999993));
     QVERIFY(TestUtils::floatCompare(selected[1].second,(float) 8.8000001));
 }
+
+void TestScan::testScanFootprint() {
+    // samples hold hundreds of thousands of scans, keep the record lean
+    // and free of per-scan stream or scratch state
+    qDebug() << "Scan size:" << sizeof(Scan) << "bytes";
+    QVERIFY(sizeof(Scan) < sizeof(ofstream));
+}
@@ -2,6 +2,44 @@
 #include "base64.h"
 #include "utilities.h"
 
+#include <algorithm>
+
+namespace {
+    // reference encoder used to build inputs long enough for the vectorized
+    // decoding paths
+    string encodeBase64(const string& bytes)
+    {
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "abcdefghijklmnopqrstuvwxyz0123456789+/";
+        string encoded;
+        for (size_t i = 0; i < bytes.size(); i += 3) {
+            unsigned int n = (unsigned char)bytes[i] << 16;
+            if (i + 1 < bytes.size()) n |= (unsigned char)bytes[i + 1] << 8;
+            if (i + 2 < bytes.size()) n |= (unsigned char)bytes[i + 2];
+            encoded += alphabet[n >> 18 & 63];
+            encoded += alphabet[n >> 12 & 63];
+            encoded += i + 1 < bytes.size() ? alphabet[n >> 6 & 63] : '=';
+            encoded += i + 2 < bytes.size() ? alphabet[n & 63] : '=';
+        }
+        return encoded;
+    }
+
+    template <typename T>
+    string packValues(const vector<double>& values, bool networkorder)
+    {
+        string bytes;
+        for (double value : values) {
+            T v = static_cast<T>(value);
+            char raw[sizeof(T)];
+            memcpy(raw, &v, sizeof(T));
+            if (networkorder)
+                std::reverse(raw, raw + sizeof(T));
+            bytes.append(raw, sizeof(T));
+        }
+        return bytes;
+    }
+}
+
 Testbase64::Testbase64() {
 
 }
@@ -23,6 +61,7 @@ void Testbase64::init() {
 
 void Testbase64::cleanup() {
     // This function is executed after each test
+    base64::forceDecoder("");
 }
 
 void Testbase64::testdecodeBase64()
@@ -36,6 +75,121 @@ void Testbase64::testdecodeBase64()
     QVERIFY(TestUtils::floatCompare(decodedArray[2],70.0742645263672));
 }
 
+void Testbase64::testdecodeBase64Compressed()
+{
+    // same values as above, zlib compressed before encoding
+    string b64String="eJxz6lH85SpQIOrUo8YGABvbA74=";
+
+    for (const string& decoder : base64::supportedDecoders()) {
+        QVERIFY(base64::forceDecoder(decoder));
+        QVERIFY(base64::decoderName() == decoder);
+
+        // stale contents of the output array must be replaced
+        vector<float> decodedArray(10, 1.0f);
+        QVERIFY2(base64::decodeBase64(b64String.c_str(), b64String.size(), 4,
+                                      true, true, decodedArray),
+                 decoder.c_str());
+
+        QVERIFY2(decodedArray.size()==3, decoder.c_str());
+        QVERIFY2(TestUtils::floatCompare(decodedArray[0],70.0663604736328),
+                 decoder.c_str());
+        QVERIFY2(TestUtils::floatCompare(decodedArray[1],2311.00512695312),
+                 decoder.c_str());
+        QVERIFY2(TestUtils::floatCompare(decodedArray[2],70.0742645263672),
+                 decoder.c_str());
+
+        // a truncated stream is reported instead of decoding to partial data
+        string truncated = b64String.substr(0, 16);
+        QVERIFY2(!base64::decodeBase64(truncated.c_str(), truncated.size(), 4,
+                                       true, true, decodedArray),
+                 decoder.c_str());
+        QVERIFY2(decodedArray.empty(), decoder.c_str());
+    }
+}
+
+void Testbase64::testdecodeBase64LongArrays()
+{
+    // every kernel the CPU can run is checked, not only the default one
+    QVERIFY(!base64::forceDecoder("unknown"));
+    for (const string& decoder : base64::supportedDecoders()) {
+        QVERIFY(base64::forceDecoder(decoder));
+        QVERIFY(base64::decoderName() == decoder);
+
+        // lengths around the vector widths exercise the scalar tail handling
+        for (size_t count : {1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 33, 100, 1001}) {
+            vector<double> values;
+            for (size_t i = 0; i < count; i++)
+                values.push_back(100.0 + i * 0.37);
+
+            for (bool networkorder : {false, true}) {
+                string b64Float = encodeBase64(
+                    packValues<float>(values, networkorder));
+                vector<float> decodedFloats =
+                    base64::decodeBase64(b64Float, 4, networkorder, false);
+                QVERIFY2(decodedFloats.size() == count, decoder.c_str());
+
+                string b64Double = encodeBase64(
+                    packValues<double>(values, networkorder));
+                vector<float> decodedDoubles =
+                    base64::decodeBase64(b64Double, 8, networkorder, false);
+                QVERIFY2(decodedDoubles.size() == count, decoder.c_str());
+
+                for (size_t i = 0; i < count; i++) {
+                    QVERIFY2(decodedFloats[i] == static_cast<float>(values[i]),
+                             decoder.c_str());
+                    QVERIFY2(decodedDoubles[i]
+                                 == static_cast<float>(values[i]),
+                             decoder.c_str());
+                }
+            }
+        }
+
+        // characters outside the standard alphabet hand over to the scalar
+        // path
+        string text(300, 'x');
+        string b64String = encodeBase64(text);
+        b64String[200] = '-';
+        string dest = base64::decodeString(b64String.c_str(),
+                                           b64String.size());
+        QVERIFY2(dest.size() == text.size(), decoder.c_str());
+        QVERIFY2(dest.compare(0, 150, text, 0, 150) == 0, decoder.c_str());
+        QVERIFY2(dest.compare(153, string::npos, text, 153, string::npos) == 0,
+                 decoder.c_str());
+    }
+}
+
+void Testbase64::benchmarkdecodeBase64()
+{
+    // timing a megabyte-scale decode only tells something on a quiet
+    // machine, so the benchmark is opt-in
+    if (qgetenv("MAVEN_BENCHMARK").isEmpty())
+        QSKIP("set MAVEN_BENCHMARK to measure base64 decoding throughput");
+
+    vector<double> values(1 << 20);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = 50.0 + (i % 10007) * 0.13;
+    string b64String = encodeBase64(packValues<double>(values, true));
+
+    for (const string& decoder : base64::supportedDecoders()) {
+        QVERIFY(base64::forceDecoder(decoder));
+
+        vector<float> decodedArray;
+        const int iterations = 10;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; i++) {
+            base64::decodeBase64(b64String.c_str(), b64String.size(), 8, true,
+                                 false, decodedArray);
+        }
+        double seconds = std::max(timer.nsecsElapsed() / 1e9, 1e-9);
+        double megabytes = b64String.size() * iterations / (1024.0 * 1024.0);
+
+        qDebug() << "base64 decoder:" << base64::decoderName()
+                 << "throughput:" << megabytes / seconds << "MB/s";
+        QVERIFY(decodedArray.size() == values.size());
+    }
+}
+
 void Testbase64::testdecodeString()
 {
     string b64String="bWF2ZW4gaXMgYXdlc29tZQ==";
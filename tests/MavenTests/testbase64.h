@@ -27,6 +27,9 @@ class Testbase64 : public QObject {
         // test functions - all functions prefixed with "test" will be ran as tests
         // this is automatically detected thanks to Qt's meta-information about QObjects
         void testdecodeBase64();
+        void testdecodeBase64Compressed();
+        void testdecodeBase64LongArrays();
+        void benchmarkdecodeBase64();
         void testdecodeString();
 };
 